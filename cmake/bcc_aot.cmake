@@ -0,0 +1,23 @@
+# Copyright (c) Google LLC
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+# bcc_aot_object(<output> <source> [CFLAGS <flag>...])
+#
+# Compiles the bcc program <source> ahead of time into <output>, relative to
+# the current binary dir, for BccObjectLoader to load on hosts without LLVM.
+# The program is built against the kernel headers of the build host, or of
+# BCC_KERNEL_SOURCE when set. List <output> in the sources of a target (or
+# add_custom_target on it) to have it built.
+function(bcc_aot_object output source)
+  cmake_parse_arguments(AOT "" "" "CFLAGS" ${ARGN})
+  if(TARGET bcc-aot)
+    set(bcc_aot bcc-aot)
+  else()
+    find_program(bcc_aot bcc-aot)
+  endif()
+  get_filename_component(src ${source} ABSOLUTE)
+  add_custom_command(OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/${output}
+    COMMAND ${bcc_aot} -o ${CMAKE_CURRENT_BINARY_DIR}/${output} ${src} ${AOT_CFLAGS}
+    DEPENDS ${src} ${bcc_aot}
+    COMMENT "Compiling BPF program ${source}")
+endfunction()
@@ -113,8 +113,9 @@ static int handle_get_next_errno(int eno)
 
 static void print_prog_hdr(void)
 {
-  printf("%9s %-15s %8s %6s %-12s %-15s\n",
-         "BID", "TYPE", "UID", "#MAPS", "LoadTime", "NAME");
+  printf("%9s %-15s %8s %6s %-12s %12s %10s %-15s\n",
+         "BID", "TYPE", "UID", "#MAPS", "LoadTime", "RunCnt", "NsPerRun",
+         "NAME");
 }
 
 static void print_prog_info(const struct bpf_prog_info *prog_info)
@@ -124,6 +125,7 @@ static void print_prog_info(const struct bpf_prog_info *prog_info)
   char unknown_prog_type[16];
   const char *prog_type;
   char load_time[16];
+  char ns_per_run[24];
   struct tm load_tm;
 
   if (prog_info->type > LAST_KNOWN_PROG_TYPE) {
@@ -149,14 +151,23 @@ static void print_prog_info(const struct bpf_prog_info *prog_info)
              prog_info->load_time / 1000000000);
   load_time[sizeof(load_time) - 1] = '\0';
 
+  /* Only counted while kernel.bpf_stats_enabled or BPF_ENABLE_STATS is on */
+  if (prog_info->run_cnt)
+    snprintf(ns_per_run, sizeof(ns_per_run), "%llu",
+             prog_info->run_time_ns / prog_info->run_cnt);
+  else
+    snprintf(ns_per_run, sizeof(ns_per_run), "-");
+
   if (prog_info->jited_prog_len)
-    printf("%9u %-15s %8u %6u %-12s %-15s\n",
+    printf("%9u %-15s %8u %6u %-12s %12llu %10s %-15s\n",
            prog_info->id, prog_type, prog_info->created_by_uid,
-           prog_info->nr_map_ids, load_time, prog_info->name);
+           prog_info->nr_map_ids, load_time, prog_info->run_cnt, ns_per_run,
+           prog_info->name);
   else
-    printf("%8u- %-15s %8u %6u %-12s %-15s\n",
+    printf("%8u- %-15s %8u %6u %-12s %12llu %10s %-15s\n",
            prog_info->id, prog_type, prog_info->created_by_uid,
-           prog_info->nr_map_ids, load_time, prog_info->name);
+           prog_info->nr_map_ids, load_time, prog_info->run_cnt, ns_per_run,
+           prog_info->name);
 }
 
 static void print_map_hdr(void)
@@ -323,6 +334,9 @@ void usage(void)
   printf("Usage: bps [bpf-prog-id]\n");
   printf("    [bpf-prog-id] If specified, it shows the details info of the bpf-prog\n");
   printf("\n");
+  printf("RunCnt and NsPerRun are only counted while the kernel.bpf_stats_enabled\n"
+         "sysctl is set or a BPF_ENABLE_STATS fd is open (Linux 5.1 and 5.8).\n");
+  printf("\n");
 }
 
 int main(int argc, char **argv)
@@ -23,12 +23,14 @@ statdir = os.path.join("stats", timestamp)
 os.mkdir(statdir)
 print("Collecting stat and save to dir: %s" % statdir)
 
-for outdir in os.listdir("."): 
+stats = dict()
+for outdir in sorted(os.listdir(".")): 
     if outdir[:6] == "output": 
         stat = dict()
         task = outdir[7:]
         if not task:
             task = "baseline"
+        stats[task] = stat
         
         for out_file in os.listdir(outdir): 
             job_name, out_format = out_file.split('.')
@@ -66,3 +68,32 @@ for outdir in os.listdir("."):
                 cpu_util = sum(map(float, job_stat["cpu"][:3] + job_stat["cpu"][5:]))
                 writer.writerow([job_name, job_stat["lat"]["mean"], job_stat["lat"]["50p"], job_stat["lat"]["90p"], 
                         job_stat["lat"]["99p"], job_stat["bw"]] + job_stat["cpu"] + [cpu_util, cpu_util*4./job_stat["bw"]])
+
+
+# compare the runs of target to the ones of base, written to name
+def compare(target, base, name):
+    target_stat = stats.get(target)
+    base_stat = stats.get(base)
+    if not target_stat or not base_stat:
+        return
+    with open(os.path.join(statdir, name), "w") as csv_w:
+        writer = csv.writer(csv_w)
+        writer.writerow(["Job name", "Lat(us)", "99 Percentile", "BW(KB/s)", "CPU-per-io"])
+        for job_name in sorted(set(base_stat) & set(target_stat)):
+            row = [job_name]
+            for key in ("mean", "99p"):
+                row.append(cmpr(target_stat[job_name]["lat"][key],
+                                base_stat[job_name]["lat"][key]))
+            row.append(cmpr(target_stat[job_name]["bw"], base_stat[job_name]["bw"]))
+            cpu_per_io = []
+            for job_stat in (target_stat[job_name], base_stat[job_name]):
+                cpu_util = sum(map(float, job_stat["cpu"][:3] + job_stat["cpu"][5:]))
+                cpu_per_io.append(cpu_util*4./job_stat["bw"])
+            row.append(cmpr(*cpu_per_io))
+            writer.writerow(row)
+
+
+# the eBPF tracing attached with fentry against the one with kprobes, and
+# ioflow following requests on raw tracepoints against kprobes
+compare("ebpf-fentry", "ebpf-kprobe", "fentry-vs-kprobe.csv")
+compare("ioflow-tp", "ioflow-kprobe", "tp-vs-kprobe.csv")
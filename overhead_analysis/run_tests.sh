@@ -1,5 +1,9 @@
 #!/bin/bash
 # Run fio tests on different modes: 0 - blockhisto disabled; 1 - blockhisto enabled
+# With blockhisto disabled, the eBPF tracing is run twice: attached with kprobes, then
+# with fentry (BPF trampolines), which blkrqhist.py falls back from if unsupported.
+# ioflow-read.py is then run following the block requests with kprobes, then with the
+# block_rq_* raw tracepoints.
 # Place the fio job files in directory "job_files". 
 
 BCC=../bcc      # specify path to bcc script here
@@ -36,7 +40,7 @@ then
     exit 1
 fi 
 
-for cnt in 1 2
+for cnt in 1 2 3 4 5
 do 
     if [ $cnt -eq 1 -a $1 -eq 0 ]
     then 
@@ -50,12 +54,40 @@ do
 
     elif [ $cnt -eq 2 -a $1 -eq 0 ]
     then
-        outdir=./output-ebpf
-        echo "Run with eBpf tracing"
-        sudo python $BCC/blkrqhist.py &  # run ebpf script at backgroud 
+        outdir=./output-ebpf-kprobe
+        echo "Run with eBpf tracing on kprobes"
+        sudo python $BCC/blkrqhist.py -K &  # run ebpf script at backgroud 
         pid=$!
         sleep 5     # ensure tracing tool has started
 
+    elif [ $cnt -eq 3 -a $1 -eq 0 ]
+    then
+        outdir=./output-ebpf-fentry
+        echo "Run with eBpf tracing on fentry"
+        sudo python $BCC/blkrqhist.py &
+        pid=$!
+        sleep 5
+
+    elif [ $cnt -eq 4 -a $1 -eq 0 ]
+    then
+        outdir=./output-ioflow-kprobe
+        echo "Run with ioflow tracing requests on kprobes"
+        cd $BCC/ioflow      # ioflow reads its BPF source from the current directory
+        sudo python ./ioflow-read.py -Q > /dev/null &
+        pid=$!
+        cd - > /dev/null
+        sleep 5
+
+    elif [ $cnt -eq 5 -a $1 -eq 0 ]
+    then
+        outdir=./output-ioflow-tp
+        echo "Run with ioflow tracing requests on raw tracepoints"
+        cd $BCC/ioflow
+        sudo python ./ioflow-read.py > /dev/null &
+        pid=$!
+        cd - > /dev/null
+        sleep 5
+
     else
         outdir=""
     fi 
@@ -65,7 +97,7 @@ do
         do_test
     fi
 
-    if [ $cnt -eq 2 -a $1 -eq 0 ]
+    if [ $cnt -ge 2 -a $1 -eq 0 ]
     then
         # kill ebpf tracing script at background 
         sudo kill -s 2 $pid
@@ -75,7 +107,8 @@ do
     echo "Current run of tests finished."
 done
 
-if [ -d ./output -a -d ./output-ebpf -a -d ./output-blkhist ]
+if [ -d ./output -a -d ./output-ebpf-kprobe -a -d ./output-ebpf-fentry -a -d ./output-ioflow-kprobe \
+     -a -d ./output-ioflow-tp -a -d ./output-blkhist ]
 then 
     mkdir -p stats
     echo "Collecting stat ..."
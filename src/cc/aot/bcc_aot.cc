@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// bcc-aot compiles a bcc program into an object that BccObjectLoader loads
+// without clang or LLVM:
+//
+//   bcc-aot -o prog.bcco prog.c [cflags...]
+
+#include <getopt.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bpf_module.h"
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-d debug_flags] -o OUTPUT SOURCE [CFLAGS...]\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  std::string output;
+  unsigned flags = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "+d:o:h")) != -1) {
+    switch (opt) {
+    case 'd':
+      flags = strtoul(optarg, nullptr, 0);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (output.empty() || optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::ifstream in(argv[optind]);
+  if (!in) {
+    fprintf(stderr, "could not open %s\n", argv[optind]);
+    return 1;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+
+  std::vector<const char *> cflags(argv + optind + 1, argv + argc);
+  ebpf::BPFModule mod(flags, nullptr, false);
+  if (mod.compile_object(text.str(), cflags.data(), cflags.size(), output)) {
+    fprintf(stderr, "could not compile %s\n", argv[optind]);
+    return 1;
+  }
+  return 0;
+}
@@ -16,13 +16,21 @@
 
 #include <linux/bpf.h>
 #include <linux/perf_event.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -98,6 +106,67 @@ StatusTuple BPF::init(const std::string& bpf_program,
   return StatusTuple::OK();
 };
 
+StatusTuple BPF::set_pin_dir(const std::string& dir) {
+  for (const std::string& d : {dir, dir + "/maps", dir + "/links"}) {
+    if (mkdir(d.c_str(), 0700) && errno != EEXIST)
+      return StatusTuple(-1, "Unable to create %s: %s", d.c_str(),
+                         std::strerror(errno));
+  }
+  pin_dir_ = dir;
+  bpf_module_->set_pin_dir(dir);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::unpin_all() {
+  if (pin_dir_.empty())
+    return StatusTuple::OK();
+
+  std::string err_msg;
+  for (const std::string& d : {pin_dir_ + "/maps", pin_dir_ + "/links"}) {
+    DIR* dir = opendir(d.c_str());
+    if (!dir) {
+      err_msg += "Unable to open " + d + ": " + std::strerror(errno) + "\n";
+      continue;
+    }
+    while (struct dirent* ent = readdir(dir)) {
+      if (ent->d_name[0] == '.')
+        continue;
+      std::string path = d + "/" + ent->d_name;
+      if (unlink(path.c_str()))
+        err_msg += "Unable to unpin " + path + ": " + std::strerror(errno) +
+                   "\n";
+    }
+    closedir(dir);
+  }
+
+  if (!err_msg.empty())
+    return StatusTuple(-1, err_msg);
+  return StatusTuple::OK();
+}
+
+std::vector<StatusTuple> BPF::init_parallel(
+    const std::vector<BPF*>& bpfs, const std::vector<std::string>& programs,
+    const std::vector<std::string>& cflags, unsigned int nthreads) {
+  size_t count = std::min(bpfs.size(), programs.size());
+  std::vector<StatusTuple> res(count, StatusTuple::OK());
+  if (nthreads == 0)
+    nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+  nthreads = std::min<size_t>(nthreads, count);
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++)
+      res[i] = bpfs[i]->init(programs[i], cflags);
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < nthreads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& t : threads)
+    t.join();
+  return res;
+}
+
 BPF::~BPF() {
   auto res = detach_all();
   if (res.code() != 0)
@@ -105,29 +174,57 @@ BPF::~BPF() {
               << res.msg() << std::endl;
   bcc_free_buildsymcache(bsymcache_);
   bsymcache_ = NULL;
+  bcc_disable_stats(stats_fd_, stats_sysctl_);
 }
 
 StatusTuple BPF::detach_all() {
   bool has_error = false;
   std::string error_msg;
 
-  for (auto& it : kprobes_) {
-    auto res = detach_kprobe_event(it.first, it.second);
+  for (const auto& u : usdt_) {
+    if (!u.shared_ || usdt_pids_.find(u.probe_func_) == usdt_pids_.end())
+      continue;
+    auto res = detach_shared_usdt(u);
     if (res.code() != 0) {
-      error_msg += "Failed to detach kprobe event " + it.first + ": ";
+      error_msg += "Failed to detach shared USDT " + u.print_name() + ": ";
       error_msg += res.msg() + "\n";
       has_error = true;
     }
   }
 
-  for (auto& it : uprobes_) {
-    auto res = detach_uprobe_event(it.first, it.second);
+  std::vector<std::string> events;
+  for (auto& it : kprobes_)
+    events.push_back(it.first);
+  auto kprobe_res = detach_probe_events(kprobes_, events, true, 0);
+  for (size_t i = 0; i < events.size(); i++) {
+    if (kprobe_res[i].code() != 0) {
+      error_msg += "Failed to detach kprobe event " + events[i] + ": ";
+      error_msg += kprobe_res[i].msg() + "\n";
+      has_error = true;
+    }
+  }
+
+  events.clear();
+  for (auto& it : uprobes_)
+    events.push_back(it.first);
+  auto uprobe_res = detach_probe_events(uprobes_, events, false, 0);
+  for (size_t i = 0; i < events.size(); i++) {
+    if (uprobe_res[i].code() != 0) {
+      error_msg += "Failed to detach uprobe event " + events[i] + ": ";
+      error_msg += uprobe_res[i].msg() + "\n";
+      has_error = true;
+    }
+  }
+
+  for (auto& it : trampolines_) {
+    auto res = detach_trampoline(it.second);
     if (res.code() != 0) {
-      error_msg += "Failed to detach uprobe event " + it.first + ": ";
+      error_msg += "Failed to detach trampoline for " + it.first + ": ";
       error_msg += res.msg() + "\n";
       has_error = true;
     }
   }
+  trampolines_.clear();
 
   for (auto& it : tracepoints_) {
     auto res = detach_tracepoint_event(it.first, it.second);
@@ -194,11 +291,19 @@ StatusTuple BPF::attach_kprobe(const std::string& kernel_func,
                                const std::string& probe_func,
                                uint64_t kernel_func_offset,
                                bpf_probe_attach_type attach_type,
-                               int maxactive) {
+                               int maxactive, bool fentry) {
   std::string probe_event = get_kprobe_event(kernel_func, attach_type);
-  if (kprobes_.find(probe_event) != kprobes_.end())
+  if (kprobes_.find(probe_event) != kprobes_.end() ||
+      trampolines_.find(probe_event) != trampolines_.end())
     return StatusTuple(-1, "kprobe %s already attached", probe_event.c_str());
 
+  // Fall back to the kprobe if the function cannot be traced with a
+  // trampoline, e.g. as it is not in the kernel BTF
+  if (fentry && kernel_func_offset == 0 &&
+      attach_trampoline(kernel_func, probe_func, attach_type, probe_event)
+              .code() == 0)
+    return StatusTuple::OK();
+
   int probe_fd;
   TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
 
@@ -264,16 +369,15 @@ StatusTuple BPF::attach_uprobe(const std::string& binary_path,
   return StatusTuple::OK();
 }
 
-StatusTuple BPF::attach_usdt_without_validation(const USDT& u, pid_t pid) {
+StatusTuple BPF::attach_usdt_locations(const USDT& u,
+                                       const std::string& probe_func,
+                                       pid_t pid) {
   auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
-  if (!probe.enable(u.probe_func_))
-    return StatusTuple(-1, "Unable to enable USDT %s" + u.print_name());
-
   bool failed = false;
   std::string err_msg;
   int cnt = 0;
   for (const auto& loc : probe.locations_) {
-    auto res = attach_uprobe(loc.bin_path_, std::string(), u.probe_func_,
+    auto res = attach_uprobe(loc.bin_path_, std::string(), probe_func,
                               loc.address_, BPF_PROBE_ENTRY, pid);
     if (!res.ok()) {
       failed = true;
@@ -297,6 +401,76 @@ StatusTuple BPF::attach_usdt_without_validation(const USDT& u, pid_t pid) {
   }
 }
 
+StatusTuple BPF::attach_usdt_without_validation(const USDT& u, pid_t pid) {
+  if (u.shared_)
+    return attach_shared_usdt(u, pid);
+
+  auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
+  if (!probe.enable(u.probe_func_))
+    return StatusTuple(-1, "Unable to enable USDT %s" + u.print_name());
+
+  return attach_usdt_locations(u, u.probe_func_, pid);
+}
+
+// The shared probe is attached to all processes the first time, later calls
+// only add pid to the set.
+StatusTuple BPF::attach_shared_usdt(const USDT& u, pid_t pid) {
+  if (usdt_pids_.find(u.probe_func_) == usdt_pids_.end()) {
+    int probe_fd;
+    TRY2(load_func(u.probe_func_, BPF_PROG_TYPE_KPROBE, probe_fd));
+    auto progs = get_prog_table(u.probe_func_ + "__usdt_prog");
+    auto res = progs.update_value(0, probe_fd);
+    if (res.ok())
+      res = attach_usdt_locations(u, u.probe_func_ + "__usdt", -1);
+    if (!res.ok()) {
+      progs.remove_value(0);
+      unload_func(u.probe_func_);
+      return res;
+    }
+    usdt_pids_[u.probe_func_];
+  }
+
+  if (pid > 0)
+    return add_usdt_pid_without_validation(u, pid);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::add_usdt_pid_without_validation(const USDT& u, pid_t pid) {
+  auto it = usdt_pids_.find(u.probe_func_);
+  if (it == usdt_pids_.end())
+    return StatusTuple(-1, "Shared USDT %s is not attached",
+                       u.print_name().c_str());
+  if (it->second.count(pid))
+    return StatusTuple::OK();
+
+  auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
+  if (probe.need_enable() && !probe.add_to_semaphore(pid, +1))
+    return StatusTuple(-1, "Unable to enable USDT %s in PID %d",
+                       u.print_name().c_str(), pid);
+
+  auto pids = get_hash_table<uint32_t, uint8_t>(u.probe_func_ + "__usdt_pids");
+  uint32_t key = pid;
+  auto res = pids.update_value(key, 1);
+  if (!res.ok()) {
+    if (probe.need_enable())
+      probe.add_to_semaphore(pid, -1);
+    return res;
+  }
+  it->second.insert(pid);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::add_usdt_pid(const USDT& usdt, pid_t pid) {
+  for (const auto& u : usdt_) {
+    if (u == usdt && u.shared_) {
+      return add_usdt_pid_without_validation(u, pid);
+    }
+  }
+
+  return StatusTuple(-1, "Shared USDT %s not found",
+                     usdt.print_name().c_str());
+}
+
 StatusTuple BPF::attach_usdt(const USDT& usdt, pid_t pid) {
   for (const auto& u : usdt_) {
     if (u == usdt) {
@@ -358,7 +532,19 @@ StatusTuple BPF::attach_raw_tracepoint(const std::string& tracepoint, const std:
   int probe_fd;
   TRY2(load_func(probe_func, BPF_PROG_TYPE_RAW_TRACEPOINT, probe_fd));
 
-  int res_fd = bpf_attach_raw_tracepoint(probe_fd, tracepoint.c_str());
+  // Adopt the link pinned by an earlier instance running the same program,
+  // which kept running in between
+  std::string link_name = "raw_" + tracepoint;
+  int res_fd = open_pinned_link(link_name, probe_fd);
+  if (res_fd >= 0) {
+    open_probe_t p = {};
+    p.perf_event_fd = res_fd;
+    p.func = probe_func;
+    raw_tracepoints_[tracepoint] = std::move(p);
+    return StatusTuple::OK();
+  }
+
+  res_fd = bpf_attach_raw_tracepoint(probe_fd, tracepoint.c_str());
 
   if (res_fd < 0) {
     TRY2(unload_func(probe_func));
@@ -366,6 +552,13 @@ StatusTuple BPF::attach_raw_tracepoint(const std::string& tracepoint, const std:
                        tracepoint.c_str(), probe_func.c_str());
   }
 
+  auto res = pin_link(res_fd, link_name);
+  if (!res.ok()) {
+    close(res_fd);
+    TRY2(unload_func(probe_func));
+    return res;
+  }
+
   open_probe_t p = {};
   p.perf_event_fd = res_fd;
   p.func = probe_func;
@@ -458,6 +651,14 @@ StatusTuple BPF::detach_kprobe(const std::string& kernel_func,
                                bpf_probe_attach_type attach_type) {
   std::string event = get_kprobe_event(kernel_func, attach_type);
 
+  auto tramp = trampolines_.find(event);
+  if (tramp != trampolines_.end()) {
+    unpin_link(event);
+    TRY2(detach_trampoline(tramp->second));
+    trampolines_.erase(tramp);
+    return StatusTuple::OK();
+  }
+
   auto it = kprobes_.find(event);
   if (it == kprobes_.end())
     return StatusTuple(-1, "No open %skprobe for %s",
@@ -490,7 +691,265 @@ StatusTuple BPF::detach_uprobe(const std::string& binary_path,
   return StatusTuple::OK();
 }
 
-StatusTuple BPF::detach_usdt_without_validation(const USDT& u, pid_t pid) {
+std::vector<StatusTuple> BPF::attach_kprobes(
+    const std::vector<std::string>& kernel_funcs,
+    const std::string& probe_func, bpf_probe_attach_type attach_type,
+    int maxactive, unsigned int nthreads) {
+  std::vector<StatusTuple> res(kernel_funcs.size(), StatusTuple::OK());
+  std::vector<std::string> events;
+  std::vector<size_t> index;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < kernel_funcs.size(); i++) {
+    std::string event = get_kprobe_event(kernel_funcs[i], attach_type);
+    if (kprobes_.find(event) != kprobes_.end() || !seen.insert(event).second) {
+      res[i] = StatusTuple(-1, "kprobe %s already attached", event.c_str());
+      continue;
+    }
+    events.push_back(std::move(event));
+    index.push_back(i);
+  }
+
+  std::vector<bcc_probe_target> targets(events.size());
+  for (size_t i = 0; i < targets.size(); i++) {
+    targets[i].attach_type = attach_type;
+    targets[i].name = kernel_funcs[index[i]].c_str();
+    targets[i].maxactive = maxactive;
+  }
+  auto status = attach_probe_events(kprobes_, events, targets, probe_func,
+                                    true, nthreads);
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (status.code() != 0)
+      res[index[i]] = status;
+    else if (targets[i].pfd < 0)
+      res[index[i]] = StatusTuple(
+          -1, "Unable to attach %skprobe for %s using %s: %s",
+          attach_type_debug(attach_type).c_str(), targets[i].name,
+          probe_func.c_str(), std::strerror(targets[i].err));
+  }
+  return res;
+}
+
+std::vector<StatusTuple> BPF::attach_uprobes(
+    const std::string& binary_path, const std::vector<std::string>& symbols,
+    const std::string& probe_func, bpf_probe_attach_type attach_type,
+    pid_t pid, unsigned int nthreads) {
+  std::vector<StatusTuple> res(symbols.size(), StatusTuple::OK());
+  std::vector<std::string> events;
+  std::vector<uint64_t> offsets;
+  std::vector<size_t> index;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    std::string module;
+    uint64_t offset;
+    res[i] = check_binary_symbol(binary_path, symbols[i], 0, module, offset);
+    if (res[i].code() != 0)
+      continue;
+    std::string event = get_uprobe_event(module, offset, attach_type, pid);
+    if (uprobes_.find(event) != uprobes_.end() || !seen.insert(event).second) {
+      res[i] = StatusTuple(-1, "uprobe %s already attached", event.c_str());
+      continue;
+    }
+    events.push_back(std::move(event));
+    offsets.push_back(offset);
+    index.push_back(i);
+  }
+
+  std::vector<bcc_probe_target> targets(events.size());
+  for (size_t i = 0; i < targets.size(); i++) {
+    targets[i].attach_type = attach_type;
+    targets[i].name = binary_path.c_str();
+    targets[i].offset = offsets[i];
+    targets[i].pid = pid;
+  }
+  auto status = attach_probe_events(uprobes_, events, targets, probe_func,
+                                    false, nthreads);
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (status.code() != 0)
+      res[index[i]] = status;
+    else if (targets[i].pfd < 0)
+      res[index[i]] = StatusTuple(
+          -1, "Unable to attach %suprobe for binary %s symbol %s using %s: %s",
+          attach_type_debug(attach_type).c_str(), binary_path.c_str(),
+          symbols[index[i]].c_str(), probe_func.c_str(),
+          std::strerror(targets[i].err));
+  }
+  return res;
+}
+
+std::vector<StatusTuple> BPF::detach_kprobes(
+    const std::vector<std::string>& kernel_funcs,
+    bpf_probe_attach_type attach_type, unsigned int nthreads) {
+  std::vector<std::string> events;
+  for (auto& kernel_func : kernel_funcs)
+    events.push_back(get_kprobe_event(kernel_func, attach_type));
+  return detach_probe_events(kprobes_, events, true, nthreads);
+}
+
+std::vector<StatusTuple> BPF::detach_uprobes(
+    const std::string& binary_path, const std::vector<std::string>& symbols,
+    bpf_probe_attach_type attach_type, pid_t pid, unsigned int nthreads) {
+  std::vector<StatusTuple> res(symbols.size(), StatusTuple::OK());
+  std::vector<std::string> events;
+  std::vector<size_t> index;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    std::string module;
+    uint64_t offset;
+    res[i] = check_binary_symbol(binary_path, symbols[i], 0, module, offset);
+    if (res[i].code() != 0)
+      continue;
+    events.push_back(get_uprobe_event(module, offset, attach_type, pid));
+    index.push_back(i);
+  }
+  auto detached = detach_probe_events(uprobes_, events, false, nthreads);
+  for (size_t i = 0; i < detached.size(); i++)
+    res[index[i]] = std::move(detached[i]);
+  return res;
+}
+
+// The event of the group's i-th kprobe or uprobe, with the kernel function
+// or module and the offset to attach it to.
+StatusTuple BPF::get_group_event(const AttachGroup& group, size_t i,
+                                 std::string& event, std::string& name,
+                                 uint64_t& offset) {
+  const auto& p = group.probes_[i];
+  if (p.is_kprobe) {
+    event = get_kprobe_event(p.name, p.attach_type);
+    name = p.name;
+    offset = 0;
+    return StatusTuple::OK();
+  }
+  TRY2(check_binary_symbol(p.name, p.symbol, p.symbol_addr, name, offset,
+                           p.symbol_offset));
+  event = get_uprobe_event(name, offset, p.attach_type, p.pid);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::attach_group(const AttachGroup& group,
+                              unsigned int nthreads) {
+  size_t count = group.probes_.size();
+  std::vector<std::string> events(count), names(count);
+  std::vector<bcc_probe_target> targets(count);
+  // Indexes of the probes attached with one batch, by function and type
+  std::map<std::pair<std::string, bool>, std::vector<size_t>> batches;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < count; i++) {
+    const auto& p = group.probes_[i];
+    const char* type = p.is_kprobe ? "kprobe" : "uprobe";
+    TRY2(get_group_event(group, i, events[i], names[i], targets[i].offset));
+    auto& probes = p.is_kprobe ? kprobes_ : uprobes_;
+    if (probes.find(events[i]) != probes.end() ||
+        !seen.insert(events[i]).second)
+      return StatusTuple(-1, "%s %s already attached", type,
+                         events[i].c_str());
+    targets[i].attach_type = p.attach_type;
+    // Stays -1 unless the target is attached, e.g. if its function fails
+    // to load
+    targets[i].pfd = -1;
+    targets[i].name = names[i].c_str();
+    targets[i].pid = p.pid;
+    targets[i].maxactive = p.maxactive;
+    batches[std::make_pair(p.probe_func, p.is_kprobe)].push_back(i);
+  }
+  for (const auto& tp : group.tracepoints_) {
+    if (tracepoints_.find(tp.first) != tracepoints_.end() ||
+        !seen.insert(tp.first).second)
+      return StatusTuple(-1, "Tracepoint %s already attached",
+                         tp.first.c_str());
+  }
+
+  StatusTuple res = StatusTuple::OK();
+  std::vector<std::string> kprobe_events, uprobe_events, tracepoints;
+  for (const auto& batch : batches) {
+    const std::string& probe_func = batch.first.first;
+    bool is_kprobe = batch.first.second;
+    std::vector<std::string> batch_events;
+    std::vector<bcc_probe_target> batch_targets;
+    for (size_t i : batch.second) {
+      batch_events.push_back(events[i]);
+      batch_targets.push_back(targets[i]);
+    }
+    res = attach_probe_events(is_kprobe ? kprobes_ : uprobes_, batch_events,
+                              batch_targets, probe_func, is_kprobe, nthreads);
+    for (size_t i = 0; i < batch_targets.size(); i++) {
+      if (batch_targets[i].pfd >= 0)
+        (is_kprobe ? kprobe_events : uprobe_events).push_back(batch_events[i]);
+      else if (res.ok())
+        res = StatusTuple(-1, "Unable to attach %s %s using %s: %s",
+                          is_kprobe ? "kprobe" : "uprobe",
+                          batch_events[i].c_str(), probe_func.c_str(),
+                          std::strerror(batch_targets[i].err));
+    }
+    if (!res.ok())
+      break;
+  }
+  for (size_t i = 0; res.ok() && i < group.tracepoints_.size(); i++) {
+    const auto& tp = group.tracepoints_[i];
+    res = attach_tracepoint(tp.first, tp.second);
+    if (res.ok())
+      tracepoints.push_back(tp.first);
+  }
+  if (res.ok())
+    return res;
+
+  std::string err_msg = res.msg() + "\n";
+  for (auto& r : detach_probe_events(kprobes_, kprobe_events, true, nthreads))
+    if (!r.ok())
+      err_msg += "During clean up: " + r.msg() + "\n";
+  for (auto& r : detach_probe_events(uprobes_, uprobe_events, false, nthreads))
+    if (!r.ok())
+      err_msg += "During clean up: " + r.msg() + "\n";
+  for (const auto& tp : tracepoints) {
+    auto r = detach_tracepoint(tp);
+    if (!r.ok())
+      err_msg += "During clean up: " + r.msg() + "\n";
+  }
+  return StatusTuple(-1, err_msg);
+}
+
+StatusTuple BPF::detach_group(const AttachGroup& group,
+                              unsigned int nthreads) {
+  bool failed = false;
+  std::string err_msg;
+  std::vector<std::string> kprobe_events, uprobe_events;
+  for (size_t i = 0; i < group.probes_.size(); i++) {
+    std::string event, name;
+    uint64_t offset;
+    auto res = get_group_event(group, i, event, name, offset);
+    if (!res.ok()) {
+      failed = true;
+      err_msg += res.msg() + "\n";
+      continue;
+    }
+    (group.probes_[i].is_kprobe ? kprobe_events : uprobe_events)
+        .push_back(std::move(event));
+  }
+
+  for (auto& res : detach_probe_events(kprobes_, kprobe_events, true, nthreads))
+    if (!res.ok()) {
+      failed = true;
+      err_msg += res.msg() + "\n";
+    }
+  for (auto& res :
+       detach_probe_events(uprobes_, uprobe_events, false, nthreads))
+    if (!res.ok()) {
+      failed = true;
+      err_msg += res.msg() + "\n";
+    }
+  for (const auto& tp : group.tracepoints_) {
+    auto res = detach_tracepoint(tp.first);
+    if (!res.ok()) {
+      failed = true;
+      err_msg += res.msg() + "\n";
+    }
+  }
+
+  if (failed)
+    return StatusTuple(-1, err_msg);
+  else
+    return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_usdt_locations(const USDT& u, pid_t pid) {
   auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
   bool failed = false;
   std::string err_msg;
@@ -505,6 +964,21 @@ StatusTuple BPF::detach_usdt_without_validation(const USDT& u, pid_t pid) {
     }
   }
 
+  if (failed)
+    return StatusTuple(-1, err_msg);
+  else
+    return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_usdt_without_validation(const USDT& u, pid_t pid) {
+  if (u.shared_)
+    return detach_shared_usdt(u);
+
+  auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
+  auto res = detach_usdt_locations(u, pid);
+  bool failed = !res.ok();
+  std::string err_msg = res.msg();
+
   if (!probe.disable()) {
     failed = true;
     err_msg += "Unable to disable USDT " + u.print_name();
@@ -516,6 +990,73 @@ StatusTuple BPF::detach_usdt_without_validation(const USDT& u, pid_t pid) {
     return StatusTuple::OK();
 }
 
+StatusTuple BPF::detach_shared_usdt(const USDT& u) {
+  auto it = usdt_pids_.find(u.probe_func_);
+  if (it == usdt_pids_.end())
+    return StatusTuple(-1, "Shared USDT %s is not attached",
+                       u.print_name().c_str());
+
+  bool failed = false;
+  std::string err_msg;
+  std::set<pid_t> pids = it->second;
+  for (pid_t pid : pids) {
+    auto res = remove_usdt_pid_without_validation(u, pid);
+    if (!res.ok()) {
+      failed = true;
+      err_msg += res.msg() + "\n";
+    }
+  }
+
+  auto res = detach_usdt_locations(u, -1);
+  if (!res.ok()) {
+    failed = true;
+    err_msg += res.msg();
+  }
+  get_prog_table(u.probe_func_ + "__usdt_prog").remove_value(0);
+  res = unload_func(u.probe_func_);
+  if (!res.ok()) {
+    failed = true;
+    err_msg += res.msg() + "\n";
+  }
+  usdt_pids_.erase(u.probe_func_);
+
+  if (failed)
+    return StatusTuple(-1, err_msg);
+  else
+    return StatusTuple::OK();
+}
+
+StatusTuple BPF::remove_usdt_pid_without_validation(const USDT& u, pid_t pid) {
+  auto it = usdt_pids_.find(u.probe_func_);
+  if (it == usdt_pids_.end() || !it->second.count(pid))
+    return StatusTuple(-1, "PID %d is not traced by shared USDT %s", pid,
+                       u.print_name().c_str());
+
+  auto pids = get_hash_table<uint32_t, uint8_t>(u.probe_func_ + "__usdt_pids");
+  uint32_t key = pid;
+  pids.remove_value(key);
+  it->second.erase(pid);
+
+  // A process which already exited has no semaphore to update
+  auto& probe = *static_cast<::USDT::Probe*>(u.probe_.get());
+  if (probe.need_enable() && !probe.add_to_semaphore(pid, -1) &&
+      !(kill(pid, 0) < 0 && errno == ESRCH))
+    return StatusTuple(-1, "Unable to disable USDT %s in PID %d",
+                       u.print_name().c_str(), pid);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::remove_usdt_pid(const USDT& usdt, pid_t pid) {
+  for (const auto& u : usdt_) {
+    if (u == usdt && u.shared_) {
+      return remove_usdt_pid_without_validation(u, pid);
+    }
+  }
+
+  return StatusTuple(-1, "Shared USDT %s not found",
+                     usdt.print_name().c_str());
+}
+
 StatusTuple BPF::detach_usdt(const USDT& usdt, pid_t pid) {
   for (const auto& u : usdt_) {
     if (u == usdt) {
@@ -552,6 +1093,7 @@ StatusTuple BPF::detach_raw_tracepoint(const std::string& tracepoint) {
   if (it == raw_tracepoints_.end())
     return StatusTuple(-1, "No open Raw tracepoint %s", tracepoint.c_str());
 
+  unpin_link("raw_" + tracepoint);
   TRY2(detach_raw_tracepoint_event(it->first, it->second));
   raw_tracepoints_.erase(it);
   return StatusTuple::OK();
@@ -681,6 +1223,57 @@ StatusTuple BPF::unload_func(const std::string& func_name) {
   return StatusTuple::OK();
 }
 
+StatusTuple BPF::enable_stats() {
+  if (stats_enabled_)
+    return StatusTuple::OK();
+  if (bcc_enable_stats(&stats_fd_, &stats_sysctl_))
+    return StatusTuple(-1, "Failed to enable BPF stats: %s", strerror(errno));
+  stats_enabled_ = true;
+  return StatusTuple::OK();
+}
+
+std::vector<ProgStats> BPF::get_prog_stats() const {
+  std::vector<ProgStats> res;
+  for (auto& it : funcs_) {
+    ProgStats stats{it.first, 0, 0};
+    if (bcc_prog_stats(it.second, &stats.run_cnt, &stats.run_time_ns) == 0)
+      res.push_back(std::move(stats));
+  }
+  return res;
+}
+
+std::string BPF::get_prog_stats_report(
+    const std::vector<ProgStats>& since) const {
+  std::vector<ProgStats> stats = get_prog_stats();
+  for (auto& s : stats) {
+    for (auto& prev : since) {
+      // A function unloaded and loaded again starts from 0
+      if (prev.name == s.name && prev.run_cnt <= s.run_cnt) {
+        s.run_cnt -= prev.run_cnt;
+        s.run_time_ns -= prev.run_time_ns;
+        break;
+      }
+    }
+  }
+  std::stable_sort(stats.begin(), stats.end(),
+                   [](const ProgStats& a, const ProgStats& b) {
+                     return a.run_time_ns > b.run_time_ns;
+                   });
+
+  std::string out;
+  char line[256];
+  snprintf(line, sizeof(line), "%-32s %12s %12s %10s\n", "FUNC", "RUNS",
+           "TIME(ms)", "NS/RUN");
+  out += line;
+  for (auto& s : stats) {
+    snprintf(line, sizeof(line), "%-32s %12" PRIu64 " %12.3f %10.1f\n",
+             s.name.c_str(), s.run_cnt, s.run_time_ns / 1000000.,
+             s.ns_per_run());
+    out += line;
+  }
+  return out;
+}
+
 StatusTuple BPF::attach_func(int prog_fd, int attachable_fd,
                              enum bpf_attach_type attach_type,
                              uint64_t flags) {
@@ -834,6 +1427,129 @@ std::string BPF::get_uprobe_event(const std::string& binary_path,
   return res;
 }
 
+StatusTuple BPF::attach_trampoline(const std::string& kernel_func,
+                                   const std::string& probe_func,
+                                   bpf_probe_attach_type attach_type,
+                                   const std::string& event) {
+  bool is_return = attach_type == BPF_PROBE_RETURN;
+  std::string func = probe_func + (is_return ? "__fexit" : "__fentry");
+  uint8_t* func_start = bpf_module_->function_start(func);
+  if (!func_start)
+    return StatusTuple(-1, "%s has no %s variant", probe_func.c_str(),
+                       is_return ? "fexit" : "fentry");
+  if (!support_kfunc())
+    return StatusTuple(-1, "BPF trampolines are not supported");
+
+  // One program per traced function, as the target is set at load time
+  std::string prog_name = func + "__" + kernel_func;
+  int log_level = 0;
+  if (flag_ & DEBUG_BPF_REGISTER_STATE)
+    log_level = 2;
+  else if (flag_ & DEBUG_BPF)
+    log_level = 1;
+  int prog_fd = bpf_module_->bcc_func_load(
+      BPF_PROG_TYPE_TRACING, func.c_str(),
+      reinterpret_cast<struct bpf_insn*>(func_start),
+      bpf_module_->function_size(func), bpf_module_->license(),
+      bpf_module_->kern_version(), log_level, nullptr, 0, nullptr,
+      kernel_func.c_str(), is_return ? BPF_TRACE_FEXIT : BPF_TRACE_FENTRY);
+  if (prog_fd < 0)
+    return StatusTuple(-1, "Failed to load %s for %s: %s", func.c_str(),
+                       kernel_func.c_str(), std::strerror(errno));
+  funcs_[prog_name] = prog_fd;
+
+  int link_fd = open_pinned_link(event, prog_fd);
+  if (link_fd >= 0) {
+    open_probe_t p = {};
+    p.perf_event_fd = link_fd;
+    p.func = prog_name;
+    trampolines_[event] = std::move(p);
+    return StatusTuple::OK();
+  }
+
+  link_fd = bpf_attach_kfunc(prog_fd);
+  if (link_fd < 0) {
+    TRY2(unload_func(prog_name));
+    return StatusTuple(-1, "Unable to attach %s to %s", func.c_str(),
+                       kernel_func.c_str());
+  }
+  auto res = pin_link(link_fd, event);
+  if (!res.ok()) {
+    close(link_fd);
+    TRY2(unload_func(prog_name));
+    return res;
+  }
+
+  open_probe_t p = {};
+  p.perf_event_fd = link_fd;
+  p.func = prog_name;
+  trampolines_[event] = std::move(p);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_trampoline(open_probe_t& attr) {
+  close(attr.perf_event_fd);
+  return unload_func(attr.func);
+}
+
+// The link pinned as name by an earlier instance using the same pin
+// directory, or -1. A link running another program than prog_fd, e.g. one
+// pinned before the program was changed, is unpinned instead, so that
+// prog_fd gets attached in its place.
+int BPF::open_pinned_link(const std::string& name, int prog_fd) {
+  if (pin_dir_.empty())
+    return -1;
+  int link_fd = bpf_obj_get((pin_dir_ + "/links/" + name).c_str());
+  if (link_fd < 0)
+    return -1;
+
+  // Programs built from the same instructions have the same tag
+  bool same_prog = false;
+  struct bpf_link_info link_info = {};
+  uint32_t info_len = sizeof(link_info);
+  if (bpf_obj_get_info(link_fd, &link_info, &info_len) == 0) {
+    int pinned_fd = bpf_prog_get_fd_by_id(link_info.prog_id);
+    if (pinned_fd >= 0) {
+      struct bpf_prog_info pinned = {}, loaded = {};
+      uint32_t pinned_len = sizeof(pinned), loaded_len = sizeof(loaded);
+      same_prog = bpf_obj_get_info(pinned_fd, &pinned, &pinned_len) == 0 &&
+                  bpf_obj_get_info(prog_fd, &loaded, &loaded_len) == 0 &&
+                  memcmp(pinned.tag, loaded.tag, sizeof(pinned.tag)) == 0;
+      close(pinned_fd);
+    }
+  }
+  if (!same_prog) {
+    close(link_fd);
+    unpin_link(name);
+    return -1;
+  }
+  return link_fd;
+}
+
+StatusTuple BPF::pin_link(int link_fd, const std::string& name) {
+  if (pin_dir_.empty())
+    return StatusTuple::OK();
+  std::string path = pin_dir_ + "/links/" + name;
+  if (bpf_obj_pin(link_fd, path.c_str()))
+    return StatusTuple(-1, "Unable to pin link as %s: %s", path.c_str(),
+                       std::strerror(errno));
+  return StatusTuple::OK();
+}
+
+void BPF::unpin_link(const std::string& name) {
+  if (!pin_dir_.empty())
+    unlink((pin_dir_ + "/links/" + name).c_str());
+}
+
+bool BPF::support_kfunc() {
+  if (!bpf_has_kernel_btf())
+    return false;
+  // kernel symbol "bpf_trampoline_link_prog" indicates kfunc support
+  KSyms ksym;
+  uint64_t addr;
+  return ksym.resolve_name(nullptr, "bpf_trampoline_link_prog", &addr);
+}
+
 StatusTuple BPF::detach_kprobe_event(const std::string& event,
                                      open_probe_t& attr) {
   bpf_close_perf_event_fd(attr.perf_event_fd);
@@ -852,6 +1568,88 @@ StatusTuple BPF::detach_uprobe_event(const std::string& event,
   return StatusTuple::OK();
 }
 
+// Loads probe_func and attaches it to each of targets, named by events. The
+// probes attached are added to probes, the others are left with pfd -1 and
+// the errno of the failure.
+StatusTuple BPF::attach_probe_events(
+    std::map<std::string, open_probe_t>& probes,
+    const std::vector<std::string>& events,
+    std::vector<bcc_probe_target>& targets, const std::string& probe_func,
+    bool is_kprobe, unsigned int nthreads) {
+  if (targets.empty())
+    return StatusTuple::OK();
+
+  bool was_loaded = funcs_.find(probe_func) != funcs_.end();
+  int probe_fd;
+  TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+  for (size_t i = 0; i < targets.size(); i++) {
+    targets[i].progfd = probe_fd;
+    targets[i].ev_name = events[i].c_str();
+  }
+
+  int failed;
+  if (is_kprobe)
+    failed = bpf_attach_kprobes(targets.data(), targets.size(), nthreads);
+  else
+    failed = bpf_attach_uprobes(targets.data(), targets.size(), nthreads);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (targets[i].pfd < 0)
+      continue;
+    open_probe_t p = {};
+    p.perf_event_fd = targets[i].pfd;
+    p.func = probe_func;
+    probes[events[i]] = std::move(p);
+  }
+  if (!was_loaded && failed == static_cast<int>(targets.size()))
+    TRY2(unload_func(probe_func));
+  return StatusTuple::OK();
+}
+
+// Closes the probes named by events and removes them from probes, returning
+// the result for each event.
+std::vector<StatusTuple> BPF::detach_probe_events(
+    std::map<std::string, open_probe_t>& probes,
+    const std::vector<std::string>& events, bool is_kprobe,
+    unsigned int nthreads) {
+  const char* type = is_kprobe ? "kprobe" : "uprobe";
+  std::vector<StatusTuple> res(events.size(), StatusTuple::OK());
+  std::vector<bcc_probe_target> targets;
+  std::vector<size_t> index;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < events.size(); i++) {
+    auto it = probes.find(events[i]);
+    if (it == probes.end() || !seen.insert(events[i]).second) {
+      res[i] = StatusTuple(-1, "No open %s %s", type, events[i].c_str());
+      continue;
+    }
+    bcc_probe_target t = {};
+    t.ev_name = it->first.c_str();
+    t.pfd = it->second.perf_event_fd;
+    targets.push_back(t);
+    index.push_back(i);
+  }
+  if (targets.empty())
+    return res;
+
+  if (is_kprobe)
+    bpf_detach_kprobes(targets.data(), targets.size(), nthreads);
+  else
+    bpf_detach_uprobes(targets.data(), targets.size(), nthreads);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    const std::string& event = events[index[i]];
+    auto unloaded = unload_func(probes[event].func);
+    if (targets[i].err)
+      res[index[i]] = StatusTuple(-1, "Unable to detach %s %s: %s", type,
+                                  event.c_str(), std::strerror(targets[i].err));
+    else
+      res[index[i]] = std::move(unloaded);
+    probes.erase(event);
+  }
+  return res;
+}
+
 StatusTuple BPF::detach_tracepoint_event(const std::string& tracepoint,
                                          open_probe_t& attr) {
   bpf_close_perf_event_fd(attr.perf_event_fd);
@@ -893,6 +1691,32 @@ int BPF::free_bcc_memory() {
   return bcc_free_memory();
 }
 
+AttachGroup& AttachGroup::add_kprobe(const std::string& kernel_func,
+                                     const std::string& probe_func,
+                                     bpf_probe_attach_type attach_type,
+                                     int maxactive) {
+  probes_.push_back({true, kernel_func, std::string(), probe_func, 0, 0,
+                     attach_type, -1, maxactive});
+  return *this;
+}
+
+AttachGroup& AttachGroup::add_uprobe(const std::string& binary_path,
+                                     const std::string& symbol,
+                                     const std::string& probe_func,
+                                     uint64_t symbol_addr,
+                                     bpf_probe_attach_type attach_type,
+                                     pid_t pid, uint64_t symbol_offset) {
+  probes_.push_back({false, binary_path, symbol, probe_func, symbol_addr,
+                     symbol_offset, attach_type, pid, 0});
+  return *this;
+}
+
+AttachGroup& AttachGroup::add_tracepoint(const std::string& tracepoint,
+                                         const std::string& probe_func) {
+  tracepoints_.emplace_back(tracepoint, probe_func);
+  return *this;
+}
+
 USDT::USDT(const std::string& binary_path, const std::string& provider,
            const std::string& name, const std::string& probe_func)
     : initialized_(false),
@@ -901,7 +1725,8 @@ USDT::USDT(const std::string& binary_path, const std::string& provider,
       provider_(provider),
       name_(name),
       probe_func_(probe_func),
-      mod_match_inode_only_(1) {}
+      mod_match_inode_only_(1),
+      shared_(false) {}
 
 USDT::USDT(pid_t pid, const std::string& provider, const std::string& name,
            const std::string& probe_func)
@@ -911,7 +1736,8 @@ USDT::USDT(pid_t pid, const std::string& provider, const std::string& name,
       provider_(provider),
       name_(name),
       probe_func_(probe_func),
-      mod_match_inode_only_(1) {}
+      mod_match_inode_only_(1),
+      shared_(false) {}
 
 USDT::USDT(const std::string& binary_path, pid_t pid,
            const std::string& provider, const std::string& name,
@@ -922,7 +1748,8 @@ USDT::USDT(const std::string& binary_path, pid_t pid,
       provider_(provider),
       name_(name),
       probe_func_(probe_func),
-      mod_match_inode_only_(1) {}
+      mod_match_inode_only_(1),
+      shared_(false) {}
 
 USDT::USDT(const USDT& usdt)
     : initialized_(false),
@@ -931,7 +1758,8 @@ USDT::USDT(const USDT& usdt)
       provider_(usdt.provider_),
       name_(usdt.name_),
       probe_func_(usdt.probe_func_),
-      mod_match_inode_only_(usdt.mod_match_inode_only_) {}
+      mod_match_inode_only_(usdt.mod_match_inode_only_),
+      shared_(usdt.shared_) {}
 
 USDT::USDT(USDT&& usdt) noexcept
     : initialized_(usdt.initialized_),
@@ -942,7 +1770,8 @@ USDT::USDT(USDT&& usdt) noexcept
       probe_func_(std::move(usdt.probe_func_)),
       probe_(std::move(usdt.probe_)),
       program_text_(std::move(usdt.program_text_)),
-      mod_match_inode_only_(usdt.mod_match_inode_only_) {
+      mod_match_inode_only_(usdt.mod_match_inode_only_),
+      shared_(usdt.shared_) {
   usdt.initialized_ = false;
 }
 
@@ -961,6 +1790,10 @@ int USDT::set_probe_matching_kludge(uint8_t kludge) {
 }
 
 StatusTuple USDT::init() {
+  if (shared_ && binary_path_.empty())
+    return StatusTuple(-1, "Shared USDT " + print_name() +
+                               " needs a binary path");
+
   std::unique_ptr<::USDT::Context> ctx;
   if (!binary_path_.empty() && pid_ > 0)
     ctx.reset(new ::USDT::Context(pid_, binary_path_, mod_match_inode_only_));
@@ -995,6 +1828,18 @@ StatusTuple USDT::init() {
   if (!probe.usdt_getarg(stream, probe_func_))
     return StatusTuple(
         -1, "Unable to generate program text for USDT " + print_name());
+  // A shared USDT attaches probe_func__usdt instead, which tail calls
+  // probe_func in the processes added to the set.
+  if (shared_) {
+    stream << "BPF_HASH(" << probe_func_ << "__usdt_pids, u32, u8);\n"
+           << "BPF_PROG_ARRAY(" << probe_func_ << "__usdt_prog, 1);\n"
+           << "int " << probe_func_ << "__usdt(struct pt_regs *ctx) {\n"
+           << "  u32 tgid = bpf_get_current_pid_tgid() >> 32;\n"
+           << "  if (" << probe_func_ << "__usdt_pids.lookup(&tgid))\n"
+           << "    " << probe_func_ << "__usdt_prog.call(ctx, 0);\n"
+           << "  return 0;\n"
+           << "}\n";
+  }
   program_text_ = ::USDT::USDT_PROGRAM_HEADER + stream.str();
 
   initialized_ = true;
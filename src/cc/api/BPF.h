@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <memory>
 #include <ostream>
+#include <set>
 #include <string>
 
 #include "BPFTable.h"
@@ -40,7 +41,19 @@ struct open_probe_t {
   std::vector<std::pair<int, int>>* per_cpu_fd;
 };
 
+// Runs and run time of a loaded function, see BPF::enable_stats()
+struct ProgStats {
+  std::string name;
+  uint64_t run_cnt;
+  uint64_t run_time_ns;
+
+  double ns_per_run() const {
+    return run_cnt ? static_cast<double>(run_time_ns) / run_cnt : 0;
+  }
+};
+
 class USDT;
+class AttachGroup;
 
 class BPF {
  public:
@@ -52,6 +65,9 @@ class BPF {
                bool allow_rlimit = true)
       : flag_(flag),
         bsymcache_(NULL),
+        stats_enabled_(false),
+        stats_fd_(-1),
+        stats_sysctl_(0),
         bpf_module_(new BPFModule(flag, ts, rw_engine_enabled, maps_ns,
                     allow_rlimit)) {}
   StatusTuple init(const std::string& bpf_program,
@@ -60,14 +76,48 @@ class BPF {
 
   StatusTuple init_usdt(const USDT& usdt);
 
+  // Sets a parameter declared with BPF_PARAM. Called before init(), this
+  // replaces the default the program is loaded with.
+  template <class T>
+  StatusTuple set_param(const std::string& name, const T& value) {
+    if (bpf_module_->set_param(name, &value, sizeof(value)))
+      return StatusTuple(-1, "Failed to set parameter %s", name.c_str());
+    return StatusTuple::OK();
+  }
+
+  // Pins the maps as dir/maps/<name> when the program is loaded, and the BPF
+  // links of raw tracepoints and of kprobes attached through BPF trampolines
+  // as dir/links/<event> when they are attached. dir must be on a bpffs, it
+  // is created if needed. A BPF object later given the same dir, e.g. after
+  // the process restarted, reuses the maps and adopts the links instead of
+  // creating them again, so the probes keep running and counting in between.
+  // A pinned link running another program, e.g. after the source changed, is
+  // replaced by one running the new program.
+  // The pins outlive detach_all() and the BPF object, detach_kprobe() and
+  // detach_raw_tracepoint() remove the ones of their probe. Called before
+  // init().
+  StatusTuple set_pin_dir(const std::string& dir);
+  // Removes all the pins under the pin directory, the probes and maps are
+  // then gone once their fds are closed.
+  StatusTuple unpin_all();
+
+  // Initializes bpfs[i] with programs[i], compiling up to nthreads programs
+  // at once (one per CPU when 0). Returns the result of each init().
+  static std::vector<StatusTuple> init_parallel(
+      const std::vector<BPF*>& bpfs, const std::vector<std::string>& programs,
+      const std::vector<std::string>& cflags = {}, unsigned int nthreads = 0);
+
   ~BPF();
   StatusTuple detach_all();
 
+  // If probe_func was declared with KPROBE_FENTRY (KRETPROBE_FEXIT), its
+  // fentry (fexit) variant is attached instead when the kernel supports BPF
+  // trampolines and fentry is set.
   StatusTuple attach_kprobe(const std::string& kernel_func,
                             const std::string& probe_func,
                             uint64_t kernel_func_offset = 0,
                             bpf_probe_attach_type = BPF_PROBE_ENTRY,
-                            int maxactive = 0);
+                            int maxactive = 0, bool fentry = true);
   StatusTuple detach_kprobe(
       const std::string& kernel_func,
       bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY);
@@ -84,10 +134,46 @@ class BPF {
                             bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
                             pid_t pid = -1,
                             uint64_t symbol_offset = 0);
+
+  // Attach or detach probe_func at each of kernel_funcs, or at each of
+  // symbols in binary_path, running up to nthreads attach syscalls at once
+  // (one per CPU when 0). Returns one result per target, in order.
+  std::vector<StatusTuple> attach_kprobes(
+      const std::vector<std::string>& kernel_funcs,
+      const std::string& probe_func,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY, int maxactive = 0,
+      unsigned int nthreads = 0);
+  std::vector<StatusTuple> detach_kprobes(
+      const std::vector<std::string>& kernel_funcs,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
+      unsigned int nthreads = 0);
+  std::vector<StatusTuple> attach_uprobes(
+      const std::string& binary_path, const std::vector<std::string>& symbols,
+      const std::string& probe_func,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY, pid_t pid = -1,
+      unsigned int nthreads = 0);
+  std::vector<StatusTuple> detach_uprobes(
+      const std::string& binary_path, const std::vector<std::string>& symbols,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY, pid_t pid = -1,
+      unsigned int nthreads = 0);
+
+  // Attach all the probes of group or none: if one fails, the ones already
+  // attached are detached again and the first error is returned. The kprobes
+  // and uprobes of each function are attached in bulk, running up to
+  // nthreads attach syscalls at once (one per CPU when 0).
+  StatusTuple attach_group(const AttachGroup& group, unsigned int nthreads = 0);
+  // Detach the probes of group in bulk, trying all of them even if some fail.
+  StatusTuple detach_group(const AttachGroup& group, unsigned int nthreads = 0);
+
   StatusTuple attach_usdt(const USDT& usdt, pid_t pid = -1);
   StatusTuple attach_usdt_all();
   StatusTuple detach_usdt(const USDT& usdt, pid_t pid = -1);
   StatusTuple detach_usdt_all();
+  // Add or remove a process traced by a shared USDT (see USDT::set_shared()),
+  // updating the probe's semaphore in it. The shared USDT must be attached.
+  // attach_usdt(usdt, pid) also adds pid, detach_usdt() removes them all.
+  StatusTuple add_usdt_pid(const USDT& usdt, pid_t pid);
+  StatusTuple remove_usdt_pid(const USDT& usdt, pid_t pid);
 
   StatusTuple attach_tracepoint(const std::string& tracepoint,
                                 const std::string& probe_func);
@@ -110,6 +196,8 @@ class BPF {
   StatusTuple detach_perf_event(uint32_t ev_type, uint32_t ev_config);
   StatusTuple detach_perf_event_raw(void* perf_event_attr);
   std::string get_syscall_fnname(const std::string& name);
+  // Whether fentry/fexit programs can be attached to kernel functions
+  static bool support_kfunc();
 
   BPFTable get_table(const std::string& name) {
     TableStorage::iterator it;
@@ -252,6 +340,30 @@ class BPF {
 
   int free_bcc_memory();
 
+  // Time and memory spent in each phase of compiling and loading the
+  // program. Empty unless the BPF object was created with DEBUG_PROFILE.
+  std::vector<PhaseStat> get_profile() const {
+    CompileProfile* profile = bpf_module_->profile();
+    return profile ? profile->phases() : std::vector<PhaseStat>();
+  }
+  std::string get_profile_report() const {
+    CompileProfile* profile = bpf_module_->profile();
+    return profile ? profile->report() : std::string();
+  }
+
+  // Turns on the accounting of the runs and run time of all BPF programs in
+  // the system while this object lives. Kernels before 5.8 only have the
+  // kernel.bpf_stats_enabled sysctl, which is set back to its previous value
+  // on destruction. It costs two clock reads per run.
+  StatusTuple enable_stats();
+  // Runs and run time of each loaded function since it was loaded
+  std::vector<ProgStats> get_prog_stats() const;
+  // The functions sorted by run time, most expensive first, with their runs,
+  // time and time per run. Given an earlier get_prog_stats(), only what ran
+  // since is counted, so printing it at an interval gives a top-like view.
+  std::string get_prog_stats_report(
+      const std::vector<ProgStats>& since = {}) const;
+
  private:
   std::string get_kprobe_event(const std::string& kernel_func,
                                bpf_probe_attach_type type);
@@ -260,9 +372,36 @@ class BPF {
 
   StatusTuple attach_usdt_without_validation(const USDT& usdt, pid_t pid);
   StatusTuple detach_usdt_without_validation(const USDT& usdt, pid_t pid);
-
+  StatusTuple attach_usdt_locations(const USDT& usdt,
+                                    const std::string& probe_func, pid_t pid);
+  StatusTuple detach_usdt_locations(const USDT& usdt, pid_t pid);
+  StatusTuple attach_shared_usdt(const USDT& usdt, pid_t pid);
+  StatusTuple detach_shared_usdt(const USDT& usdt);
+  StatusTuple add_usdt_pid_without_validation(const USDT& usdt, pid_t pid);
+  StatusTuple remove_usdt_pid_without_validation(const USDT& usdt, pid_t pid);
+
+  StatusTuple attach_trampoline(const std::string& kernel_func,
+                                const std::string& probe_func,
+                                bpf_probe_attach_type attach_type,
+                                const std::string& event);
+  StatusTuple detach_trampoline(open_probe_t& attr);
+  int open_pinned_link(const std::string& name, int prog_fd);
+  StatusTuple pin_link(int link_fd, const std::string& name);
+  void unpin_link(const std::string& name);
+  StatusTuple get_group_event(const AttachGroup& group, size_t i,
+                              std::string& event, std::string& name,
+                              uint64_t& offset);
   StatusTuple detach_kprobe_event(const std::string& event, open_probe_t& attr);
   StatusTuple detach_uprobe_event(const std::string& event, open_probe_t& attr);
+  StatusTuple attach_probe_events(std::map<std::string, open_probe_t>& probes,
+                                  const std::vector<std::string>& events,
+                                  std::vector<bcc_probe_target>& targets,
+                                  const std::string& probe_func, bool is_kprobe,
+                                  unsigned int nthreads);
+  std::vector<StatusTuple> detach_probe_events(
+      std::map<std::string, open_probe_t>& probes,
+      const std::vector<std::string>& events, bool is_kprobe,
+      unsigned int nthreads);
   StatusTuple detach_tracepoint_event(const std::string& tracepoint,
                                       open_probe_t& attr);
   StatusTuple detach_raw_tracepoint_event(const std::string& tracepoint,
@@ -309,24 +448,78 @@ class BPF {
 
   void *bsymcache_;
 
+  bool stats_enabled_;
+  // Keeps the run time accounting on, -1 if enable_stats() was not called or
+  // set kernel.bpf_stats_enabled instead
+  int stats_fd_;
+  // Whether enable_stats() turned kernel.bpf_stats_enabled on, it is turned
+  // off again on destruction
+  int stats_sysctl_;
+
   std::unique_ptr<std::string> syscall_prefix_;
 
   std::unique_ptr<BPFModule> bpf_module_;
 
+  std::string pin_dir_;
+
   std::map<std::string, int> funcs_;
 
   std::vector<USDT> usdt_;
   std::string all_bpf_program_;
+  // Processes traced by each attached shared USDT, by probe function
+  std::map<std::string, std::set<pid_t>> usdt_pids_;
 
   std::map<std::string, open_probe_t> kprobes_;
   std::map<std::string, open_probe_t> uprobes_;
   std::map<std::string, open_probe_t> tracepoints_;
   std::map<std::string, open_probe_t> raw_tracepoints_;
+  // KPROBE_FENTRY and KRETPROBE_FEXIT probes attached through trampolines,
+  // by kprobe event name
+  std::map<std::string, open_probe_t> trampolines_;
   std::map<std::string, BPFPerfBuffer*> perf_buffers_;
   std::map<std::string, BPFPerfEventArray*> perf_event_arrays_;
   std::map<std::pair<uint32_t, uint32_t>, open_probe_t> perf_events_;
 };
 
+// Probes attached and detached together by BPF::attach_group() and
+// BPF::detach_group(). The arguments are those of the matching BPF::attach_*.
+class AttachGroup {
+ public:
+  AttachGroup& add_kprobe(const std::string& kernel_func,
+                          const std::string& probe_func,
+                          bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
+                          int maxactive = 0);
+  AttachGroup& add_uprobe(const std::string& binary_path,
+                          const std::string& symbol,
+                          const std::string& probe_func,
+                          uint64_t symbol_addr = 0,
+                          bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
+                          pid_t pid = -1, uint64_t symbol_offset = 0);
+  AttachGroup& add_tracepoint(const std::string& tracepoint,
+                              const std::string& probe_func);
+
+  size_t size() const { return probes_.size() + tracepoints_.size(); }
+
+ private:
+  struct Probe {
+    bool is_kprobe;
+    std::string name;  // the kernel function or the binary path
+    std::string symbol;
+    std::string probe_func;
+    uint64_t symbol_addr;
+    uint64_t symbol_offset;
+    bpf_probe_attach_type attach_type;
+    pid_t pid;
+    int maxactive;
+  };
+
+  std::vector<Probe> probes_;
+  // tracepoint and probe function
+  std::vector<std::pair<std::string, std::string>> tracepoints_;
+
+  friend class BPF;
+};
+
 class USDT {
  public:
   USDT(const std::string& binary_path, const std::string& provider,
@@ -376,6 +569,16 @@ class USDT {
   // BPF::init()
   int set_probe_matching_kludge(uint8_t kludge);
 
+  // A shared USDT is attached once at each location of the probe in the
+  // binary, for all the processes running it, rather than once per process.
+  // probe_func then only runs in the processes added with
+  // BPF::add_usdt_pid(), which is checked against a BPF hash set, so workers
+  // can come and go without attaching again. The USDT needs a binary path.
+  //
+  // set_shared() must be called before USDTs are submitted to BPF::init()
+  void set_shared(bool shared) { shared_ = shared; }
+  bool shared() const { return shared_; }
+
  private:
   bool initialized_;
 
@@ -390,6 +593,7 @@ class USDT {
   std::string program_text_;
 
   uint8_t mod_match_inode_only_;
+  bool shared_;
 
   friend class BPF;
 };
@@ -13,6 +13,9 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <cstdio>
+#include <linux/bpf.h>
+
 #include "bcc_common.h"
 #include "bpf_module.h"
 
@@ -251,6 +254,19 @@ int bcc_func_load(void *program, int prog_type, const char *name,
 
 }
 
+int bcc_func_load_trampoline(void *program, const char *name,
+                             const char *kernel_func, int attach_type,
+                             const struct bpf_insn *insns, int prog_len,
+                             const char *license, unsigned kern_version,
+                             int log_level, char *log_buf,
+                             unsigned log_buf_size) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->bcc_func_load(BPF_PROG_TYPE_TRACING, name, insns, prog_len,
+                            license, kern_version, log_level, log_buf,
+                            log_buf_size, nullptr, kernel_func, attach_type);
+}
+
 size_t bpf_perf_event_fields(void *program, const char *event) {
   auto mod = static_cast<ebpf::BPFModule *>(program);
   if (!mod)
@@ -265,4 +281,27 @@ const char * bpf_perf_event_field(void *program, const char *event, size_t i) {
   return mod->perf_event_field(event, i);
 }
 
+size_t bpf_module_num_phases(void *program) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod || !mod->profile())
+    return 0;
+  return mod->profile()->phases().size();
+}
+
+int bpf_module_phase_stat(void *program, size_t id, struct bcc_phase_stat *stat) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod || !mod->profile())
+    return -1;
+  auto phases = mod->profile()->phases();
+  if (id >= phases.size())
+    return -1;
+  const ebpf::PhaseStat &phase = phases[id];
+  snprintf(stat->name, sizeof(stat->name), "%s", phase.name.c_str());
+  stat->wall_ms = phase.wall_ms;
+  stat->cpu_ms = phase.cpu_ms;
+  stat->max_rss_kb = phase.max_rss_kb;
+  stat->max_rss_growth_kb = phase.max_rss_growth_kb;
+  return 0;
+}
+
 }
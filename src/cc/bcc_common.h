@@ -67,12 +67,33 @@ int bpf_table_leaf_sscanf(void *program, size_t id, const char *buf, void *leaf)
 size_t bpf_perf_event_fields(void *program, const char *event);
 const char * bpf_perf_event_field(void *program, const char *event, size_t i);
 
+/* Time and memory spent in one phase of compiling or loading a program
+ * created with DEBUG_PROFILE (0x40) in its flags. */
+struct bcc_phase_stat {
+  char name[64];
+  double wall_ms;
+  double cpu_ms;
+  long max_rss_kb;
+  long max_rss_growth_kb;
+};
+size_t bpf_module_num_phases(void *program);
+int bpf_module_phase_stat(void *program, size_t id, struct bcc_phase_stat *stat);
+
 struct bpf_insn;
 int bcc_func_load(void *program, int prog_type, const char *name,
                   const struct bpf_insn *insns, int prog_len,
                   const char *license, unsigned kern_version,
                   int log_level, char *log_buf, unsigned log_buf_size,
                   const char *dev_name);
+// Load name as a BPF_PROG_TYPE_TRACING program attached to the entry
+// (BPF_TRACE_FENTRY) or the return (BPF_TRACE_FEXIT) of kernel_func, rather
+// than to the function its name refers to.
+int bcc_func_load_trampoline(void *program, const char *name,
+                             const char *kernel_func, int attach_type,
+                             const struct bpf_insn *insns, int prog_len,
+                             const char *license, unsigned kern_version,
+                             int log_level, char *log_buf,
+                             unsigned log_buf_size);
 
 #ifdef __cplusplus
 }
@@ -68,6 +68,10 @@ int bcc_elf_foreach_sym_lazy(const char *path, bcc_elf_symcb_lazy callback,
 // Iterate over all symbols from current system's vDSO
 // Returns -1 on error, and 0 on success or stopped by callback
 int bcc_elf_foreach_vdso_sym(bcc_elf_symcb callback, void *payload);
+// Find the separate debuginfo file of a binary module, through symfs, its
+// build-id or its debuglink section. The result must be freed by the caller.
+// Returns NULL if there is none.
+char *bcc_elf_find_debug_file(const char *path, int check_crc);
 
 int bcc_elf_get_text_scn_info(const char *path, uint64_t *addr,
                               uint64_t *offset);
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bcc_object.h"
+#include "file_desc.h"
+
+namespace ebpf {
+
+using std::string;
+
+namespace {
+
+const char kMagic[8] = {'B', 'C', 'C', 'P', 'R', 'O', 'G', 'C'};
+const uint32_t kVersion = 3;
+
+// Appends fixed size integers and length-prefixed strings to a buffer.
+class Writer {
+ public:
+  void u32(uint32_t v) { buf_.append((const char *)&v, sizeof(v)); }
+  void u64(uint64_t v) { buf_.append((const char *)&v, sizeof(v)); }
+  void str(const string &s) { bytes(s.data(), s.size()); }
+  void bytes(const void *p, size_t len) {
+    u64(len);
+    buf_.append((const char *)p, len);
+  }
+  string &data() { return buf_; }
+
+ private:
+  string buf_;
+};
+
+// Reads back what Writer wrote. Any read past the end puts the reader in a
+// failed state and yields zeroes, ok() also requires that the whole buffer
+// was consumed.
+class Reader {
+ public:
+  explicit Reader(const string &buf) : buf_(buf), pos_(0), ok_(true) {}
+  uint32_t u32() {
+    uint32_t v = 0;
+    read(&v, sizeof(v));
+    return v;
+  }
+  uint64_t u64() {
+    uint64_t v = 0;
+    read(&v, sizeof(v));
+    return v;
+  }
+  string str() {
+    const char *p;
+    size_t len;
+    if (!bytes(&p, &len))
+      return string();
+    return string(p, len);
+  }
+  bool bytes(const char **p, size_t *len) {
+    *len = u64();
+    if (!ok_ || *len > buf_.size() - pos_) {
+      ok_ = false;
+      return false;
+    }
+    *p = buf_.data() + pos_;
+    pos_ += *len;
+    return true;
+  }
+  bool failed() const { return !ok_; }
+  bool ok() const { return ok_ && pos_ == buf_.size(); }
+
+ private:
+  void read(void *v, size_t len) {
+    if (!ok_ || len > buf_.size() - pos_) {
+      ok_ = false;
+      return;
+    }
+    memcpy(v, buf_.data() + pos_, len);
+    pos_ += len;
+  }
+
+  const string &buf_;
+  size_t pos_;
+  bool ok_;
+};
+
+}  // namespace
+
+// Layout: the magic and version, then each part of the object prefixed by
+// its element count.
+string BccObject::serialize() const {
+  Writer w;
+  w.bytes(kMagic, sizeof(kMagic));
+  w.u32(kVersion);
+
+  w.u64(sections.size());
+  for (auto &section : sections) {
+    w.str(section.name);
+    w.u64(section.size);
+    w.u32(section.id);
+    w.str(section.data);
+  }
+
+  w.u64(tables.size());
+  for (auto &table : tables) {
+    w.str(table.name);
+    w.u32(table.fake_fd);
+    w.u32(table.type);
+    w.u64(table.key_size);
+    w.u64(table.leaf_size);
+    w.u64(table.max_entries);
+    w.u32(table.flags);
+    w.str(table.key_desc);
+    w.str(table.leaf_desc);
+  }
+
+  w.u64(maps.size());
+  for (auto &map : maps) {
+    w.u32(map.fake_fd);
+    w.u32(map.type);
+    w.str(map.name);
+    w.u32(map.key_size);
+    w.u32(map.value_size);
+    w.u32(map.max_entries);
+    w.u32(map.flags);
+    w.str(map.inner_map_name);
+  }
+
+  w.u64(perf_events.size());
+  for (auto &event : perf_events) {
+    w.str(event.first);
+    w.u64(event.second.size());
+    for (auto &field : event.second)
+      w.str(field);
+  }
+
+  w.u64(functions.size());
+  for (auto &func : functions) {
+    w.str(func.name);
+    w.str(func.src);
+    w.str(func.src_rewritten);
+  }
+
+  w.str(mod_src);
+
+  w.u64(values.size());
+  for (auto &value : values) {
+    w.str(value.table);
+    w.str(value.key);
+    w.str(value.leaf);
+  }
+
+  w.str(rw_types);
+
+  return std::move(w.data());
+}
+
+bool BccObject::parse(const string &buf) {
+  Reader r(buf);
+  const char *magic;
+  size_t magic_len;
+  if (!r.bytes(&magic, &magic_len) || magic_len != sizeof(kMagic) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) || r.u32() != kVersion)
+    return false;
+
+  BccObject obj;
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    Section section;
+    section.name = r.str();
+    section.size = r.u64();
+    section.id = r.u32();
+    section.data = r.str();
+    if (!section.data.empty() && section.data.size() != section.size)
+      return false;
+    obj.sections.push_back(std::move(section));
+  }
+
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    Table table;
+    table.name = r.str();
+    table.fake_fd = (int)r.u32();
+    table.type = r.u32();
+    table.key_size = r.u64();
+    table.leaf_size = r.u64();
+    table.max_entries = r.u64();
+    table.flags = r.u32();
+    table.key_desc = r.str();
+    table.leaf_desc = r.str();
+    obj.tables.push_back(std::move(table));
+  }
+
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    Map map;
+    map.fake_fd = (int)r.u32();
+    map.type = r.u32();
+    map.name = r.str();
+    map.key_size = r.u32();
+    map.value_size = r.u32();
+    map.max_entries = r.u32();
+    map.flags = r.u32();
+    map.inner_map_name = r.str();
+    obj.maps.push_back(std::move(map));
+  }
+
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    string event = r.str();
+    auto &fields = obj.perf_events[event];
+    for (uint64_t m = r.u64(); m > 0 && !r.failed(); --m)
+      fields.push_back(r.str());
+  }
+
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    Function func;
+    func.name = r.str();
+    func.src = r.str();
+    func.src_rewritten = r.str();
+    obj.functions.push_back(std::move(func));
+  }
+
+  obj.mod_src = r.str();
+
+  for (uint64_t n = r.u64(); n > 0 && !r.failed(); --n) {
+    Value value;
+    value.table = r.str();
+    value.key = r.str();
+    value.leaf = r.str();
+    obj.values.push_back(std::move(value));
+  }
+
+  obj.rw_types = r.str();
+
+  if (!r.ok())
+    return false;
+  *this = std::move(obj);
+  return true;
+}
+
+bool BccObject::save(const string &path) const {
+  // Write to a private file and rename it in place, so that concurrent
+  // readers and writers only ever see complete objects.
+  string tmp_path = path + ".XXXXXX";
+  int fd = mkstemp(&tmp_path[0]);
+  if (fd < 0)
+    return false;
+  FILE *file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  // mkstemp creates the file private to its owner.
+  fchmod(fd, 0644);
+  string buf = serialize();
+  bool ok = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool BccObject::load(const string &path) {
+  FileDesc fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return false;
+  struct stat s;
+  if (fstat(fd, &s))
+    return false;
+  string buf(s.st_size, '\0');
+  size_t off = 0;
+  while (off < buf.size()) {
+    ssize_t n = read(fd, &buf[off], buf.size() - off);
+    if (n <= 0)
+      return false;
+    off += n;
+  }
+  return parse(buf);
+}
+
+}  // namespace ebpf
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ebpf {
+
+/// A compiled BPFModule: the program sections together with the table and
+/// map descriptions needed to load them. This is the format of the program
+/// cache and of objects built ahead of time with bcc-aot. It does not depend
+/// on LLVM, so BccObjectLoader can load it in processes that do not link it.
+struct BccObject {
+  struct Section {
+    std::string name;
+    uint64_t size;
+    unsigned id;
+    std::string data;  // empty for the maps/ sections
+  };
+  struct Table {
+    std::string name;
+    int fake_fd;
+    int type;
+    size_t key_size;
+    size_t leaf_size;
+    size_t max_entries;
+    int flags;
+    std::string key_desc;
+    std::string leaf_desc;
+  };
+  struct Map {
+    int fake_fd;
+    int type;
+    std::string name;
+    int key_size;
+    int value_size;
+    int max_entries;
+    int flags;
+    std::string inner_map_name;
+  };
+  struct Function {
+    std::string name;
+    std::string src;
+    std::string src_rewritten;
+  };
+  /// Stored into a table right after the maps are created. Loaders may
+  /// change these before loading, which lets parameters of a prebuilt
+  /// program be set without compiling it again.
+  struct Value {
+    std::string table;
+    std::string key;
+    std::string leaf;
+  };
+
+  std::vector<Section> sections;
+  std::vector<Table> tables;
+  std::vector<Map> maps;
+  std::map<std::string, std::vector<std::string>> perf_events;
+  std::vector<Function> functions;
+  std::string mod_src;
+  std::vector<Value> values;
+  /// LLVM IR declaring each table with its key and leaf types, from which
+  /// the text readers and writers of the tables are rebuilt. Empty unless the
+  /// program was compiled with the rw engine enabled.
+  std::string rw_types;
+
+  std::string serialize() const;
+  bool parse(const std::string &buf);
+
+  /// The file is replaced atomically, so concurrent readers only ever see a
+  /// complete object.
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+};
+
+}  // namespace ebpf
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <linux/bpf.h>
+
+#include "bcc_libbpf_inc.h"
+#include "bcc_object_loader.h"
+#include "libbpf.h"
+
+namespace ebpf {
+
+using std::string;
+
+BccObjectLoader::~BccObjectLoader() {
+  for (auto &prog : prog_fds_)
+    close(prog.second);
+  close_maps();
+}
+
+int BccObjectLoader::open(const string &path) {
+  if (!obj_.load(path)) {
+    fprintf(stderr, "could not read bcc object %s\n", path.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int BccObjectLoader::set_value(const string &table, const string &key,
+                               const string &leaf) {
+  if (loaded_)
+    return -1;
+  const BccObject::Table *desc = this->table(table);
+  if (!desc || key.size() != desc->key_size || leaf.size() != desc->leaf_size)
+    return -1;
+  for (auto &value : obj_.values) {
+    if (value.table == table && value.key == key) {
+      value.leaf = leaf;
+      return 0;
+    }
+  }
+  obj_.values.push_back({table, key, leaf});
+  return 0;
+}
+
+int BccObjectLoader::set_param(const string &name, const void *value,
+                               size_t size) {
+  int key = 0;
+  return set_value(name, string((const char *)&key, sizeof(key)),
+                   string((const char *)value, size));
+}
+
+int BccObjectLoader::create_map(const BccObject::Map &map, int inner_map_fd) {
+  struct bpf_create_map_attr attr = {};
+  attr.map_type = (enum bpf_map_type)map.type;
+  attr.name = map.name.c_str();
+  attr.key_size = map.key_size;
+  attr.value_size = map.value_size;
+  attr.max_entries = map.max_entries;
+  attr.map_flags = map.flags;
+  attr.inner_map_fd = inner_map_fd;
+  int fd = bcc_create_map_xattr(&attr, allow_rlimit_);
+  if (fd < 0) {
+    fprintf(stderr, "could not open bpf map: %s, error: %s\n",
+            map.name.c_str(), strerror(errno));
+    return -1;
+  }
+  map_fds_[map.fake_fd] = fd;
+  return fd;
+}
+
+void BccObjectLoader::close_maps() {
+  for (auto &map : map_fds_)
+    close(map.second);
+  map_fds_.clear();
+}
+
+// Follows BPFModule::load_maps: maps used as the template of a map-in-map
+// are created first, then the remaining maps and the instructions referring
+// to them are pointed at the real fds. The object is only marked as loaded
+// once all of that succeeded, a failed load leaves no maps behind.
+int BccObjectLoader::load() {
+  if (loaded_)
+    return -1;
+
+  std::set<string> inner_maps;
+  for (auto &map : obj_.maps) {
+    if (!map.inner_map_name.empty())
+      inner_maps.insert(map.inner_map_name);
+  }
+  std::map<string, int> inner_map_fds;
+  for (auto &map : obj_.maps) {
+    if (!inner_maps.count(map.name))
+      continue;
+    if (!map.inner_map_name.empty()) {
+      fprintf(stderr, "inner map %s has inner map %s\n", map.name.c_str(),
+              map.inner_map_name.c_str());
+      close_maps();
+      return -1;
+    }
+    int fd = create_map(map, 0);
+    if (fd < 0) {
+      close_maps();
+      return -1;
+    }
+    inner_map_fds[map.name] = fd;
+  }
+  for (auto &map : obj_.maps) {
+    if (inner_maps.count(map.name))
+      continue;
+    int inner_map_fd = 0;
+    if (!map.inner_map_name.empty())
+      inner_map_fd = inner_map_fds[map.inner_map_name];
+    if (create_map(map, inner_map_fd) < 0) {
+      close_maps();
+      return -1;
+    }
+  }
+
+  for (auto &value : obj_.values) {
+    const BccObject::Table *desc = table(value.table);
+    auto it = desc ? map_fds_.find(desc->fake_fd) : map_fds_.end();
+    if (it == map_fds_.end() ||
+        bpf_update_elem(it->second, &value.key[0], &value.leaf[0], BPF_ANY)) {
+      fprintf(stderr, "could not set initial value in table %s: %s\n",
+              value.table.c_str(), strerror(errno));
+      close_maps();
+      return -1;
+    }
+  }
+
+  for (auto &section : obj_.sections) {
+    if (section.name.compare(0, strlen(BPF_FN_PREFIX), BPF_FN_PREFIX))
+      continue;
+    struct bpf_insn *insns = (struct bpf_insn *)&section.data[0];
+    size_t num_insns = section.data.size() / sizeof(*insns);
+    for (size_t i = 0; i < num_insns; i++) {
+      if (insns[i].code != (BPF_LD | BPF_DW | BPF_IMM))
+        continue;
+      if (insns[i].src_reg == BPF_PSEUDO_MAP_FD) {
+        auto it = map_fds_.find(insns[i].imm);
+        if (it != map_fds_.end())
+          insns[i].imm = it->second;
+      }
+      i++;
+    }
+  }
+  loaded_ = true;
+  return 0;
+}
+
+int BccObjectLoader::load_func(const string &name, int prog_type,
+                               int log_level, char *log_buf,
+                               unsigned log_buf_size) {
+  if (!loaded_)
+    return -1;
+  auto it = prog_fds_.find(name);
+  if (it != prog_fds_.end())
+    return it->second;
+
+  const BccObject::Section *fn = section(BPF_FN_PREFIX + name);
+  if (!fn || fn->data.empty()) {
+    fprintf(stderr, "could not find function %s\n", name.c_str());
+    return -1;
+  }
+  const BccObject::Section *license = section("license");
+  const BccObject::Section *version = section("version");
+
+  struct bpf_load_program_attr attr = {};
+  attr.prog_type = (enum bpf_prog_type)prog_type;
+  attr.name = name.c_str();
+  attr.insns = (const struct bpf_insn *)fn->data.data();
+  attr.license = license ? license->data.c_str() : nullptr;
+  if (version && version->data.size() >= sizeof(unsigned) &&
+      attr.prog_type != BPF_PROG_TYPE_TRACING &&
+      attr.prog_type != BPF_PROG_TYPE_EXT)
+    attr.kern_version = *(const unsigned *)version->data.data();
+  attr.log_level = log_level;
+
+  int fd = bcc_prog_load_xattr(&attr, fn->data.size(), log_buf, log_buf_size,
+                               allow_rlimit_);
+  if (fd >= 0)
+    prog_fds_[name] = fd;
+  return fd;
+}
+
+std::vector<string> BccObjectLoader::function_names() const {
+  std::vector<string> names;
+  size_t prefix_len = strlen(BPF_FN_PREFIX);
+  for (auto &section : obj_.sections) {
+    if (!section.name.compare(0, prefix_len, BPF_FN_PREFIX))
+      names.push_back(section.name.substr(prefix_len));
+  }
+  return names;
+}
+
+int BccObjectLoader::table_fd(const string &name) const {
+  const BccObject::Table *desc = table(name);
+  if (!desc || !loaded_)
+    return -1;
+  auto it = map_fds_.find(desc->fake_fd);
+  return it != map_fds_.end() ? it->second : -1;
+}
+
+const BccObject::Table *BccObjectLoader::table(const string &name) const {
+  for (auto &table : obj_.tables) {
+    if (table.name == name)
+      return &table;
+  }
+  return nullptr;
+}
+
+const std::vector<string> *BccObjectLoader::perf_event_fields(
+    const string &event) const {
+  auto it = obj_.perf_events.find(event);
+  return it != obj_.perf_events.end() ? &it->second : nullptr;
+}
+
+const BccObject::Section *BccObjectLoader::section(const string &name) const {
+  for (auto &section : obj_.sections) {
+    if (section.name == name)
+      return &section;
+  }
+  return nullptr;
+}
+
+}  // namespace ebpf
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bcc_object.h"
+
+namespace ebpf {
+
+/// Loads a bcc object built ahead of time by bcc-aot (or
+/// BPFModule::compile_object) into the kernel. Unlike BPFModule this needs
+/// neither clang nor LLVM, and links only against libbcc_bpf.
+class BccObjectLoader {
+ public:
+  explicit BccObjectLoader(bool allow_rlimit = true)
+      : allow_rlimit_(allow_rlimit), loaded_(false) {}
+  ~BccObjectLoader();
+
+  int open(const std::string &path);
+  /// Overrides the value stored at key in table when the maps are created,
+  /// for example a threshold kept in an array. Only valid before load().
+  int set_value(const std::string &table, const std::string &key,
+                const std::string &leaf);
+  /// Sets a parameter declared with BPF_PARAM, which must be of the size of
+  /// the parameter's type. Only valid before load().
+  int set_param(const std::string &name, const void *value, size_t size);
+  /// Creates the maps and stores their initial values. On failure no maps
+  /// are left open and load() may be called again.
+  int load();
+  /// Loads a program function, returns its fd. The fd is closed when the
+  /// loader is destroyed.
+  int load_func(const std::string &name, int prog_type, int log_level = 0,
+                char *log_buf = nullptr, unsigned log_buf_size = 0);
+
+  const BccObject &object() const { return obj_; }
+  std::vector<std::string> function_names() const;
+  /// Returns the fd of the map backing table, or -1.
+  int table_fd(const std::string &table) const;
+  const BccObject::Table *table(const std::string &name) const;
+  const std::vector<std::string> *perf_event_fields(
+      const std::string &event) const;
+
+ private:
+  const BccObject::Section *section(const std::string &name) const;
+  int create_map(const BccObject::Map &map, int inner_map_fd);
+  void close_maps();
+
+  bool allow_rlimit_;
+  bool loaded_;
+  BccObject obj_;
+  std::map<int, int> map_fds_;  // fake fd -> fd
+  std::map<std::string, int> prog_fds_;
+};
+
+}  // namespace ebpf
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include "bcc_perf_map.h"
 
@@ -80,6 +81,36 @@ bool bcc_perf_map_path(char *map_path, size_t map_len, int pid) {
   return true;
 }
 
+// Parses one perf map line and calls callback on it. Returns -1 if the line
+// is malformed.
+static int _perf_map_parse_line(char *line, bcc_perf_map_symcb callback,
+                                void *payload) {
+  char *cursor = line;
+  char *newline, *sep;
+  long long begin, len;
+
+  begin = strtoull(cursor, &sep, 16);
+  if (begin == 0 || *sep != ' ' || (begin == ULLONG_MAX && errno == ERANGE))
+    return -1;
+  cursor = sep;
+  while (*cursor && isspace(*cursor)) cursor++;
+
+  len = strtoull(cursor, &sep, 16);
+  if (*sep != ' ' ||
+      (sep == cursor && len == 0) ||
+      (len == ULLONG_MAX && errno == ERANGE))
+    return -1;
+  cursor = sep;
+  while (*cursor && isspace(*cursor)) cursor++;
+
+  newline = strchr(cursor, '\n');
+  if (newline)
+      newline[0] = '\0';
+
+  callback(cursor, begin, len, payload);
+  return 0;
+}
+
 int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
                              void* payload) {
   FILE* file = fopen(path, "r");
@@ -88,30 +119,36 @@ int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
 
   char *line = NULL;
   size_t size = 0;
-  long long begin, len;
-  while (getline(&line, &size, file) != -1) {
-    char *cursor = line;
-    char *newline, *sep;
-
-    begin = strtoull(cursor, &sep, 16);
-    if (begin == 0 || *sep != ' ' || (begin == ULLONG_MAX && errno == ERANGE))
-      continue;
-    cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
-
-    len = strtoull(cursor, &sep, 16);
-    if (*sep != ' ' ||
-        (sep == cursor && len == 0) ||
-        (len == ULLONG_MAX && errno == ERANGE))
-      continue;
-    cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
-
-    newline = strchr(cursor, '\n');
-    if (newline)
-        newline[0] = '\0';
-
-    callback(cursor, begin, len, payload);
+  while (getline(&line, &size, file) != -1)
+    _perf_map_parse_line(line, callback, payload);
+
+  free(line);
+  fclose(file);
+
+  return 0;
+}
+
+int bcc_perf_map_foreach_sym_from(const char *path, uint64_t *offset,
+                                  bcc_perf_map_symcb callback, void *payload) {
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return -1;
+
+  if (fseeko(file, (off_t)*offset, SEEK_SET) != 0) {
+    fclose(file);
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &size, file)) != -1) {
+    // The JIT may be in the middle of writing this line, leave it for the
+    // next call.
+    if (line[len - 1] != '\n')
+      break;
+    *offset += len;
+    _perf_map_parse_line(line, callback, payload);
   }
 
   free(line);
@@ -34,6 +34,11 @@ int bcc_perf_map_nstgid(int pid);
 bool bcc_perf_map_path(char *map_path, size_t map_len, int pid);
 int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
                              void* payload);
+// Same as bcc_perf_map_foreach_sym, but only reads the lines after *offset,
+// and advances it past the last complete line read. Used to pick up symbols
+// a JIT appended since the previous call.
+int bcc_perf_map_foreach_sym_from(const char *path, uint64_t *offset,
+                                  bcc_perf_map_symcb callback, void *payload);
 
 #ifdef __cplusplus
 }
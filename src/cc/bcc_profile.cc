@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstdio>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "bcc_profile.h"
+
+namespace ebpf {
+
+namespace {
+
+double wall_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+double timeval_ms(const struct timeval &tv) {
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+// Modules may be compiled on several threads at once, so CPU time is taken
+// for the calling thread only. The peak RSS can only be had for the process.
+double thread_cpu_ms() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru))
+    return 0;
+  return timeval_ms(ru.ru_utime) + timeval_ms(ru.ru_stime);
+}
+
+long max_rss_kb() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru))
+    return 0;
+  return ru.ru_maxrss;
+}
+
+}  // namespace
+
+void CompileProfile::add(PhaseStat stat) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  phases_.push_back(std::move(stat));
+}
+
+std::vector<PhaseStat> CompileProfile::phases() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return phases_;
+}
+
+std::string CompileProfile::report() const {
+  std::string out;
+  char line[256];
+  snprintf(line, sizeof(line), "%-24s %10s %10s %12s %12s\n", "PHASE",
+           "WALL(ms)", "CPU(ms)", "MAXRSS(kB)", "GROWTH(kB)");
+  out += line;
+  for (auto &phase : phases()) {
+    snprintf(line, sizeof(line), "%-24s %10.3f %10.3f %12ld %12ld\n",
+             phase.name.c_str(), phase.wall_ms, phase.cpu_ms, phase.max_rss_kb,
+             phase.max_rss_growth_kb);
+    out += line;
+  }
+  return out;
+}
+
+ScopedPhase::ScopedPhase(CompileProfile *profile, const std::string &name)
+    : profile_(profile) {
+  if (!profile_)
+    return;
+  name_ = name;
+  wall_start_ = wall_ms();
+  cpu_start_ = thread_cpu_ms();
+  max_rss_start_ = max_rss_kb();
+}
+
+ScopedPhase::~ScopedPhase() {
+  if (!profile_)
+    return;
+  PhaseStat stat;
+  stat.name = std::move(name_);
+  stat.wall_ms = wall_ms() - wall_start_;
+  stat.cpu_ms = thread_cpu_ms() - cpu_start_;
+  stat.max_rss_kb = max_rss_kb();
+  stat.max_rss_growth_kb = stat.max_rss_kb - max_rss_start_;
+  profile_->add(std::move(stat));
+}
+
+}  // namespace ebpf
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ebpf {
+
+/// Time and memory spent in one phase of compiling or loading a program.
+struct PhaseStat {
+  std::string name;
+  double wall_ms;
+  /// CPU time of the thread running the phase, user and system.
+  double cpu_ms;
+  /// Peak resident set size of the process at the end of the phase, and how
+  /// much the phase raised it.
+  long max_rss_kb;
+  long max_rss_growth_kb;
+};
+
+/// The phases recorded for a BPFModule created with DEBUG_PROFILE, in the
+/// order they finished.
+class CompileProfile {
+ public:
+  void add(PhaseStat stat);
+  std::vector<PhaseStat> phases() const;
+  /// One line per phase, in a format meant for logs.
+  std::string report() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<PhaseStat> phases_;
+};
+
+/// Records the phase running for the lifetime of the object into profile,
+/// does nothing if profile is null.
+class ScopedPhase {
+ public:
+  ScopedPhase(CompileProfile *profile, const std::string &name);
+  ~ScopedPhase();
+
+ private:
+  CompileProfile *profile_;
+  std::string name_;
+  double wall_start_;
+  double cpu_start_;
+  long max_rss_start_;
+};
+
+}  // namespace ebpf
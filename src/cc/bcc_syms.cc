@@ -30,6 +30,7 @@
 #include "bcc_proc.h"
 #include "bcc_syms.h"
 #include "common.h"
+#include "symname_index.h"
 #include "vendor/tinyformat.hpp"
 
 #include "syms.h"
@@ -47,63 +48,43 @@ bool ProcStat::is_stale() {
 ProcStat::ProcStat(int pid)
     : procfs_(tfm::format("/proc/%d/exe", pid)), inode_(getinode_()) {}
 
-void KSyms::_add_symbol(const char *symname, const char *modname, uint64_t addr, void *p) {
-  KSyms *ks = static_cast<KSyms *>(p);
-  ks->syms_.emplace_back(symname, modname, addr);
-}
-
+// Like bcc_procutils_each_ksym(), only root sees the symbol addresses.
 void KSyms::refresh() {
-  if (syms_.empty()) {
-    bcc_procutils_each_ksym(_add_symbol, this);
-    std::sort(syms_.begin(), syms_.end());
-  }
+  if (!index_ && geteuid() == 0)
+    index_ = KallsymsIndex::get();
 }
 
 bool KSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle) {
   refresh();
 
-  std::vector<Symbol>::iterator it;
-
-  if (syms_.empty())
-    goto unknown_symbol;
-
-  it = std::upper_bound(syms_.begin(), syms_.end(), Symbol("", "", addr));
-  if (it != syms_.begin()) {
-    it--;
-    sym->name = (*it).name.c_str();
-    if (demangle)
-      sym->demangle_name = sym->name;
-    sym->module = (*it).mod.c_str();
-    sym->offset = addr - (*it).addr;
-    return true;
+  const KallsymsIndex::Symbol *s = index_ ? index_->find_addr(addr) : nullptr;
+  if (!s || s->addr == 0) {
+    memset(sym, 0, sizeof(struct bcc_symbol));
+    return false;
   }
 
-unknown_symbol:
-  memset(sym, 0, sizeof(struct bcc_symbol));
-  return false;
+  sym->name = index_->name(*s);
+  if (demangle)
+    sym->demangle_name = sym->name;
+  sym->module = index_->module(*s);
+  sym->offset = addr - s->addr;
+  return true;
 }
 
 bool KSyms::resolve_name(const char *_unused, const char *name,
                          uint64_t *addr) {
   refresh();
 
-  if (syms_.size() != symnames_.size()) {
-    symnames_.clear();
-    for (Symbol &sym : syms_) {
-      symnames_[sym.name] = sym.addr;
-    }
-  }
-
-  auto it = symnames_.find(name);
-  if (it == symnames_.end())
+  const KallsymsIndex::Symbol *s = index_ ? index_->find_name(name) : nullptr;
+  if (!s || s->addr == 0)
     return false;
 
-  *addr = it->second;
+  *addr = s->addr;
   return true;
 }
 
 ProcSyms::ProcSyms(int pid, struct bcc_symbol_option *option)
-    : pid_(pid), procstat_(pid) {
+    : pid_(pid), procstat_(pid), prefetch_next_(0), prefetch_nthreads_(0) {
   if (option)
     std::memcpy(&symbol_option_, option, sizeof(bcc_symbol_option));
   else
@@ -116,6 +97,44 @@ ProcSyms::ProcSyms(int pid, struct bcc_symbol_option *option)
   load_modules();
 }
 
+ProcSyms::~ProcSyms() { stop_prefetch(); }
+
+void ProcSyms::prefetch(int nthreads) {
+  stop_prefetch();
+  prefetch_nthreads_ = nthreads;
+  start_prefetch();
+}
+
+void ProcSyms::start_prefetch() {
+  prefetch_queue_.clear();
+  for (Module &mod : modules_) {
+    // The vDSO image is extracted into shared global state, leave it to the
+    // resolving thread.
+    if (mod.type_ == ModuleType::EXEC || mod.type_ == ModuleType::SO ||
+        mod.type_ == ModuleType::PERF_MAP)
+      prefetch_queue_.push_back(&mod);
+  }
+
+  prefetch_next_ = 0;
+  size_t nthreads = std::min<size_t>(std::max(prefetch_nthreads_, 0),
+                                     prefetch_queue_.size());
+  for (size_t i = 0; i < nthreads; i++)
+    prefetch_threads_.emplace_back([this]() {
+      size_t next;
+      while ((next = prefetch_next_++) < prefetch_queue_.size())
+        prefetch_queue_[next]->load_sym_table();
+    });
+}
+
+void ProcSyms::stop_prefetch() {
+  // Make the threads stop after the modules they are loading right now
+  prefetch_next_ = prefetch_queue_.size();
+  for (std::thread &thread : prefetch_threads_)
+    thread.join();
+  prefetch_threads_.clear();
+  prefetch_queue_.clear();
+}
+
 int ProcSyms::_add_load_sections(uint64_t v_addr, uint64_t mem_sz,
                                  uint64_t file_offset, void *payload) {
   auto module = static_cast<Module *>(payload);
@@ -125,39 +144,150 @@ int ProcSyms::_add_load_sections(uint64_t v_addr, uint64_t mem_sz,
 
 void ProcSyms::load_exe() {
   std::string exe = ebpf::get_pid_exe(pid_);
+  struct stat s;
+  bool have_stat = !stat(exe.c_str(), &s);
+
+  if (have_stat) {
+    Module *reused = reuse_module(exe, exe, major(s.st_dev), minor(s.st_dev),
+                                  s.st_ino);
+    if (reused) {
+      bcc_elf_foreach_load_section(exe.c_str(), &_add_load_sections, reused);
+      return;
+    }
+  }
+
   Module module(exe.c_str(), exe.c_str(), &symbol_option_);
 
   if (module.type_ != ModuleType::EXEC)
     return;
 
+  if (have_stat) {
+    module.dev_major_ = major(s.st_dev);
+    module.dev_minor_ = minor(s.st_dev);
+    module.inode_ = s.st_ino;
+  }
 
   bcc_elf_foreach_load_section(exe.c_str(), &_add_load_sections, &module);
 
-  if (!module.ranges_.empty())
+  if (!module.ranges_.empty()) {
+    module_idx_[module.name_] = modules_.size();
     modules_.emplace_back(std::move(module));
+  }
 }
 
 void ProcSyms::load_modules() {
   load_exe();
   bcc_procutils_each_module(pid_, _add_module, this);
+  build_range_index();
 }
 
 void ProcSyms::refresh() {
+  stop_prefetch();
+
+  // Keep the current modules aside so that those still mapping the same file
+  // are moved back by load_modules() together with their symbol tables,
+  // instead of having to load them again.
+  stale_modules_.clear();
+  for (Module &mod : modules_) {
+    std::string name = mod.name_;
+    stale_modules_.emplace(std::move(name), std::move(mod));
+  }
   modules_.clear();
+  module_idx_.clear();
+
   load_modules();
+  stale_modules_.clear();
   procstat_.reset();
+
+  start_prefetch();
+}
+
+ProcSyms::Module *ProcSyms::reuse_module(const std::string &name,
+                                         const std::string &path,
+                                         uint64_t dev_major,
+                                         uint64_t dev_minor, uint64_t inode) {
+  auto it = stale_modules_.find(name);
+  if (it == stale_modules_.end())
+    return nullptr;
+
+  Module &stale = it->second;
+  if (stale.path_ != path || !stale.same_file(dev_major, dev_minor, inode))
+    return nullptr;
+
+  stale.ranges_.clear();
+  // perf-PID map files are appended to in place, pick up the new lines on
+  // next lookup.
+  if (stale.type_ == ModuleType::PERF_MAP)
+    stale.load_once_.reset(new std::once_flag);
+  module_idx_[name] = modules_.size();
+  modules_.emplace_back(std::move(stale));
+  stale_modules_.erase(it);
+  return &modules_.back();
+}
+
+void ProcSyms::build_range_index() {
+  range_index_.clear();
+  perf_map_idx_.clear();
+
+  for (size_t i = 0; i < modules_.size(); i++) {
+    const Module &mod = modules_[i];
+    // perf-PID maps cover the whole address space and are only consulted
+    // after the other modules, keep them out of the index.
+    if (mod.type_ == ModuleType::PERF_MAP) {
+      perf_map_idx_.push_back(i);
+      continue;
+    }
+    for (size_t j = 0; j < mod.ranges_.size(); j++)
+      range_index_.push_back({mod.ranges_[j].start, mod.ranges_[j].end, 0, i,
+                              j});
+  }
+
+  std::sort(range_index_.begin(), range_index_.end());
+  uint64_t max_end = 0;
+  for (RangeEntry &entry : range_index_) {
+    max_end = std::max(max_end, entry.end);
+    entry.max_end = max_end;
+  }
+}
+
+ProcSyms::Module *ProcSyms::find_module(uint64_t addr, uint64_t &offset) {
+  auto it = std::upper_bound(range_index_.begin(), range_index_.end(),
+                             RangeEntry{addr, 0, 0, 0, 0});
+  // Walk back over all ranges starting at or below addr that could still
+  // cover it. If several modules do, prefer the one loaded first.
+  const RangeEntry *match = nullptr;
+  while (it != range_index_.begin()) {
+    --it;
+    if (it->max_end <= addr)
+      break;
+    if (addr < it->end && (!match || it->module_idx < match->module_idx))
+      match = &*it;
+  }
+  if (!match)
+    return nullptr;
+
+  Module &mod = modules_[match->module_idx];
+  offset = mod.range_offset(mod.ranges_[match->range_idx], addr);
+  return &mod;
 }
 
 int ProcSyms::_add_module(mod_info *mod, int enter_ns, void *payload) {
   ProcSyms *ps = static_cast<ProcSyms *>(payload);
   std::string ns_relative_path = tfm::format("/proc/%d/root%s", ps->pid_, mod->name);
   const char *modpath = enter_ns && ps->pid_ != -1 ? ns_relative_path.c_str() : mod->name;
-  auto it = std::find_if(
-      ps->modules_.begin(), ps->modules_.end(),
-      [=](const ProcSyms::Module &m) { return m.name_ == mod->name; });
-  if (it == ps->modules_.end()) {
+  Module *m = nullptr;
+  auto idx = ps->module_idx_.find(mod->name);
+  if (idx != ps->module_idx_.end())
+    m = &ps->modules_[idx->second];
+  if (!m)
+    m = ps->reuse_module(mod->name, modpath, mod->dev_major, mod->dev_minor,
+                         mod->inode);
+  if (!m) {
     auto module = Module(
         mod->name, modpath, &ps->symbol_option_);
+    module.dev_major_ = mod->dev_major;
+    module.dev_minor_ = mod->dev_minor;
+    module.inode_ = mod->inode;
 
     // pid/maps doesn't account for file_offset of text within the ELF.
     // It only gives the mmap offset. We need the real offset for symbol
@@ -170,23 +300,33 @@ int ProcSyms::_add_module(mod_info *mod, int enter_ns, void *payload) {
       }
     }
 
-    if (!bcc_is_perf_map(modpath) || module.type_ != ModuleType::UNKNOWN)
+    if (!bcc_is_perf_map(modpath) || module.type_ != ModuleType::UNKNOWN) {
       // Always add the module even if we can't read it, so that we could
       // report correct module name. Unless it's a perf map that we only
       // add readable ones.
-      it = ps->modules_.insert(ps->modules_.end(), std::move(module));
-    else
+      ps->module_idx_[module.name_] = ps->modules_.size();
+      ps->modules_.emplace_back(std::move(module));
+      m = &ps->modules_.back();
+    } else
       return 0;
   }
-  it->ranges_.emplace_back(mod->start_addr, mod->end_addr, mod->file_offset);
+  m->ranges_.emplace_back(mod->start_addr, mod->end_addr, mod->file_offset);
   // perf-PID map is added last. We try both inside the Process's mount
   // namespace + chroot, and in global /tmp. Make sure we only add one.
-  if (it->type_ == ModuleType::PERF_MAP)
+  if (m->type_ == ModuleType::PERF_MAP)
     return -1;
 
   return 0;
 }
 
+static void demangle_symbol(struct bcc_symbol *sym) {
+  if (sym->name && (!strncmp(sym->name, "_Z", 2) || !strncmp(sym->name, "___Z", 4)))
+    sym->demangle_name =
+        abi::__cxa_demangle(sym->name, nullptr, nullptr, nullptr);
+  if (!sym->demangle_name)
+    sym->demangle_name = sym->name;
+}
+
 bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
                             bool demangle) {
   if (procstat_.is_stale())
@@ -196,28 +336,25 @@ bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
 
   const char *original_module = nullptr;
   uint64_t offset;
-  bool only_perf_map = false;
-  for (Module &mod : modules_) {
-    if (only_perf_map && (mod.type_ != ModuleType::PERF_MAP))
-      continue;
-    if (mod.contains(addr, offset)) {
-      if (mod.find_addr(offset, sym)) {
-        if (demangle) {
-          if (sym->name && (!strncmp(sym->name, "_Z", 2) || !strncmp(sym->name, "___Z", 4)))
-            sym->demangle_name =
-                abi::__cxa_demangle(sym->name, nullptr, nullptr, nullptr);
-          if (!sym->demangle_name)
-            sym->demangle_name = sym->name;
-        }
-        return true;
-      } else if (mod.type_ != ModuleType::PERF_MAP) {
-        // In this case, we found the address in the range of a module, but
-        // not able to find a symbol of that address in the module.
-        // Thus, we would try to find the address in perf map, and
-        // save the module's name in case we will need it later.
-        original_module = mod.name_.c_str();
-        only_perf_map = true;
-      }
+  Module *mod = find_module(addr, offset);
+  if (mod) {
+    if (mod->find_addr(offset, sym)) {
+      if (demangle)
+        demangle_symbol(sym);
+      return true;
+    }
+    // In this case, we found the address in the range of a module, but
+    // not able to find a symbol of that address in the module.
+    // Thus, we would try to find the address in perf map, and
+    // save the module's name in case we will need it later.
+    original_module = mod->name_.c_str();
+  }
+  for (size_t idx : perf_map_idx_) {
+    Module &perf_map = modules_[idx];
+    if (perf_map.contains(addr, offset) && perf_map.find_addr(offset, sym)) {
+      if (demangle)
+        demangle_symbol(sym);
+      return true;
     }
   }
   // If we didn't find the symbol anywhere, the module name is probably
@@ -229,6 +366,22 @@ bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
   return false;
 }
 
+bool ProcSyms::find_module_file(uint64_t addr, ModuleFile *file) {
+  if (procstat_.is_stale())
+    refresh();
+
+  uint64_t offset;
+  Module *mod = find_module(addr, offset);
+  if (!mod || (mod->type_ != ModuleType::EXEC && mod->type_ != ModuleType::SO))
+    return false;
+
+  file->path = &mod->path_;
+  file->addr = offset;
+  file->option = mod->symbol_option_;
+  file->debug_info = &mod->debug_info_;
+  return true;
+}
+
 bool ProcSyms::resolve_name(const char *module, const char *name,
                             uint64_t *addr) {
   if (procstat_.is_stale())
@@ -245,9 +398,14 @@ ProcSyms::Module::Module(const char *name, const char *path,
     struct bcc_symbol_option *option)
     : name_(name),
       path_(path),
-      loaded_(false),
+      load_once_(new std::once_flag),
       symbol_option_(option),
-      type_(ModuleType::UNKNOWN) {
+      type_(ModuleType::UNKNOWN),
+      dev_major_(0),
+      dev_minor_(0),
+      inode_(0),
+      perf_map_offset_(0),
+      perf_map_inode_(0) {
   int elf_type = bcc_elf_get_type(path_.c_str());
   // The Module is an ELF file
   if (elf_type >= 0) {
@@ -286,20 +444,28 @@ int ProcSyms::Module::_add_symbol_lazy(size_t section_idx, size_t str_table_idx,
 }
 
 void ProcSyms::Module::load_sym_table() {
-  if (loaded_)
-    return;
-  loaded_ = true;
+  std::call_once(*load_once_, &Module::do_load_sym_table, this);
+}
 
+void ProcSyms::Module::do_load_sym_table() {
   if (type_ == ModuleType::UNKNOWN)
     return;
 
-  if (type_ == ModuleType::PERF_MAP)
-    bcc_perf_map_foreach_sym(path_.c_str(), _add_symbol, this);
+  if (type_ == ModuleType::PERF_MAP) {
+    load_perf_map();
+    return;
+  }
   if (type_ == ModuleType::EXEC || type_ == ModuleType::SO) {
-    if (symbol_option_->lazy_symbolize)
-      bcc_elf_foreach_sym_lazy(path_.c_str(), _add_symbol_lazy, symbol_option_, this);
+    sym_index_ = SymbolIndex::load(path_, symbol_option_);
+    if (sym_index_)
+      return;
+    // The bcc_elf_foreach_sym* functions write to the option, which is
+    // shared with modules being loaded on other threads.
+    bcc_symbol_option option = *symbol_option_;
+    if (option.lazy_symbolize)
+      bcc_elf_foreach_sym_lazy(path_.c_str(), _add_symbol_lazy, &option, this);
     else
-      bcc_elf_foreach_sym(path_.c_str(), _add_symbol, symbol_option_, this);
+      bcc_elf_foreach_sym(path_.c_str(), _add_symbol, &option, this);
   }
   if (type_ == ModuleType::VDSO)
     bcc_elf_foreach_vdso_sym(_add_symbol, this);
@@ -307,19 +473,64 @@ void ProcSyms::Module::load_sym_table() {
   std::sort(syms_.begin(), syms_.end());
 }
 
+int ProcSyms::Module::_add_perf_map_symbol(const char *symname,
+                                           uint64_t start, uint64_t size,
+                                           void *p) {
+  Module *m = static_cast<Module *>(p);
+  uint64_t end = start + size;
+  if (end <= start)
+    return 0;
+
+  auto &syms = m->perf_map_syms_;
+  auto it = syms.lower_bound(start);
+  // Cut the entry starting before this one short, keeping its tail if it
+  // extends past this one.
+  if (it != syms.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second.end > start) {
+      if (prev->second.end > end)
+        syms.emplace(end, prev->second);
+      prev->second.end = start;
+    }
+  }
+  // Drop entries covered by this one, keeping the tail of the last one.
+  while (it != syms.end() && it->first < end) {
+    if (it->second.end > end) {
+      PerfMapSymbol tail = it->second;
+      syms.erase(it);
+      syms.emplace(end, tail);
+      break;
+    }
+    it = syms.erase(it);
+  }
+
+  auto res = m->symnames_.emplace(symname);
+  syms.emplace(start, PerfMapSymbol{start, end, &*(res.first)});
+  return 0;
+}
+
+void ProcSyms::Module::load_perf_map() {
+  struct stat s;
+  if (stat(path_.c_str(), &s))
+    return;
+
+  // The map was re-created, e.g. the pid was reused, start over.
+  if (s.st_ino != perf_map_inode_ ||
+      static_cast<uint64_t>(s.st_size) < perf_map_offset_) {
+    perf_map_syms_.clear();
+    symnames_.clear();
+    perf_map_offset_ = 0;
+    perf_map_inode_ = s.st_ino;
+  }
+
+  bcc_perf_map_foreach_sym_from(path_.c_str(), &perf_map_offset_,
+                                _add_perf_map_symbol, this);
+}
+
 bool ProcSyms::Module::contains(uint64_t addr, uint64_t &offset) const {
   for (const auto &range : ranges_) {
     if (addr >= range.start && addr < range.end) {
-      if (type_ == ModuleType::SO || type_ == ModuleType::VDSO) {
-        // Offset within the mmap
-        offset = addr - range.start + range.file_offset;
-
-        // Offset within the ELF for SO symbol lookup
-        offset += (elf_so_addr_ - elf_so_offset_);
-      } else {
-        offset = addr;
-      }
-
+      offset = range_offset(range, addr);
       return true;
     }
   }
@@ -327,6 +538,18 @@ bool ProcSyms::Module::contains(uint64_t addr, uint64_t &offset) const {
   return false;
 }
 
+uint64_t ProcSyms::Module::range_offset(const Range &range,
+                                        uint64_t addr) const {
+  if (type_ == ModuleType::SO || type_ == ModuleType::VDSO) {
+    // Offset within the mmap
+    uint64_t offset = addr - range.start + range.file_offset;
+
+    // Offset within the ELF for SO symbol lookup
+    return offset + (elf_so_addr_ - elf_so_offset_);
+  }
+  return addr;
+}
+
 bool ProcSyms::Module::find_name(const char *symname, uint64_t *addr) {
   struct Payload {
     const char *symname;
@@ -367,12 +590,57 @@ bool ProcSyms::Module::find_name(const char *symname, uint64_t *addr) {
   return true;
 }
 
+bool ProcSyms::Module::find_perf_map_addr(uint64_t offset,
+                                          struct bcc_symbol *sym) {
+  auto it = perf_map_syms_.upper_bound(offset);
+  if (it == perf_map_syms_.begin())
+    return false;
+
+  --it;
+  if (offset >= it->second.end)
+    return false;
+
+  sym->name = it->second.name->c_str();
+  sym->offset = offset - it->second.start;
+  return true;
+}
+
+bool ProcSyms::Module::find_index_addr(uint64_t offset,
+                                       struct bcc_symbol *sym) {
+  auto it = std::upper_bound(sym_index_->begin(), sym_index_->end(),
+                             SymbolIndex::Entry{offset, 0, 0});
+  if (it == sym_index_->begin())
+    return false;
+
+  // Step back over nested symbols, see find_addr() below.
+  --it;
+  uint64_t limit = it->start;
+  for (; offset >= it->start; --it) {
+    if (offset < it->start + it->size) {
+      sym->name = sym_index_->name(*it);
+      sym->offset = (offset - it->start);
+      return sym->name != nullptr;
+    }
+    if (limit > it->start + it->size)
+      break;
+    if (it == sym_index_->begin())
+      break;
+  }
+
+  return false;
+}
+
 bool ProcSyms::Module::find_addr(uint64_t offset, struct bcc_symbol *sym) {
   load_sym_table();
 
   sym->module = name_.c_str();
   sym->offset = offset;
 
+  if (type_ == ModuleType::PERF_MAP)
+    return find_perf_map_addr(offset, sym);
+  if (sym_index_)
+    return find_index_addr(offset, sym);
+
   auto it = std::upper_bound(syms_.begin(), syms_.end(), Symbol(nullptr, offset, 0));
   if (it == syms_.begin())
     return false;
@@ -439,6 +707,12 @@ bool BuildSyms::Module::load_sym_table()
     .use_symbol_type = (1 << STT_FUNC) | (1 << STT_GNU_IFUNC)
   };
 
+  sym_index_ = SymbolIndex::load(module_name_, &symbol_option_);
+  if (sym_index_) {
+    loaded_ = true;
+    return true;
+  }
+
   bcc_elf_foreach_sym(module_name_.c_str(), _add_symbol, &symbol_option_, this);
   std::sort(syms_.begin(), syms_.end());
 
@@ -465,6 +739,20 @@ bool BuildSyms::Module::resolve_addr(uint64_t offset, struct bcc_symbol* sym,
 
   load_sym_table();
 
+  if (sym_index_) {
+    auto idx = std::upper_bound(sym_index_->begin(), sym_index_->end(),
+                                SymbolIndex::Entry{offset, 0, 0});
+    if (idx != sym_index_->begin() && sym_index_->name(*--idx)) {
+      sym->name = sym_index_->name(*idx);
+      if (demangle)
+        sym->demangle_name = sym->name;
+      sym->offset = offset - idx->start;
+      sym->module = module_name_.c_str();
+      return true;
+    }
+    goto unknown_symbol;
+  }
+
   if (syms_.empty())
     goto unknown_symbol;
 
@@ -558,6 +846,56 @@ void bcc_symcache_refresh(void *resolver) {
   cache->refresh();
 }
 
+void bcc_symcache_prefetch(void *resolver, int nthreads) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  cache->prefetch(nthreads);
+}
+
+void *bcc_kallsyms_get(void) {
+  auto index = KallsymsIndex::get();
+  if (!index)
+    return nullptr;
+  return static_cast<void *>(new std::shared_ptr<KallsymsIndex>(index));
+}
+
+void bcc_kallsyms_put(void *index) {
+  delete static_cast<std::shared_ptr<KallsymsIndex> *>(index);
+}
+
+void bcc_kallsyms_invalidate(void) { KallsymsIndex::invalidate(); }
+
+int bcc_kallsyms_lookup_name(void *index, const char *name, uint64_t *addr) {
+  auto &idx = *static_cast<std::shared_ptr<KallsymsIndex> *>(index);
+  const KallsymsIndex::Symbol *sym = idx->find_name(name);
+  if (!sym)
+    return -1;
+  *addr = sym->addr;
+  return 0;
+}
+
+int bcc_kallsyms_lookup_addr(void *index, uint64_t addr,
+                             struct bcc_symbol *sym) {
+  auto &idx = *static_cast<std::shared_ptr<KallsymsIndex> *>(index);
+  const KallsymsIndex::Symbol *s = idx->find_addr(addr);
+  if (!s) {
+    memset(sym, 0, sizeof(struct bcc_symbol));
+    return -1;
+  }
+  sym->name = idx->name(*s);
+  sym->demangle_name = sym->name;
+  sym->module = idx->module(*s);
+  sym->offset = addr - s->addr;
+  return 0;
+}
+
+int bcc_kallsyms_foreach(void *index, const char *pattern, int flags,
+                         bcc_kallsyms_cb cb, void *payload) {
+  auto &idx = *static_cast<std::shared_ptr<KallsymsIndex> *>(index);
+  return idx->foreach(pattern, flags, [&](const KallsymsIndex::Symbol &sym) {
+    return cb(idx->name(sym), idx->module(sym), sym.addr, payload) == 0;
+  });
+}
+
 void *bcc_buildsymcache_new(void) {
   return static_cast<void *>(new BuildSyms());
 }
@@ -703,6 +1041,10 @@ int _find_load(uint64_t v_addr, uint64_t mem_sz, uint64_t file_offset,
   return 0;
 }
 
+void bcc_symname_cache_invalidate(void) {
+  SymnameIndex::invalidate();
+}
+
 int bcc_resolve_symname(const char *module, const char *symname,
                         const uint64_t addr, int pid,
                         struct bcc_symbol_option *option,
@@ -742,6 +1084,17 @@ int bcc_resolve_symname(const char *module, const char *symname,
   if (option == NULL)
     option = &default_option;
 
+  // Resolve through the cached index of the module if it can be built,
+  // falling back to reading the module otherwise
+  if (auto index = SymnameIndex::get(sym->module, option)) {
+    if (sym->name && sym->offset == 0x0 &&
+        !index->find_name(sym->name, &sym->offset))
+      goto invalid_module;
+    if (sym->offset == 0x0 || !index->file_offset(sym->offset, &sym->offset))
+      goto invalid_module;
+    return 0;
+  }
+
   if (sym->name && sym->offset == 0x0)
     if (bcc_elf_foreach_sym(sym->module, _find_sym, option, sym) < 0)
       goto invalid_module;
@@ -31,6 +31,15 @@ struct bcc_symbol {
   uint64_t offset;
 };
 
+// Source location of one frame of an inline chain, see
+// bcc_symcache_resolve_lines()
+struct bcc_symbol_line {
+  const char *function;
+  const char *file;
+  uint32_t line;
+  uint32_t column;
+};
+
 typedef int (*SYM_CB)(const char *symname, uint64_t addr);
 struct mod_info;
 
@@ -67,7 +76,48 @@ int bcc_symcache_resolve_no_demangle(void *symcache, uint64_t addr,
 
 int bcc_symcache_resolve_name(void *resolver, const char *module,
                               const char *name, uint64_t *addr);
+// Expand addr into its source location and the chain of functions inlined at
+// it, using the DWARF line table and inline subroutine information of its
+// module, or of the module's separate debuginfo file. frames[0] is the
+// innermost inlined function, the last frame the function that contains addr
+// in the symbol table. Function names are demangled.
+// Returns the number of frames written, or -1 if there is no debug
+// information for addr. The strings stay valid until the symcache is freed or
+// refreshed.
+int bcc_symcache_resolve_lines(void *resolver, uint64_t addr,
+                               struct bcc_symbol_line *frames, int max_frames);
 void bcc_symcache_refresh(void *resolver);
+// Load the symbol tables of all modules of a process symcache on nthreads
+// background threads, instead of on first lookup in each module. Lookups only
+// wait for the module they need. Does nothing for the kernel symcache.
+void bcc_symcache_prefetch(void *resolver, int nthreads);
+
+// The kernel symbols, parsed from /proc/kallsyms once per process and shared
+// with the kernel symcache. bcc_kallsyms_get() returns a reference to the
+// index, NULL if kallsyms cannot be read, to be released with
+// bcc_kallsyms_put(). bcc_kallsyms_invalidate() makes the next
+// bcc_kallsyms_get() read kallsyms again, e.g. after loading a module.
+void *bcc_kallsyms_get(void);
+void bcc_kallsyms_put(void *index);
+void bcc_kallsyms_invalidate(void);
+int bcc_kallsyms_lookup_name(void *index, const char *name, uint64_t *addr);
+// sym->name and sym->module stay valid until the index is put
+int bcc_kallsyms_lookup_addr(void *index, uint64_t addr,
+                             struct bcc_symbol *sym);
+
+// Flags of bcc_kallsyms_foreach()
+// pattern is a POSIX extended regex instead of a shell glob
+#define BCC_KALLSYMS_REGEX 0x1
+// Only the functions a kprobe can be attached to: text symbols outside of the
+// init and irqentry sections, and not blacklisted
+#define BCC_KALLSYMS_KPROBES 0x2
+
+typedef int (*bcc_kallsyms_cb)(const char *name, const char *module,
+                               uint64_t addr, void *payload);
+// Call cb on each symbol matching pattern (all symbols if NULL), in address
+// order, until it returns non-zero. Returns -1 if pattern is invalid.
+int bcc_kallsyms_foreach(void *index, const char *pattern, int flags,
+                         bcc_kallsyms_cb cb, void *payload);
 
 int _bcc_syms_find_module(struct mod_info *info, int enter_ns, void *p);
 int bcc_resolve_global_addr(int pid, const char *module, const uint64_t address,
@@ -97,10 +147,15 @@ int bcc_foreach_function_symbol(const char *module, SYM_CB cb);
 //
 // Return 0 on success and -1 on failure. Output will be write to sym. After
 // use, sym->module need to be freed if it's not empty.
+//
+// The symbols and load sections of each module are read once and cached for
+// the life of the process, keyed by device, inode and modification time.
 int bcc_resolve_symname(const char *module, const char *symname,
                         const uint64_t addr, int pid,
                         struct bcc_symbol_option* option,
                         struct bcc_symbol *sym);
+// Drop the modules cached by bcc_resolve_symname().
+void bcc_symname_cache_invalidate(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cxxabi.h>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+#if LLVM_MAJOR_VERSION >= 9
+#include <llvm/DebugInfo/DIContext.h>
+#include <llvm/DebugInfo/DWARF/DWARFContext.h>
+#include <llvm/Object/ObjectFile.h>
+#endif
+
+#include "bcc_elf.h"
+#include "bcc_syms.h"
+#include "syms.h"
+
+#if LLVM_MAJOR_VERSION >= 9
+
+using namespace llvm;
+
+// DWARF of one module, parsed by LLVM. DWARFContext only extracts the DIEs
+// and line table of a compilation unit when an address inside it is looked
+// up, and keeps them for later lookups, so the memory used grows with the
+// code that is actually hit rather than with the size of the binary.
+class ModuleDebugInfo {
+ public:
+  static std::shared_ptr<ModuleDebugInfo> load(
+      const std::string &path, const bcc_symbol_option *option);
+
+  int resolve(uint64_t addr, bcc_symbol_line *frames, int max_frames);
+
+ private:
+  bool open(const std::string &path);
+  const char *intern(const std::string &str, bool demangle);
+
+  object::OwningBinary<object::ObjectFile> binary_;
+  std::unique_ptr<DWARFContext> context_;
+  // Backs the strings handed out in bcc_symbol_line
+  std::unordered_set<std::string> strings_;
+};
+
+bool ModuleDebugInfo::open(const std::string &path) {
+  auto binary = object::ObjectFile::createObjectFile(path);
+  if (!binary) {
+    consumeError(binary.takeError());
+    return false;
+  }
+
+  std::unique_ptr<DWARFContext> context =
+      DWARFContext::create(*binary->getBinary());
+  if (!context || context->getNumCompileUnits() == 0)
+    return false;
+
+  binary_ = std::move(*binary);
+  context_ = std::move(context);
+  return true;
+}
+
+std::shared_ptr<ModuleDebugInfo> ModuleDebugInfo::load(
+    const std::string &path, const bcc_symbol_option *option) {
+  std::shared_ptr<ModuleDebugInfo> info = std::make_shared<ModuleDebugInfo>();
+
+  // Distributions usually strip the DWARF into a separate file, prefer it.
+  // Keep the result even if neither has any, so we don't retry every time.
+  if (option->use_debug_file) {
+    char *debug_file = bcc_elf_find_debug_file(path.c_str(),
+                                               option->check_debug_file_crc);
+    if (debug_file) {
+      bool found = info->open(debug_file);
+      ::free(debug_file);
+      if (found)
+        return info;
+    }
+  }
+  info->open(path);
+  return info;
+}
+
+const char *ModuleDebugInfo::intern(const std::string &str, bool demangle) {
+  if (str == "<invalid>")
+    return nullptr;
+
+  if (demangle && (!str.compare(0, 2, "_Z") || !str.compare(0, 4, "___Z"))) {
+    char *demangled = abi::__cxa_demangle(str.c_str(), nullptr, nullptr,
+                                          nullptr);
+    if (demangled) {
+      const char *res = strings_.emplace(demangled).first->c_str();
+      ::free(demangled);
+      return res;
+    }
+  }
+  return strings_.emplace(str).first->c_str();
+}
+
+int ModuleDebugInfo::resolve(uint64_t addr, bcc_symbol_line *frames,
+                             int max_frames) {
+  if (!context_)
+    return -1;
+
+  DILineInfoSpecifier spec(
+      DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath,
+      DILineInfoSpecifier::FunctionNameKind::LinkageName);
+  DIInliningInfo inlining = context_->getInliningInfoForAddress(
+      {addr, object::SectionedAddress::UndefSection}, spec);
+
+  int nframes = inlining.getNumberOfFrames();
+  if (nframes == 0 || (nframes == 1 && inlining.getFrame(0).Line == 0 &&
+                       inlining.getFrame(0).FunctionName == "<invalid>"))
+    return -1;
+
+  int i;
+  for (i = 0; i < nframes && i < max_frames; i++) {
+    const DILineInfo &frame = inlining.getFrame(i);
+    frames[i].function = intern(frame.FunctionName, true);
+    frames[i].file = intern(frame.FileName, false);
+    frames[i].line = frame.Line;
+    frames[i].column = frame.Column;
+  }
+  return i;
+}
+
+#else
+
+class ModuleDebugInfo {
+ public:
+  static std::shared_ptr<ModuleDebugInfo> load(
+      const std::string &path, const bcc_symbol_option *option) {
+    return nullptr;
+  }
+  int resolve(uint64_t addr, bcc_symbol_line *frames, int max_frames) {
+    return -1;
+  }
+};
+
+#endif
+
+extern "C" {
+
+int bcc_symcache_resolve_lines(void *resolver, uint64_t addr,
+                               struct bcc_symbol_line *frames,
+                               int max_frames) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  SymbolCache::ModuleFile file;
+  if (!cache->find_module_file(addr, &file))
+    return -1;
+
+  if (!*file.debug_info)
+    *file.debug_info = ModuleDebugInfo::load(*file.path, file.option);
+  if (!*file.debug_info)
+    return -1;
+  return (*file.debug_info)->resolve(file.addr, frames, max_frames);
+}
+
+}
@@ -71,6 +71,11 @@ int bcc_usdt_get_argument(void *usdt, const char *provider_name,
 
 int bcc_usdt_enable_probe(void *, const char *, const char *);
 int bcc_usdt_addsem_probe(void *, const char *, const char *, int16_t);
+// Enable len probes at once, provider_names or its entries may be NULL to
+// match any provider. Enables none of them on failure.
+int bcc_usdt_enable_probes(void *usdt, const char **provider_names,
+                           const char **probe_names, const char **fn_names,
+                           int len);
 #define BCC_USDT_HAS_FULLY_SPECIFIED_PROBE
 int bcc_usdt_enable_fully_specified_probe(void *, const char *, const char *,
                                           const char *);
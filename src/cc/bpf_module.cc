@@ -13,8 +13,10 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <cerrno>
 #include <fcntl.h>
 #include <map>
+#include <mutex>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -101,21 +103,26 @@ BPFModule::BPFModule(unsigned flags, TableStorage *ts, bool rw_engine_enabled,
       rw_engine_enabled_(rw_engine_enabled && bpf_module_rw_engine_enabled()),
       used_b_loader_(false),
       allow_rlimit_(allow_rlimit),
+      from_object_(false),
       ctx_(new LLVMContext),
       id_(std::to_string((uintptr_t)this)),
       maps_ns_(maps_ns),
       ts_(ts), btf_(nullptr) {
   ifindex_ = dev_name ? if_nametoindex(dev_name) : 0;
-  initialize_rw_engine();
-  LLVMInitializeBPFTarget();
-  LLVMInitializeBPFTargetMC();
-  LLVMInitializeBPFTargetInfo();
-  LLVMInitializeBPFAsmPrinter();
+  // Target registration is not safe to race with modules being constructed
+  // on other threads, so it is done once for the process.
+  static std::once_flag llvm_init;
+  std::call_once(llvm_init, [this]() {
+    initialize_rw_engine();
+    LLVMInitializeBPFTarget();
+    LLVMInitializeBPFTargetMC();
+    LLVMInitializeBPFTargetInfo();
+    LLVMInitializeBPFAsmPrinter();
 #if LLVM_MAJOR_VERSION >= 6
-  LLVMInitializeBPFAsmParser();
-  if (flags & DEBUG_SOURCE)
+    LLVMInitializeBPFAsmParser();
     LLVMInitializeBPFDisassembler();
 #endif
+  });
   LLVMLinkInMCJIT(); /* call empty function to force linking of MCJIT */
   if (!ts_) {
     local_ts_ = createSharedTableStorage();
@@ -139,7 +146,7 @@ BPFModule::~BPFModule() {
     v->leaf_snprintf = unimplemented_snprintf;
   }
 
-  if (!rw_engine_enabled_) {
+  if (!rw_engine_enabled_ || from_object_) {
     for (auto section : sections_)
       delete[] get<0>(section.second);
   }
@@ -161,7 +168,7 @@ int BPFModule::free_bcc_memory() {
 
 // load an entire c file as a module
 int BPFModule::load_cfile(const string &file, bool in_memory, const char *cflags[], int ncflags) {
-  ClangLoader clang_loader(&*ctx_, flags_);
+  ClangLoader clang_loader(&*ctx_, flags_, profile());
   if (clang_loader.parse(&mod_, *ts_, file, in_memory, cflags, ncflags, id_,
                          *func_src_, mod_src_, maps_ns_, fake_fd_map_, perf_events_))
     return -1;
@@ -188,6 +195,7 @@ void BPFModule::annotate_light() {
 
   size_t id = 0;
   Path path({id_});
+  auto guard = ts_->lock();
   for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up; ++it) {
     TableDesc &table = it->second;
     tables_.push_back(&it->second);
@@ -210,8 +218,21 @@ int BPFModule::run_pass_manager(Module &mod) {
 
   legacy::PassManager PM;
   PassManagerBuilder PMB;
-  PMB.OptLevel = 3;
-  PM.add(createFunctionInliningPass());
+  if (flags_ & OPT_BPF_PIPELINE) {
+    // Every function not marked noinline is already always_inline (see
+    // annotate()), so the cost model inliner only needs to look at what is
+    // left, with the -Os threshold. BPF has no vector registers, and the
+    // verifier rather than the CPU decides what code is too slow, so -O3,
+    // the vectorizers and GVN load PRE cost compile time for little gain.
+    PMB.OptLevel = 2;
+    PMB.LoopVectorize = false;
+    PMB.SLPVectorize = false;
+    PMB.DisableGVNLoadPRE = true;
+    PM.add(createFunctionInliningPass(75));
+  } else {
+    PMB.OptLevel = 3;
+    PM.add(createFunctionInliningPass());
+  }
   /*
    * llvm < 4.0 needs
    * PM.add(createAlwaysInlinerPass());
@@ -317,8 +338,13 @@ int BPFModule::create_maps(std::map<std::string, std::pair<int, int>> &map_tids,
         inner_map_fd = inner_map_fds[inner_map_name];
     }
 
+    bool pin = !for_inner_map && !pin_dir_.empty();
     if (pinned_id) {
         fd = bpf_map_get_fd_by_id(pinned_id);
+    } else if (pin && (fd = open_pinned_map(map_name, map_type, key_size,
+                                            value_size, max_entries)) != -1) {
+        if (fd < 0)
+          return -1;
     } else {
         struct bpf_create_map_attr attr = {};
         attr.map_type = (enum bpf_map_type)map_type;
@@ -337,6 +363,15 @@ int BPFModule::create_maps(std::map<std::string, std::pair<int, int>> &map_tids,
         }
 
         fd = bcc_create_map_xattr(&attr, allow_rlimit_);
+        if (fd >= 0 && pin) {
+          std::string path = pin_dir_ + "/maps/" + map_name;
+          if (bpf_obj_pin(fd, path.c_str())) {
+            fprintf(stderr, "could not pin bpf map %s as %s: %s\n", map_name,
+                    path.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+          }
+        }
     }
 
     if (fd < 0) {
@@ -354,6 +389,30 @@ int BPFModule::create_maps(std::map<std::string, std::pair<int, int>> &map_tids,
   return 0;
 }
 
+// Opens the map pinned as name under pin_dir_/maps. Returns -1 if there is
+// none, and -2 if it does not have the layout this program declares, which
+// means the pins are left over from another program.
+int BPFModule::open_pinned_map(const char *name, int type, int key_size,
+                               int value_size, int max_entries) {
+  std::string path = pin_dir_ + "/maps/" + name;
+  int fd = bpf_obj_get(path.c_str());
+  if (fd < 0)
+    return -1;
+
+  struct bpf_map_info info = {};
+  uint32_t info_len = sizeof(info);
+  if (bpf_obj_get_info(fd, &info, &info_len) == 0 &&
+      (int)info.type == type && (int)info.key_size == key_size &&
+      (int)info.value_size == value_size &&
+      (int)info.max_entries == max_entries)
+    return fd;
+
+  fprintf(stderr, "pinned bpf map %s does not match map %s, remove it\n",
+          path.c_str(), name);
+  close(fd);
+  return -2;
+}
+
 int BPFModule::load_maps(sec_map_def &sections) {
   // find .maps.<table_name> sections and retrieve all map key/value type id's
   std::map<std::string, std::pair<int, int>> map_tids;
@@ -407,6 +466,7 @@ int BPFModule::load_maps(sec_map_def &sections) {
     return -1;
 
   // update map table fd's
+  auto guard = ts_->lock();
   for (auto it = ts_->begin(), up = ts_->end(); it != up; ++it) {
     TableDesc &table = it->second;
     if (map_fds.find(table.fake_fd) != map_fds.end()) {
@@ -480,10 +540,24 @@ int BPFModule::finalize() {
     engine_->setProcessAllSections(true);
 #endif
 
-  if (int rc = run_pass_manager(*mod))
-    return rc;
+  {
+    ScopedPhase phase(profile(), "run_pass_manager");
+    if (int rc = run_pass_manager(*mod))
+      return rc;
+  }
+
+  {
+    ScopedPhase phase(profile(), "finalize");
+    engine_->finalizeObject();
+  }
 
-  engine_->finalizeObject();
+  add_param_defaults(*sections_p);
+
+  // Save the sections before BTF and map fds are fixed up in place below.
+  if (!prog_cache_path_.empty())
+    save_object(*sections_p, prog_cache_path_);
+  if (!object_path_.empty())
+    return save_object(*sections_p, object_path_) ? 0 : -1;
 
   if (flags_ & DEBUG_SOURCE) {
     SourceDebugger src_debugger(mod, *sections_p, FN_PREFIX, mod_src_,
@@ -492,8 +566,13 @@ int BPFModule::finalize() {
   }
 
   load_btf(*sections_p);
-  if (load_maps(*sections_p))
-    return -1;
+  {
+    ScopedPhase phase(profile(), "create maps");
+    if (load_maps(*sections_p))
+      return -1;
+    if (load_values())
+      return -1;
+  }
 
   if (!rw_engine_enabled_) {
     // Setup sections_ correctly and then free llvm internal memory
@@ -848,6 +927,7 @@ int BPFModule::load_b(const string &filename, const string &proto_filename) {
                               maps_ns_))
     return rc;
   if (rw_engine_enabled_) {
+    ScopedPhase phase(profile(), "annotate");
     if (int rc = annotate())
       return rc;
   } else {
@@ -871,6 +951,7 @@ int BPFModule::load_c(const string &filename, const char *cflags[], int ncflags)
   if (int rc = load_cfile(filename, false, cflags, ncflags))
     return rc;
   if (rw_engine_enabled_) {
+    ScopedPhase phase(profile(), "annotate");
     if (int rc = annotate())
       return rc;
   } else {
@@ -887,9 +968,29 @@ int BPFModule::load_string(const string &text, const char *cflags[], int ncflags
     fprintf(stderr, "Program already initialized\n");
     return -1;
   }
+  string cache_path = prog_cache_path(text, cflags, ncflags);
+  if (!cache_path.empty()) {
+    BccObject obj;
+    bool cached;
+    {
+      ScopedPhase phase(profile(), "read object");
+      cached = obj.load(cache_path);
+    }
+    if (cached) {
+      from_object(obj);
+      if (rw_engine_enabled_ && !obj.rw_types.empty() &&
+          annotate_object(obj.rw_types))
+        return -1;
+      return finalize_object();
+    }
+  }
+
   if (int rc = load_cfile(text, true, cflags, ncflags))
     return rc;
+  if (!cache_path.empty() && prog_cacheable())
+    prog_cache_path_ = cache_path;
   if (rw_engine_enabled_) {
+    ScopedPhase phase(profile(), "annotate");
     if (int rc = annotate())
       return rc;
   } else {
@@ -905,7 +1006,8 @@ int BPFModule::bcc_func_load(int prog_type, const char *name,
                 const struct bpf_insn *insns, int prog_len,
                 const char *license, unsigned kern_version,
                 int log_level, char *log_buf, unsigned log_buf_size,
-                const char *dev_name) {
+                const char *dev_name, const char *attach_func,
+                int attach_type) {
   struct bpf_load_program_attr attr = {};
   unsigned func_info_cnt, line_info_cnt, finfo_rec_size, linfo_rec_size;
   void *func_info = NULL, *line_info = NULL;
@@ -922,6 +1024,18 @@ int BPFModule::bcc_func_load(int prog_type, const char *name,
   attr.log_level = log_level;
   if (dev_name)
     attr.prog_ifindex = if_nametoindex(dev_name);
+  // A tracing program attached to a kernel function other than the one its
+  // name refers to, e.g. the fentry variant of a KPROBE_FENTRY probe
+  if (attach_func) {
+    int btf_id = libbpf_find_vmlinux_btf_id(
+        attach_func, (enum bpf_attach_type)attach_type);
+    if (btf_id <= 0) {
+      errno = btf_id < 0 ? -btf_id : ENOENT;
+      return -1;
+    }
+    attr.attach_btf_id = btf_id;
+    attr.expected_attach_type = (enum bpf_attach_type)attach_type;
+  }
 
   if (btf_) {
     int btf_fd = btf_->get_fd();
@@ -942,7 +1056,11 @@ int BPFModule::bcc_func_load(int prog_type, const char *name,
     }
   }
 
-  ret = bcc_prog_load_xattr(&attr, prog_len, log_buf, log_buf_size, allow_rlimit_);
+  {
+    ScopedPhase phase(profile(), string("bcc_prog_load ") + name);
+    ret = bcc_prog_load_xattr(&attr, prog_len, log_buf, log_buf_size,
+                              allow_rlimit_);
+  }
   if (btf_) {
     free(func_info);
     free(line_info);
@@ -19,10 +19,13 @@
 #include <stdint.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "bcc_exception.h"
+#include "bcc_object.h"
+#include "bcc_profile.h"
 #include "table_storage.h"
 
 namespace llvm {
@@ -53,6 +56,16 @@ enum {
   DEBUG_BPF_REGISTER_STATE = 0x10,
   // Debug BTF.
   DEBUG_BTF = 0x20,
+  // Record the time and memory taken by each phase of compiling and loading
+  // the program, see BPFModule::profile().
+  DEBUG_PROFILE = 0x40,
+};
+
+// Options changing how the program is compiled, passed in the same flags.
+enum {
+  // Optimize with a pipeline tuned for BPF instead of the generic -O3 one,
+  // see BPFModule::run_pass_manager().
+  OPT_BPF_PIPELINE = 0x1000,
 };
 
 class TableDesc;
@@ -73,6 +86,8 @@ class BPFModule {
   int parse(llvm::Module *mod);
   int finalize();
   int annotate();
+  int annotate_object(const std::string &rw_types);
+  void annotate_table(TableDesc &table, llvm::Type *type);
   void annotate_light();
   std::unique_ptr<llvm::ExecutionEngine> finalize_rw(std::unique_ptr<llvm::Module> mod);
   std::string make_reader(llvm::Module *mod, llvm::Type *type);
@@ -82,9 +97,19 @@ class BPFModule {
   int load_includes(const std::string &text);
   int load_cfile(const std::string &file, bool in_memory, const char *cflags[], int ncflags);
   int kbuild_flags(const char *uname_release, std::vector<std::string> *cflags);
+  std::string prog_cache_path(const std::string &text, const char *cflags[],
+                              int ncflags) const;
+  bool prog_cacheable();
+  void to_object(const sec_map_def &sections, BccObject &obj);
+  bool save_object(const sec_map_def &sections, const std::string &path);
+  void from_object(BccObject &obj);
+  int finalize_object();
+  void add_param_defaults(const sec_map_def &sections);
+  int load_values();
   int run_pass_manager(llvm::Module &mod);
-  StatusTuple sscanf(std::string fn_name, const char *str, void *val);
-  StatusTuple snprintf(std::string fn_name, char *str, size_t sz,
+  uint64_t rw_engine_function(llvm::Type *type, bool is_writer);
+  StatusTuple sscanf(llvm::Type *type, const char *str, void *val);
+  StatusTuple snprintf(llvm::Type *type, char *str, size_t sz,
                        const void *val);
   void load_btf(sec_map_def &sections);
   int load_maps(sec_map_def &sections);
@@ -92,6 +117,8 @@ class BPFModule {
                   std::map<int, int> &map_fds,
                   std::map<std::string, int> &inner_map_fds,
                   bool for_inner_map);
+  int open_pinned_map(const char *name, int type, int key_size,
+                      int value_size, int max_entries);
 
  public:
   BPFModule(unsigned flags, TableStorage *ts = nullptr, bool rw_engine_enabled = true,
@@ -102,6 +129,18 @@ class BPFModule {
   int load_b(const std::string &filename, const std::string &proto_filename);
   int load_c(const std::string &filename, const char *cflags[], int ncflags);
   int load_string(const std::string &text, const char *cflags[], int ncflags);
+  // Loads a program written by compile_object() or cached by load_string().
+  int load_object(const std::string &path);
+  // Compiles the program and writes it to path, without creating any maps.
+  // The module can not be used to load the program afterwards.
+  int compile_object(const std::string &text, const char *cflags[],
+                     int ncflags, const std::string &path);
+  // Sets a parameter declared with BPF_PARAM. Before the program is loaded
+  // this replaces the default, afterwards it updates the running program.
+  int set_param(const std::string &name, const void *value, size_t size);
+  // Pins the maps as dir/maps/<name> when the program is loaded, reusing the
+  // ones already pinned there, e.g. by the previous run of the same tool.
+  void set_pin_dir(const std::string &dir) { pin_dir_ = dir; }
   std::string id() const { return id_; }
   std::string maps_ns() const { return maps_ns_; }
   size_t num_functions() const;
@@ -144,18 +183,27 @@ class BPFModule {
                     const struct bpf_insn *insns, int prog_len,
                     const char *license, unsigned kern_version,
                     int log_level, char *log_buf, unsigned log_buf_size,
-                    const char *dev_name = nullptr);
+                    const char *dev_name = nullptr,
+                    const char *attach_func = nullptr,
+                    int attach_type = 0);
   int bcc_func_attach(int prog_fd, int attachable_fd,
                       int attach_type, unsigned int flags);
   int bcc_func_detach(int prog_fd, int attachable_fd, int attach_type);
   size_t perf_event_fields(const char *) const;
   const char * perf_event_field(const char *, size_t i) const;
+  // Null unless the module was created with DEBUG_PROFILE.
+  CompileProfile *profile() {
+    return (flags_ & DEBUG_PROFILE) ? &profile_ : nullptr;
+  }
 
  private:
   unsigned flags_;  // 0x1 for printing
   bool rw_engine_enabled_;
   bool used_b_loader_;
   bool allow_rlimit_;
+  bool from_object_;
+  std::string prog_cache_path_;
+  std::string object_path_;
   std::string filename_;
   std::string proto_filename_;
   std::unique_ptr<llvm::LLVMContext> ctx_;
@@ -167,16 +215,24 @@ class BPFModule {
   std::vector<TableDesc *> tables_;
   std::map<std::string, size_t> table_names_;
   std::vector<std::string> function_names_;
+  // Guards rw_engine_, readers_ and writers_, which are filled on the first
+  // use of each reader or writer, possibly from several threads
+  std::mutex rw_engine_mutex_;
   std::map<llvm::Type *, std::string> readers_;
   std::map<llvm::Type *, std::string> writers_;
+  std::string rw_types_;
   std::string id_;
   std::string maps_ns_;
+  std::string pin_dir_;
   std::string mod_src_;
   std::map<std::string, std::string> src_dbg_fmap_;
   TableStorage *ts_;
   std::unique_ptr<TableStorage> local_ts_;
   BTF *btf_;
   fake_fd_map_def fake_fd_map_;
+  std::vector<BccObject::Value> values_;
+  std::map<std::string, std::string> params_;
+  CompileProfile profile_;
   unsigned int ifindex_;
 
   // map of events -- key: event name, value: event fields
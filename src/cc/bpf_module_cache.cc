@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <linux/bpf.h>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
+
+#include "bcc_object.h"
+#include "bcc_version.h"
+#include "bpf_module.h"
+#include "common.h"
+#include "frontends/clang/b_frontend_action.h"
+#include "frontends/clang/loader.h"
+#include "libbpf.h"
+#include "table_storage.h"
+
+namespace ebpf {
+
+using std::get;
+using std::make_tuple;
+using std::string;
+
+namespace {
+
+// Map sections only back the JIT's view of the table structs, their content
+// is never used once the program is compiled.
+bool is_map_section(const string &name) {
+  return !strncmp("maps/", name.c_str(), 5);
+}
+
+StatusTuple object_sscanf(const char *, void *) {
+  return StatusTuple(-1, "sscanf not available for precompiled program");
+}
+
+StatusTuple object_snprintf(char *, size_t, const void *) {
+  return StatusTuple(-1, "snprintf not available for precompiled program");
+}
+
+}  // namespace
+
+// The cache is keyed by everything that feeds into the compilation: the
+// source and cflags, the running kernel (which selects the headers and the
+// tracepoint formats) and the bcc and llvm versions. The rewritten source is
+// a function of those, so it is not needed in the key.
+string BPFModule::prog_cache_path(const string &text, const char *cflags[],
+                                  int ncflags) const {
+  const char *cache_dir = getenv("BCC_PROG_CACHE_DIR");
+  if (!cache_dir || !*cache_dir)
+    return string();
+  // Debug output is produced while compiling, don't skip it.
+  if (flags_ & (DEBUG_LLVM_IR | DEBUG_PREPROCESSOR | DEBUG_SOURCE))
+    return string();
+  if (!make_private_dir(cache_dir))
+    return string();
+  // The key does not cover the contents of headers outside of the kernel and
+  // bcc ones, a cached program would not see them change.
+  char cwd[256];
+  if (!getcwd(cwd, sizeof(cwd)) ||
+      uses_local_headers(text, cflags, ncflags, cwd))
+    return string();
+
+  struct utsname un;
+  if (uname(&un))
+    return string();
+
+  llvm::SHA1 hash;
+  auto add = [&hash](const char *s) {
+    hash.update(llvm::StringRef(s ? s : ""));
+    hash.update(llvm::StringRef("", 1));
+  };
+  add(LIBBCC_VERSION);
+  add(std::to_string(LLVM_MAJOR_VERSION).c_str());
+  add(un.release);
+  add(un.version);
+  add(un.machine);
+  add(getenv("BCC_KERNEL_SOURCE"));
+  add(getenv("BCC_KERNEL_MODULES_SUFFIX"));
+  add(getenv("BCC_LINUX_VERSION_CODE"));
+  add((flags_ & OPT_BPF_PIPELINE) ? "bpf" : "");
+  add(std::to_string(ncflags).c_str());
+  for (int i = 0; i < ncflags; ++i)
+    add(cflags[i]);
+  hash.update(text);
+
+  return string(cache_dir) + "/" + llvm::toHex(hash.final(), true) + ".bpfc";
+}
+
+// Programs that reference tables outside of this module bake the state of
+// those tables into the compiled code, or leave entries behind in the table
+// storage that a cache hit would not recreate. Fake fds are unique within the
+// process, so an exported copy of one of our tables is found by its fake fd
+// even while other modules are adding and removing their own tables.
+bool BPFModule::prog_cacheable() {
+  auto guard = ts_->lock();
+  std::set<int> local_fds;
+  Path path({id_});
+  for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up;
+       ++it) {
+    if (it->second.is_extern || it->second.is_shared)
+      return false;
+    local_fds.insert(it->second.fake_fd);
+  }
+
+  for (auto it = ts_->begin(), up = ts_->lower_bound(path); it != up; ++it) {
+    if (local_fds.count(it->second.fake_fd))
+      return false;
+  }
+  for (auto it = ts_->upper_bound(path), up = ts_->end(); it != up; ++it) {
+    if (local_fds.count(it->second.fake_fd))
+      return false;
+  }
+
+  for (auto &map : fake_fd_map_) {
+    if (get<6>(map.second))
+      return false;
+  }
+  return true;
+}
+
+void BPFModule::to_object(const sec_map_def &sections, BccObject &obj) {
+  for (auto &section : sections) {
+    BccObject::Section sec;
+    sec.name = section.first;
+    sec.size = get<1>(section.second);
+    sec.id = get<2>(section.second);
+    if (!is_map_section(section.first) && get<0>(section.second))
+      sec.data.assign((const char *)get<0>(section.second), sec.size);
+    obj.sections.push_back(std::move(sec));
+  }
+
+  auto guard = ts_->lock();
+  Path path({id_});
+  for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up;
+       ++it) {
+    const TableDesc &desc = it->second;
+    BccObject::Table table;
+    table.name = desc.name;
+    table.fake_fd = desc.fake_fd;
+    table.type = desc.type;
+    table.key_size = desc.key_size;
+    table.leaf_size = desc.leaf_size;
+    table.max_entries = desc.max_entries;
+    table.flags = desc.flags;
+    table.key_desc = desc.key_desc;
+    table.leaf_desc = desc.leaf_desc;
+    obj.tables.push_back(std::move(table));
+  }
+
+  for (auto &fake_fd_map : fake_fd_map_) {
+    BccObject::Map map;
+    map.fake_fd = fake_fd_map.first;
+    map.type = get<0>(fake_fd_map.second);
+    map.name = get<1>(fake_fd_map.second);
+    map.key_size = get<2>(fake_fd_map.second);
+    map.value_size = get<3>(fake_fd_map.second);
+    map.max_entries = get<4>(fake_fd_map.second);
+    map.flags = get<5>(fake_fd_map.second);
+    map.inner_map_name = get<7>(fake_fd_map.second);
+    obj.maps.push_back(std::move(map));
+  }
+
+  obj.perf_events = perf_events_;
+  func_src_->for_each(
+      [&obj](const string &name, const string &src, const string &rewritten) {
+        obj.functions.push_back({name, src, rewritten});
+      });
+  obj.mod_src = mod_src_;
+  obj.values = values_;
+  obj.rw_types = rw_types_;
+}
+
+bool BPFModule::save_object(const sec_map_def &sections, const string &path) {
+  BccObject obj;
+  to_object(sections, obj);
+  return obj.save(path);
+}
+
+void BPFModule::from_object(BccObject &obj) {
+  // The fake fds in the object may be in use by other modules in this
+  // process, so every reference to them is moved to freshly allocated ones.
+  std::map<int, int> fd_remap;
+  for (auto &map : obj.maps) {
+    int fake_fd = BFrontendAction::get_next_fake_fd();
+    fd_remap[map.fake_fd] = fake_fd;
+    fake_fd_map_[fake_fd] = make_tuple(map.type, map.name, map.key_size,
+                                       map.value_size, map.max_entries,
+                                       map.flags, 0u, map.inner_map_name);
+  }
+
+  for (auto &sec : obj.sections) {
+    uint8_t *p = nullptr;
+    if (!sec.data.empty()) {
+      p = new uint8_t[sec.data.size()];
+      memcpy(p, sec.data.data(), sec.data.size());
+    }
+    sections_[sec.name] = make_tuple(p, sec.size, sec.id);
+    if (!p || sec.name.compare(0, FN_PREFIX.size(), FN_PREFIX))
+      continue;
+    struct bpf_insn *insns = (struct bpf_insn *)p;
+    size_t num_insns = sec.size / sizeof(*insns);
+    for (size_t i = 0; i < num_insns; i++) {
+      if (insns[i].code != (BPF_LD | BPF_DW | BPF_IMM))
+        continue;
+      if (insns[i].src_reg == BPF_PSEUDO_MAP_FD) {
+        auto it = fd_remap.find(insns[i].imm);
+        if (it != fd_remap.end())
+          insns[i].imm = it->second;
+      }
+      i++;
+    }
+  }
+  from_object_ = true;
+
+  for (auto &table : obj.tables) {
+    TableDesc desc;
+    desc.name = table.name;
+    auto it = fd_remap.find(table.fake_fd);
+    desc.fake_fd = it != fd_remap.end() ? it->second : table.fake_fd;
+    desc.type = table.type;
+    desc.key_size = table.key_size;
+    desc.leaf_size = table.leaf_size;
+    desc.max_entries = table.max_entries;
+    desc.flags = table.flags;
+    desc.key_desc = table.key_desc;
+    desc.leaf_desc = table.leaf_desc;
+    desc.key_sscanf = object_sscanf;
+    desc.leaf_sscanf = object_sscanf;
+    desc.key_snprintf = object_snprintf;
+    desc.leaf_snprintf = object_snprintf;
+    ts_->Insert(Path({id_, table.name}), std::move(desc));
+  }
+
+  perf_events_ = std::move(obj.perf_events);
+  for (auto &func : obj.functions) {
+    func_src_->set_src(func.name, func.src);
+    func_src_->set_src_rewritten(func.name, func.src_rewritten);
+  }
+  mod_src_ = std::move(obj.mod_src);
+  values_ = std::move(obj.values);
+}
+
+int BPFModule::finalize_object() {
+  size_t id = 0;
+  Path path({id_});
+  auto guard = ts_->lock();
+  for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up; ++it) {
+    TableDesc &table = it->second;
+    tables_.push_back(&it->second);
+    table_names_[table.name] = id++;
+  }
+
+  load_btf(sections_);
+  {
+    ScopedPhase phase(profile(), "create maps");
+    if (load_maps(sections_))
+      return -1;
+    if (load_values())
+      return -1;
+  }
+
+  for (auto section : sections_)
+    if (!strncmp(FN_PREFIX.c_str(), section.first.c_str(), FN_PREFIX.size()))
+      function_names_.push_back(section.first);
+
+  return 0;
+}
+
+// BPF_PARAM keeps the default of each parameter in a section of its own,
+// which becomes the initial value of the parameter's table.
+void BPFModule::add_param_defaults(const sec_map_def &sections) {
+  static const string prefix = ".bcc.param.";
+  for (auto &section : sections) {
+    if (section.first.compare(0, prefix.size(), prefix) ||
+        !get<0>(section.second))
+      continue;
+    BccObject::Value value;
+    value.table = section.first.substr(prefix.size());
+    value.key = string(sizeof(int), '\0');
+    value.leaf.assign((const char *)get<0>(section.second),
+                      get<1>(section.second));
+    values_.push_back(std::move(value));
+  }
+}
+
+// Values set with set_param() before the program was loaded are not part of
+// the object, they are applied after its initial values.
+int BPFModule::load_values() {
+  std::vector<BccObject::Value> values = values_;
+  for (auto &param : params_)
+    values.push_back({param.first, string(sizeof(int), '\0'), param.second});
+  for (auto &value : values) {
+    auto it = table_names_.find(value.table);
+    if (it == table_names_.end()) {
+      fprintf(stderr, "initial value for unknown table %s\n",
+              value.table.c_str());
+      return -1;
+    }
+    TableDesc *table = tables_[it->second];
+    if (value.key.size() != table->key_size ||
+        value.leaf.size() != table->leaf_size) {
+      fprintf(stderr, "initial value for table %s has the wrong size\n",
+              value.table.c_str());
+      return -1;
+    }
+    if (bpf_update_elem(table->fd, &value.key[0], &value.leaf[0], BPF_ANY)) {
+      fprintf(stderr, "could not set initial value in table %s: %s\n",
+              value.table.c_str(), strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int BPFModule::set_param(const string &name, const void *value, size_t size) {
+  string leaf((const char *)value, size);
+  int fd = table_fd(name);
+  if (fd < 0) {
+    params_[name] = std::move(leaf);
+    return 0;
+  }
+  if (size != table_leaf_size(name)) {
+    fprintf(stderr, "parameter %s has size %zu\n", name.c_str(),
+            table_leaf_size(name));
+    return -1;
+  }
+  int key = 0;
+  return bpf_update_elem(fd, &key, &leaf[0], BPF_ANY);
+}
+
+int BPFModule::load_object(const string &path) {
+  if (!sections_.empty()) {
+    fprintf(stderr, "Program already initialized\n");
+    return -1;
+  }
+  {
+    ScopedPhase phase(profile(), "read object");
+    BccObject obj;
+    if (!obj.load(path)) {
+      fprintf(stderr, "could not read bcc object %s\n", path.c_str());
+      return -1;
+    }
+    from_object(obj);
+  }
+  return finalize_object();
+}
+
+int BPFModule::compile_object(const string &text, const char *cflags[],
+                              int ncflags, const string &path) {
+  if (!sections_.empty()) {
+    fprintf(stderr, "Program already initialized\n");
+    return -1;
+  }
+  if (int rc = load_cfile(text, true, cflags, ncflags))
+    return rc;
+  if (!prog_cacheable()) {
+    fprintf(stderr, "programs using shared, extern or pinned tables cannot be "
+                    "compiled ahead of time\n");
+    return -1;
+  }
+  object_path_ = path;
+  annotate_light();
+  return finalize();
+}
+
+}  // namespace ebpf
@@ -14,11 +14,15 @@
  * limitations under the License.
  */
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include <llvm/ExecutionEngine/MCJIT.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/TargetSelect.h>
 
 #include "common.h"
@@ -368,50 +372,115 @@ int BPFModule::annotate() {
     if (!fn->hasFnAttribute(Attribute::NoInline))
       fn->addFnAttr(Attribute::AlwaysInline);
 
-  // separate module to hold the reader functions
-  auto m = ebpf::make_unique<Module>("sscanf", *ctx_);
+  // A cached program is loaded without its module, the table types are saved
+  // with it in a module of their own to rebuild the readers and writers from.
+  unique_ptr<Module> types;
+  if (!prog_cache_path_.empty())
+    types = ebpf::make_unique<Module>("rw_types", *ctx_);
 
   size_t id = 0;
   Path path({id_});
+  auto guard = ts_->lock();
   for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up; ++it) {
     TableDesc &table = it->second;
     tables_.push_back(&it->second);
     table_names_[table.name] = id++;
     GlobalValue *gvar = mod_->getNamedValue(table.name);
     if (!gvar) continue;
-    if (PointerType *pt = dyn_cast<PointerType>(gvar->getType())) {
-      if (StructType *st = dyn_cast<StructType>(pt->getElementType())) {
-        if (st->getNumElements() < 2) continue;
-        Type *key_type = st->elements()[0];
-        Type *leaf_type = st->elements()[1];
-
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        using std::placeholders::_3;
-        table.key_sscanf = std::bind(&BPFModule::sscanf, this,
-                                     make_reader(&*m, key_type), _1, _2);
-        table.leaf_sscanf = std::bind(&BPFModule::sscanf, this,
-                                      make_reader(&*m, leaf_type), _1, _2);
-        table.key_snprintf = std::bind(&BPFModule::snprintf, this,
-                                       make_writer(&*m, key_type), _1, _2, _3);
-        table.leaf_snprintf =
-            std::bind(&BPFModule::snprintf, this, make_writer(&*m, leaf_type),
-                      _1, _2, _3);
-      }
-    }
+    if (types)
+      new GlobalVariable(*types, gvar->getValueType(), false,
+                         GlobalValue::ExternalLinkage, nullptr, table.name);
+    annotate_table(table, gvar->getType());
   }
 
-  rw_engine_ = finalize_rw(move(m));
-  if (!rw_engine_)
+  if (types) {
+    raw_string_ostream os(rw_types_);
+    types->print(os, nullptr);
+    os.flush();
+  }
+  return 0;
+}
+
+// Gives the tables of a module read from an object their readers and
+// writers, from the types saved in it by annotate().
+int BPFModule::annotate_object(const string &rw_types) {
+  SMDiagnostic err;
+  unique_ptr<Module> types =
+      parseIR(MemoryBufferRef(rw_types, "rw_types"), err, *ctx_);
+  if (!types) {
+    fprintf(stderr, "could not read the table types: %s\n",
+            err.getMessage().str().c_str());
     return -1;
+  }
+
+  Path path({id_});
+  auto guard = ts_->lock();
+  for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up; ++it) {
+    GlobalValue *gvar = types->getNamedValue(it->second.name);
+    if (gvar)
+      annotate_table(it->second, gvar->getType());
+  }
   return 0;
 }
 
-StatusTuple BPFModule::sscanf(string fn_name, const char *str, void *val) {
+// type is the pointer type of the table's variable, a struct of the key and
+// the leaf.
+void BPFModule::annotate_table(TableDesc &table, Type *type) {
+  PointerType *pt = dyn_cast<PointerType>(type);
+  if (!pt)
+    return;
+  StructType *st = dyn_cast<StructType>(pt->getElementType());
+  if (!st || st->getNumElements() < 2)
+    return;
+  Type *key_type = st->elements()[0];
+  Type *leaf_type = st->elements()[1];
+
+  // The reader and writer functions are only generated when first
+  // called, most programs never format their table entries as text.
+  using std::placeholders::_1;
+  using std::placeholders::_2;
+  using std::placeholders::_3;
+  table.key_sscanf = std::bind(&BPFModule::sscanf, this, key_type, _1, _2);
+  table.leaf_sscanf = std::bind(&BPFModule::sscanf, this, leaf_type, _1, _2);
+  table.key_snprintf = std::bind(&BPFModule::snprintf, this, key_type,
+                                 _1, _2, _3);
+  table.leaf_snprintf = std::bind(&BPFModule::snprintf, this, leaf_type,
+                                  _1, _2, _3);
+}
+
+// Returns the address of the reader or writer function for type, compiling
+// it into the rw engine on first use. Each function gets its own module, which
+// MCJIT compiles when the function is looked up.
+uint64_t BPFModule::rw_engine_function(Type *type, bool is_writer) {
+  std::lock_guard<std::mutex> guard(rw_engine_mutex_);
+  auto &fns = is_writer ? writers_ : readers_;
+  string fn_name;
+  auto fn_it = fns.find(type);
+  if (fn_it != fns.end()) {
+    fn_name = fn_it->second;
+  } else {
+    auto m = ebpf::make_unique<Module>(is_writer ? "snprintf" : "sscanf", *ctx_);
+    fn_name = is_writer ? make_writer(&*m, type) : make_reader(&*m, type);
+    if (!rw_engine_) {
+      rw_engine_ = finalize_rw(move(m));
+      if (!rw_engine_) {
+        fns.erase(type);
+        return 0;
+      }
+    } else {
+      run_pass_manager(*m);
+      rw_engine_->addModule(move(m));
+    }
+  }
+  if (!rw_engine_)
+    return 0;
+  return rw_engine_->getFunctionAddress(fn_name);
+}
+
+StatusTuple BPFModule::sscanf(Type *type, const char *str, void *val) {
   if (!rw_engine_enabled_)
     return StatusTuple(-1, "rw_engine not enabled");
-  auto fn =
-      (int (*)(const char *, void *))rw_engine_->getFunctionAddress(fn_name);
+  auto fn = (int (*)(const char *, void *))rw_engine_function(type, false);
   if (!fn)
     return StatusTuple(-1, "sscanf not available");
   int rc = fn(str, val);
@@ -420,12 +489,12 @@ StatusTuple BPFModule::sscanf(string fn_name, const char *str, void *val) {
   return StatusTuple(rc);
 }
 
-StatusTuple BPFModule::snprintf(string fn_name, char *str, size_t sz,
+StatusTuple BPFModule::snprintf(Type *type, char *str, size_t sz,
                                 const void *val) {
   if (!rw_engine_enabled_)
     return StatusTuple(-1, "rw_engine not enabled");
   auto fn = (int (*)(char *, size_t,
-                     const void *))rw_engine_->getFunctionAddress(fn_name);
+                     const void *))rw_engine_function(type, true);
   if (!fn)
     return StatusTuple(-1, "snprintf not available");
   int rc = fn(str, sz, val);
@@ -32,4 +32,8 @@ int BPFModule::annotate() {
   return -1;
 }
 
+int BPFModule::annotate_object(const std::string &rw_types) {
+  return -1;
+}
+
 } // namespace ebpf
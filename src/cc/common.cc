@@ -13,8 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <cerrno>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "vendor/tinyformat.hpp"
@@ -198,4 +201,20 @@ std::string parse_tracepoint(std::istream &input, std::string const& category,
   tp_struct += "};\n";
   return tp_struct;
 }
+
+// Whoever can write to a cache can make the processes reading it load their
+// code, headers or symbols.
+bool make_private_dir(const std::string &dir) {
+  struct stat st;
+  if (::mkdir(dir.c_str(), 0755) && errno != EEXIST)
+    return false;
+  if (::lstat(dir.c_str(), &st) || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    fprintf(stderr, "%s: not a directory only writable by the current user\n",
+            dir.c_str());
+    return false;
+  }
+  return true;
+}
+
 } // namespace ebpf
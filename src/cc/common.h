@@ -39,6 +39,11 @@ std::vector<int> get_possible_cpus();
 
 std::string get_pid_exe(pid_t pid);
 
+// Creates dir if needed. Returns false unless it is a directory owned by the
+// effective user that nobody else can write to, the only kind the caches of
+// compiled programs, headers and symbols may be read from.
+bool make_private_dir(const std::string &dir);
+
 std::string parse_tracepoint(std::istream &input, std::string const& category,
                              std::string const& event);
 }  // namespace ebpf
@@ -247,6 +247,32 @@ struct _name##_table_t _name = { .max_entries = (_max_entries) }
 #define BPF_HASH4(_name, _key_type, _leaf_type, _size) \
   BPF_TABLE("hash", _key_type, _leaf_type, _name, _size)
 
+// A tunable parameter of the program, read with _name.get(). The value lives
+// in a single entry array table called _name, which is set to _default when
+// the program is loaded unless a value was set before. User space can update
+// it at any time, so changing a threshold does not need a new compile. The
+// default is kept in a section of its own and never read by the program.
+// Changes to the macro require changes in BFrontendAction classes
+#define BPF_F_PARAM(_type, _name, _default, _flags) \
+struct _name##_table_t { \
+  int key; \
+  _type leaf; \
+  _type (*get) (void); \
+  u32 max_entries; \
+  int flags; \
+}; \
+__attribute__((section("maps/array"))) \
+struct _name##_table_t _name = { .flags = (_flags), .max_entries = 1 }; \
+BPF_ANNOTATE_KV_PAIR(_name, int, _type); \
+_type __bcc_param_##_name BCC_SEC(".bcc.param." #_name) = (_default)
+
+// BPF_PARAM(type, name, default)
+#define BPF_PARAM(_type, _name, _default) \
+  BPF_F_PARAM(_type, _name, _default, 0)
+// As BPF_PARAM, but the program can not modify the value (kernel 5.2+)
+#define BPF_PARAM_RDONLY(_type, _name, _default) \
+  BPF_F_PARAM(_type, _name, _default, BPF_F_RDONLY_PROG)
+
 // helper for default-variable macro function
 #define BPF_HASHX(_1, _2, _3, _4, NAME, ...) NAME
 
@@ -1142,6 +1168,64 @@ static int ____##name(unsigned long long *ctx, ##args)
 #define LSM_PROBE(event, args...) \
         BPF_PROG(lsm__ ## event, args)
 
+#define ___bpf_kprobe_args0() ctx
+#define ___bpf_kprobe_args1(x) ___bpf_kprobe_args0(), (void *)PT_REGS_PARM1(ctx)
+#define ___bpf_kprobe_args2(x, args...) ___bpf_kprobe_args1(args), (void *)PT_REGS_PARM2(ctx)
+#define ___bpf_kprobe_args3(x, args...) ___bpf_kprobe_args2(args), (void *)PT_REGS_PARM3(ctx)
+#define ___bpf_kprobe_args4(x, args...) ___bpf_kprobe_args3(args), (void *)PT_REGS_PARM4(ctx)
+#define ___bpf_kprobe_args5(x, args...) ___bpf_kprobe_args4(args), (void *)PT_REGS_PARM5(ctx)
+#define ___bpf_kprobe_args(args...) \
+        ___bpf_apply(___bpf_kprobe_args, ___bpf_narg(args))(args)
+
+/* KPROBE_FENTRY defines a probe on the entry of kernel functions twice, as
+ * the kprobe program name and as the fentry program name__fentry, sharing
+ * the body. attach_kprobe(event, name) attaches the fentry program when the
+ * kernel supports BPF trampolines, the kprobe one otherwise. args are the
+ * first (up to 5) arguments of the function, ctx is a void pointer. Kernel
+ * memory must be read with bpf_probe_read_kernel(), as in either program.
+ *
+ * KRETPROBE_FEXIT is the same for attach_kretprobe(), the body gets the
+ * return value as ret. nargs is the number of arguments of the traced
+ * function, which fexit passes before the return value.
+ */
+#define ___bpf_kprobe_fentry(name, tramp, kargs, targs, args...) \
+int name(struct pt_regs *ctx);                                  \
+int name##__##tramp(unsigned long long *ctx);                   \
+__attribute__((always_inline))                                  \
+static int ____##name(void *ctx, ##args);                       \
+int name(struct pt_regs *ctx)                                   \
+{                                                               \
+        int __ret;                                              \
+                                                                \
+        _Pragma("GCC diagnostic push")                          \
+        _Pragma("GCC diagnostic ignored \"-Wint-conversion\"")  \
+        __ret = ____##name kargs;                               \
+        _Pragma("GCC diagnostic pop")                           \
+        return __ret;                                           \
+}                                                               \
+int name##__##tramp(unsigned long long *ctx)                    \
+{                                                               \
+        int __ret;                                              \
+                                                                \
+        _Pragma("GCC diagnostic push")                          \
+        _Pragma("GCC diagnostic ignored \"-Wint-conversion\"")  \
+        __ret = ____##name targs;                               \
+        _Pragma("GCC diagnostic pop")                           \
+        return __ret;                                           \
+}                                                               \
+static int ____##name(void *ctx, ##args)
+
+#define KPROBE_FENTRY(name, args...)                            \
+        ___bpf_kprobe_fentry(name, fentry,                      \
+                             (___bpf_kprobe_args(args)),        \
+                             (___bpf_ctx_cast(args)), ##args)
+
+#define KRETPROBE_FEXIT(name, nargs)                            \
+        ___bpf_kprobe_fentry(name, fexit,                       \
+                             (ctx, PT_REGS_RC(ctx)),            \
+                             (ctx, ctx[nargs]),                 \
+                             unsigned long long ret)
+
 #define TP_DATA_LOC_READ_CONST(dst, field, length)                        \
         do {                                                              \
             unsigned short __offset = args->data_loc_##field & 0xFFFF;    \
@@ -18,6 +18,7 @@
 #include <sys/utsname.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <mutex>
 
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/ASTContext.h>
@@ -83,20 +84,21 @@ const char **get_call_conv(void) {
   return ret;
 }
 
-/* Use resolver only once per translation */
+/* Use resolver only once per translation. Programs may be compiled from
+ * several threads at once, and the resolver loads its symbols lazily, so
+ * lookups are serialized. */
 static void *kresolver = NULL;
-static void *get_symbol_resolver(void) {
+static std::mutex kresolver_mutex;
+static bool kernel_symbol_exists(const char *name) {
+  std::lock_guard<std::mutex> guard(kresolver_mutex);
   if (!kresolver)
     kresolver = bcc_symcache_new(-1, nullptr);
-  return kresolver;
+  uint64_t addr = 0;
+  return bcc_symcache_resolve_name(kresolver, nullptr, name, &addr) >= 0;
 }
 
 static std::string check_bpf_probe_read_kernel(void) {
-  bool is_probe_read_kernel;
-  void *resolver = get_symbol_resolver();
-  uint64_t addr = 0;
-  is_probe_read_kernel = bcc_symcache_resolve_name(resolver, nullptr,
-                          "bpf_probe_read_kernel", &addr) >= 0 ? true: false;
+  bool is_probe_read_kernel = kernel_symbol_exists("bpf_probe_read_kernel");
 
   /* If bpf_probe_read is not found (ARCH_HAS_NON_OVERLAPPING_ADDRESS_SPACE) is
    * not set in newer kernel, then bcc would anyway fail */
@@ -111,10 +113,7 @@ static std::string check_bpf_probe_read_user(llvm::StringRef probe,
   if (probe.str() == "bpf_probe_read_user" ||
       probe.str() == "bpf_probe_read_user_str") {
     // Check for probe_user symbols in backported kernel before fallback
-    void *resolver = get_symbol_resolver();
-    uint64_t addr = 0;
-    bool found = bcc_symcache_resolve_name(resolver, nullptr,
-                  "bpf_probe_read_user", &addr) >= 0 ? true: false;
+    bool found = kernel_symbol_exists("bpf_probe_read_user");
     if (found)
       return probe.str();
 
@@ -833,8 +832,10 @@ bool BTypeVisitor::VisitCallExpr(CallExpr *Call) {
         if (!A->getName().startswith("maps"))
           return true;
 
-        string args = rewriter_.getRewrittenText(expansionRange(SourceRange(GET_BEGINLOC(Call->getArg(0)),
-                                                   GET_ENDLOC(Call->getArg(Call->getNumArgs() - 1)))));
+        string args;
+        if (Call->getNumArgs())
+          args = rewriter_.getRewrittenText(expansionRange(SourceRange(GET_BEGINLOC(Call->getArg(0)),
+                                              GET_ENDLOC(Call->getArg(Call->getNumArgs() - 1)))));
 
         // find the table fd, which was opened at declaration time
         TableStorage::iterator desc;
@@ -888,6 +889,14 @@ bool BTypeVisitor::VisitCallExpr(CallExpr *Call) {
             txt += update + ", &_key, &_zleaf, BPF_NOEXIST); } ";
           }
           txt += "})";
+        } else if (memb_name == "get") {
+          // BPF_PARAM: the value is the single entry of the table
+          string name = string(Ref->getDecl()->getName());
+          string lookup = "bpf_map_lookup_elem_(bpf_pseudo_fd(1, " + fd + ")";
+          txt  = "({ int _key = 0; ";
+          txt += "typeof(" + name + ".leaf) *_leaf = " + lookup + ", &_key); ";
+          txt += "typeof(" + name + ".leaf) _val; __builtin_memset(&_val, 0, sizeof(_val)); ";
+          txt += "if (_leaf) _val = *_leaf; _val; })";
         } else if (memb_name == "perf_submit") {
           string name = string(Ref->getDecl()->getName());
           string arg0 = rewriter_.getRewrittenText(expansionRange(Call->getArg(0)->getSourceRange()));
@@ -1613,6 +1622,8 @@ void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
 
 }
 
+std::atomic<int> BFrontendAction::next_fake_fd_(-1);
+
 BFrontendAction::BFrontendAction(llvm::raw_ostream &os, unsigned flags,
                                  TableStorage &ts, const std::string &id,
                                  const std::string &main_path,
@@ -1629,7 +1640,6 @@ BFrontendAction::BFrontendAction(llvm::raw_ostream &os, unsigned flags,
       main_path_(main_path),
       func_src_(func_src),
       mod_src_(mod_src),
-      next_fake_fd_(-1),
       fake_fd_map_(fake_fd_map),
       perf_events_(perf_events) {}
 
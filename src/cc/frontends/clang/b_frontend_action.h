@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <set>
@@ -173,7 +174,9 @@ class BFrontendAction : public clang::ASTFrontendAction {
   bool is_rewritable_ext_func(clang::FunctionDecl *D);
   void DoMiscWorkAround();
   // negative fake_fd to be different from real fd in bpf_pseudo_fd.
-  int get_next_fake_fd() { return next_fake_fd_--; }
+  // Fake fds identify maps in the table storage shared by every module in
+  // the process, so they are handed out from one process-wide counter.
+  static int get_next_fake_fd() { return next_fake_fd_--; }
   void add_map_def(int fd,
     std::tuple<int, std::string, int, int, int, int, unsigned int, std::string> map_def) {
     fake_fd_map_[fd] = move(map_def);
@@ -192,7 +195,7 @@ class BFrontendAction : public clang::ASTFrontendAction {
   FuncSource &func_src_;
   std::string &mod_src_;
   std::set<clang::Decl *> m_;
-  int next_fake_fd_;
+  static std::atomic<int> next_fake_fd_;
   fake_fd_map_def &fake_fd_map_;
   std::map<std::string, std::vector<std::string>> &perf_events_;
 };
@@ -18,10 +18,17 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
+
+#include "common.h"
 #include "kbuild_helper.h"
 
 namespace ebpf {
@@ -125,10 +132,94 @@ static inline int proc_kheaders_exists(void)
   return file_exists(PROC_KHEADERS_PATH);
 }
 
-static inline int extract_kheaders(const std::string &dirpath,
-                                   const struct utsname &uname_data)
+namespace {
+
+// Entries of the kheaders cache not used for this long are removed.
+const time_t kheaders_max_age = 30 * 24 * 60 * 60;
+
+int ftw_phys_cb(const char *path, const struct stat *, int, struct FTW *) {
+  return ::remove(path);
+}
+
+void remove_tree(const string &path) {
+  ::nftw(path.c_str(), ftw_phys_cb, 20, FTW_DEPTH | FTW_PHYS);
+}
+
+string kheaders_cache_dir() {
+  const char *dir = ::getenv("BCC_KHEADERS_DIR");
+  return (dir && *dir) ? string(dir) : string(KHEADERS_CACHE_DIR);
+}
+
+string hex_sha1(llvm::SHA1 &hash) {
+  return llvm::toHex(hash.final(), true);
+}
+
+// Names the running kernel build, which may have its headers cached under
+// the hash of an archive that is not loaded right now.
+string kernel_link_name(const struct utsname &uname_data) {
+  llvm::SHA1 hash;
+  hash.update(llvm::StringRef(uname_data.release));
+  hash.update(llvm::StringRef("", 1));
+  hash.update(llvm::StringRef(uname_data.version));
+  hash.update(llvm::StringRef("", 1));
+  hash.update(llvm::StringRef(uname_data.machine));
+  return "kernel-" + hex_sha1(hash);
+}
+
+int hash_file(const char *path, string &digest) {
+  FILEPtr f(fopen(path, "re"));
+  if (!f)
+    return -1;
+  llvm::SHA1 hash;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), &*f)) > 0)
+    hash.update(llvm::ArrayRef<uint8_t>(buf, n));
+  if (ferror(&*f))
+    return -1;
+  digest = hex_sha1(hash);
+  return 0;
+}
+
+// Marks an entry as used, so that collect_kheaders() keeps it.
+void touch(const string &path) {
+  ::utimensat(AT_FDCWD, path.c_str(), nullptr, AT_SYMLINK_NOFOLLOW);
+}
+
+// Removes the entries not used by any kernel in kheaders_max_age, and kernel
+// links whose headers are gone. Run after each extraction, which is rare
+// enough not to matter for startup time.
+void collect_kheaders(const string &cache_dir, const string &keep) {
+  DIR *dir = ::opendir(cache_dir.c_str());
+  if (!dir)
+    return;
+  time_t now = ::time(nullptr);
+  while (struct dirent *ent = ::readdir(dir)) {
+    string name = ent->d_name;
+    if (name[0] == '.' || name == keep)
+      continue;
+    string path = cache_dir + "/" + name;
+    struct stat st;
+    if (::lstat(path.c_str(), &st))
+      continue;
+    if (S_ISLNK(st.st_mode)) {
+      struct stat target;
+      if (::stat(path.c_str(), &target) || now - st.st_mtime > kheaders_max_age)
+        ::unlink(path.c_str());
+    } else if (S_ISDIR(st.st_mode) && now - st.st_mtime > kheaders_max_age) {
+      remove_tree(path);
+    }
+  }
+  ::closedir(dir);
+}
+
+}  // namespace
+
+static inline int extract_kheaders(const string &cache_dir,
+                                   const string &link_name, string &dirpath)
 {
-  char tar_cmd[256], dirpath_tmp[256];
+  char tar_cmd[256];
+  string digest, dirpath_tmp, link_tmp;
   int ret;
   bool module = false;
 
@@ -143,29 +234,48 @@ static inline int extract_kheaders(const std::string &dirpath,
     }
   }
 
-  snprintf(dirpath_tmp, sizeof(dirpath_tmp), "/tmp/kheaders-%s-XXXXXX", uname_data.release);
-  if (mkdtemp(dirpath_tmp) == NULL) {
-    ret = -1;
+  // Kernels with identical headers share one copy.
+  ret = hash_file(PROC_KHEADERS_PATH, digest);
+  if (ret)
     goto cleanup;
-  }
+  dirpath = cache_dir + "/" + digest;
 
-  if ((size_t)snprintf(tar_cmd, sizeof(tar_cmd), "tar -xf %s -C %s", PROC_KHEADERS_PATH, dirpath_tmp) >= sizeof(tar_cmd)) {
-    ret = -1;
-    goto cleanup;
-  }
-  ret = system(tar_cmd);
-  if (ret) {
-    system(("rm -rf " + std::string(dirpath_tmp)).c_str());
-    goto cleanup;
+  if (!file_exists(dirpath.c_str())) {
+    dirpath_tmp = cache_dir + "/." + digest + "-XXXXXX";
+    if (mkdtemp(&dirpath_tmp[0]) == NULL) {
+      ret = -1;
+      goto cleanup;
+    }
+    if ((size_t)snprintf(tar_cmd, sizeof(tar_cmd), "tar -xf %s -C %s",
+                         PROC_KHEADERS_PATH, dirpath_tmp.c_str()) >= sizeof(tar_cmd)) {
+      remove_tree(dirpath_tmp);
+      ret = -1;
+      goto cleanup;
+    }
+    ret = system(tar_cmd);
+    if (ret) {
+      remove_tree(dirpath_tmp);
+      goto cleanup;
+    }
+
+    /*
+     * If the new directory exists, it could have raced with a parallel
+     * extraction, in this case just delete ours and use the other one.
+     */
+    if (rename(dirpath_tmp.c_str(), dirpath.c_str()))
+      remove_tree(dirpath_tmp);
+    collect_kheaders(cache_dir, digest);
   }
+  // tar may have restored the build time of the top directory
+  touch(dirpath);
 
-  /*
-   * If the new directory exists, it could have raced with a parallel
-   * extraction, in this case just delete the old directory and ignore.
-   */
-  ret = rename(dirpath_tmp, dirpath.c_str());
-  if (ret)
-    ret = system(("rm -rf " + std::string(dirpath_tmp)).c_str());
+  // Point the kernel at the headers, replacing the link atomically.
+  link_tmp = cache_dir + "/." + link_name + "-" + std::to_string(getpid());
+  ::unlink(link_tmp.c_str());
+  if (!::symlink(digest.c_str(), link_tmp.c_str()) &&
+      rename(link_tmp.c_str(), (cache_dir + "/" + link_name).c_str()))
+    ::unlink(link_tmp.c_str());
+  ret = 0;
 
 cleanup:
   if (module) {
@@ -177,22 +287,36 @@ cleanup:
   return ret;
 }
 
+// The headers of /sys/kernel/kheaders.tar.xz are extracted once into a cache
+// directory named after the hash of the archive, and found again through a
+// link named after the kernel build, without loading the kheaders module.
 int get_proc_kheaders(std::string &dirpath)
 {
   struct utsname uname_data;
-  char dirpath_tmp[256];
 
   if (uname(&uname_data))
     return -errno;
 
-  snprintf(dirpath_tmp, 256, "/tmp/kheaders-%s", uname_data.release);
-  dirpath = std::string(dirpath_tmp);
+  string cache_dir = kheaders_cache_dir();
+  if (!make_private_dir(cache_dir))
+    return -1;
 
-  if (file_exists(dirpath_tmp))
-    return 0;
+  string link_name = kernel_link_name(uname_data);
+  string link_path = cache_dir + "/" + link_name;
+  char target[PATH_MAX];
+  ssize_t len = ::readlink(link_path.c_str(), target, sizeof(target) - 1);
+  if (len > 0) {
+    target[len] = '\0';
+    dirpath = cache_dir + "/" + target;
+    if (file_exists(dirpath.c_str())) {
+      touch(link_path);
+      touch(dirpath);
+      return 0;
+    }
+  }
 
-  // First time so extract it
-  return extract_kheaders(dirpath, uname_data);
+  // First time for this kernel so extract it
+  return extract_kheaders(cache_dir, link_name, dirpath);
 }
 
 }  // namespace ebpf
@@ -22,6 +22,9 @@
 #include <ftw.h>
 
 #define PROC_KHEADERS_PATH "/sys/kernel/kheaders.tar.xz"
+// Default directory for headers extracted from PROC_KHEADERS_PATH, see
+// get_proc_kheaders(). Overridden by BCC_KHEADERS_DIR.
+#define KHEADERS_CACHE_DIR "/var/tmp/bcc-kheaders"
 
 namespace ebpf {
 
@@ -20,9 +20,11 @@
 #include <fcntl.h>
 #include <ftw.h>
 #include <map>
+#include <mutex>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
@@ -48,10 +50,14 @@
 #include <clang/FrontendTool/Utils.h>
 #include <clang/Lex/PreprocessorOptions.h>
 
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/SHA1.h>
 
 #include "bcc_exception.h"
+#include "bcc_version.h"
 #include "bpf_module.h"
+#include "common.h"
 #include "exported_files.h"
 #include "kbuild_helper.h"
 #include "b_frontend_action.h"
@@ -66,8 +72,9 @@ using std::vector;
 
 namespace ebpf {
 
-ClangLoader::ClangLoader(llvm::LLVMContext *ctx, unsigned flags)
-    : ctx_(ctx), flags_(flags)
+ClangLoader::ClangLoader(llvm::LLVMContext *ctx, unsigned flags,
+                         CompileProfile *profile)
+    : ctx_(ctx), flags_(flags), profile_(profile)
 {
   for (auto f : ExportedFiles::headers())
     remapped_headers_[f.first] = llvm::MemoryBuffer::getMemBuffer(f.second);
@@ -77,6 +84,34 @@ ClangLoader::ClangLoader(llvm::LLVMContext *ctx, unsigned flags)
 
 ClangLoader::~ClangLoader() {}
 
+bool uses_local_headers(const string &text, const char *cflags[], int ncflags,
+                        const char *dir) {
+  for (int i = 0; cflags && i < ncflags; ++i) {
+    if (!strncmp(cflags[i], "-I", 2) || !strncmp(cflags[i], "-i", 2))
+      return true;
+  }
+
+  for (size_t pos = text.find("include"); pos != string::npos;
+       pos = text.find("include", pos)) {
+    pos += strlen("include");
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t'))
+      ++pos;
+    if (pos >= text.size())
+      break;
+    if (text[pos] == '"')
+      return true;
+    if (text[pos] == '<') {
+      size_t end = text.find('>', pos);
+      if (end == string::npos)
+        break;
+      string header = string(dir) + "/" + text.substr(pos + 1, end - pos - 1);
+      if (::access(header.c_str(), F_OK) == 0)
+        return true;
+    }
+  }
+  return false;
+}
+
 namespace
 {
 
@@ -103,7 +138,7 @@ std::pair<bool, string> get_kernel_path_info(const string kdir)
 }
 
 static int CreateFromArgs(clang::CompilerInvocation &invocation,
-                          const llvm::opt::ArgStringList &ccargs,
+                          llvm::ArrayRef<const char *> ccargs,
                           clang::DiagnosticsEngine &diags)
 {
 #if LLVM_MAJOR_VERSION >= 10
@@ -115,6 +150,49 @@ static int CreateFromArgs(clang::CompilerInvocation &invocation,
 #endif
 }
 
+const char *pch_main_path = "/virtual/include/bcc/pch.h";
+
+// The tracepoint pass only adds the definitions of the tracepoint argument
+// structures used by functions in the main file, either spelled out or through
+// TRACEPOINT_PROBE(). A local header or a macro from the command line may hide
+// them, so always run the pass for programs with local headers or when the
+// cflags define macros.
+bool needs_tracepoint_pass(const string &text, const char *cflags[],
+                           int ncflags, const char *cwd)
+{
+  if (text.find("tracepoint__") != string::npos ||
+      text.find("TRACEPOINT_PROBE") != string::npos)
+    return true;
+
+  for (int i = 0; cflags && i < ncflags; ++i) {
+    if (!strncmp(cflags[i], "-D", 2))
+      return true;
+  }
+  return uses_local_headers(text, cflags, ncflags, cwd);
+}
+
+// The precompiled header includes the files the program would -include, in
+// the same order.
+unique_ptr<llvm::MemoryBuffer> make_pch_header(const vector<string> &includes)
+{
+  string text;
+  for (const auto &inc : includes)
+    text += "#include \"" + inc + "\"\n";
+  return llvm::MemoryBuffer::getMemBufferCopy(text, pch_main_path);
+}
+
+// Precompiled headers that compiled in this process, with the file they were
+// checked at. Headers are only checked again once they are replaced.
+std::mutex checked_pch_mutex;
+map<string, struct stat> checked_pch;
+
+bool same_file(const struct stat &a, const struct stat &b)
+{
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+         a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
 }
 
 int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
@@ -146,6 +224,7 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
 
   // If all attempts to obtain kheaders fail, check for kheaders.tar.xz in sysfs
   if (!is_dir(kpath)) {
+    ScopedPhase phase(profile_, "kheaders");
     int ret = get_proc_kheaders(tmpdir);
     if (!ret) {
       kpath = tmpdir;
@@ -159,10 +238,18 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
   if (flags_ & DEBUG_PREPROCESSOR)
     std::cout << "Running from kernel directory at: " << kpath.c_str() << "\n";
 
-  // clang needs to run inside the kernel dir
-  DirStack dstack(kpath);
-  if (!dstack.ok())
+  // clang needs to run inside the kernel dir. The process working directory
+  // is shared by every thread, so clang is pointed at it with
+  // -working-directory rather than by changing into it.
+  if (!is_dir(kpath)) {
+    fprintf(stderr, "%s: not a directory\n", kpath.c_str());
+    return -1;
+  }
+  char cwd[256];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    ::perror("getcwd");
     return -1;
+  }
 
   string abs_file;
   if (in_memory) {
@@ -172,7 +259,7 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
     if (file.substr(0, 1) == "/")
       abs_file = file;
     else
-      abs_file = string(dstack.cwd()) + "/" + file;
+      abs_file = string(cwd) + "/" + file;
   }
 
   // -fno-color-diagnostics: this is a workaround for a bug in llvm terminalHasColors() as of
@@ -183,7 +270,8 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
   // "-D __BPF_TRACING__" below is added to suppress a warning in 4.17+.
   // It can be removed once clang supports asm-goto or the kernel removes
   // the warning.
-  vector<const char *> flags_cstr({"-O0", "-O2", "-emit-llvm", "-I", dstack.cwd(),
+  vector<const char *> flags_cstr({"-O0", "-O2", "-emit-llvm", "-I", cwd,
+                                   "-working-directory", kpath.c_str(),
                                    "-D", "__BPF_TRACING__",
                                    "-Wno-deprecated-declarations",
                                    "-Wno-gnu-variable-sized-type-not-at-end",
@@ -232,8 +320,12 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
   flags_cstr_rem.push_back(cur_cpu_flag.c_str());
 #endif
 
-  if (do_compile(mod, ts, in_memory, flags_cstr, flags_cstr_rem, main_path,
-                 main_buf, id, func_src, mod_src, true, maps_ns, fake_fd_map, perf_events)) {
+  bool tracepoint_pass =
+      !in_memory || needs_tracepoint_pass(file, cflags, ncflags, cwd);
+
+  if (do_compile(mod, ts, in_memory, tracepoint_pass, flags_cstr,
+                 flags_cstr_rem, main_path, main_buf, id, func_src, mod_src,
+                 true, maps_ns, fake_fd_map, perf_events)) {
 #if BCC_BACKUP_COMPILE != 1
     return -1;
 #else
@@ -244,8 +336,9 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, TableStorage &ts,
     func_src.clear();
     mod_src.clear();
     fake_fd_map.clear();
-    if (do_compile(mod, ts, in_memory, flags_cstr, flags_cstr_rem, main_path,
-                   main_buf, id, func_src, mod_src, false, maps_ns, fake_fd_map, perf_events))
+    if (do_compile(mod, ts, in_memory, tracepoint_pass, flags_cstr,
+                   flags_cstr_rem, main_path, main_buf, id, func_src, mod_src,
+                   false, maps_ns, fake_fd_map, perf_events))
       return -1;
 #endif
   }
@@ -285,7 +378,7 @@ string get_clang_target(void) {
 }
 
 int ClangLoader::do_compile(unique_ptr<llvm::Module> *mod, TableStorage &ts,
-                            bool in_memory,
+                            bool in_memory, bool tracepoint_pass,
                             const vector<const char *> &flags_cstr_in,
                             const vector<const char *> &flags_cstr_rem,
                             const std::string &main_path,
@@ -355,77 +448,82 @@ int ClangLoader::do_compile(unique_ptr<llvm::Module> *mod, TableStorage &ts,
     llvm::errs() << "\n";
   }
 
-  // pre-compilation pass for generating tracepoint structures
-  CompilerInstance compiler0;
-  CompilerInvocation &invocation0 = compiler0.getInvocation();
-  if (!CreateFromArgs(invocation0, ccargs, diags))
-    return -1;
-
-  invocation0.getPreprocessorOpts().RetainRemappedFileBuffers = true;
-  for (const auto &f : remapped_headers_)
-    invocation0.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
-  for (const auto &f : remapped_footers_)
-    invocation0.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
-
-  if (in_memory) {
-    invocation0.getPreprocessorOpts().addRemappedFile(main_path, &*main_buf);
-    invocation0.getFrontendOpts().Inputs.clear();
-    invocation0.getFrontendOpts().Inputs.push_back(FrontendInputFile(
-        main_path, FrontendOptions::getInputKindForExtension("c")));
+  // Use a precompiled header for the files included in front of the program,
+  // building it first if this is the first compilation with these flags.
+  vector<const char *> ccargs_v(ccargs.begin(), ccargs.end());
+  string pch = pch_path(flags_cstr);
+  pch_header_.reset();
+  if (!pch.empty()) {
+    ScopedPhase phase(profile_, "clang pch");
+    if (!check_pch(ccargs_v, pch) &&
+        !(build_pch(ccargs_v, pch) && check_pch(ccargs_v, pch)))
+      pch.clear();
   }
-  invocation0.getFrontendOpts().DisableFree = false;
-
-  compiler0.createDiagnostics(new IgnoringDiagConsumer());
 
   // capture the rewritten c file
   string out_str;
-  llvm::raw_string_ostream os(out_str);
-  TracepointFrontendAction tpact(os);
-  compiler0.ExecuteAction(tpact); // ignore errors, they will be reported later
-  unique_ptr<llvm::MemoryBuffer> out_buf = llvm::MemoryBuffer::getMemBuffer(out_str);
+  if (!tracepoint_pass) {
+    out_str = main_buf->getBuffer().str();
+  } else {
+    // pre-compilation pass for generating tracepoint structures
+    ScopedPhase phase(profile_, "clang tracepoint pass");
+    CompilerInstance compiler0;
+    CompilerInvocation &invocation0 = compiler0.getInvocation();
+    if (!CreateFromArgs(invocation0, ccargs, diags))
+      return -1;
 
-  // first pass
-  CompilerInstance compiler1;
-  CompilerInvocation &invocation1 = compiler1.getInvocation();
-  if (!CreateFromArgs( invocation1, ccargs, diags))
-    return -1;
+    add_remapped_files(invocation0, pch);
 
-  // This option instructs clang whether or not to free the file buffers that we
-  // give to it. Since the embedded header files should be copied fewer times
-  // and reused if possible, set this flag to true.
-  invocation1.getPreprocessorOpts().RetainRemappedFileBuffers = true;
-  for (const auto &f : remapped_headers_)
-    invocation1.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
-  for (const auto &f : remapped_footers_)
-    invocation1.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
-  invocation1.getPreprocessorOpts().addRemappedFile(main_path, &*out_buf);
-  invocation1.getFrontendOpts().Inputs.clear();
-  invocation1.getFrontendOpts().Inputs.push_back(FrontendInputFile(
-      main_path, FrontendOptions::getInputKindForExtension("c")));
-  invocation1.getFrontendOpts().DisableFree = false;
+    if (in_memory) {
+      invocation0.getPreprocessorOpts().addRemappedFile(main_path, &*main_buf);
+      invocation0.getFrontendOpts().Inputs.clear();
+      invocation0.getFrontendOpts().Inputs.push_back(FrontendInputFile(
+          main_path, FrontendOptions::getInputKindForExtension("c")));
+    }
+    invocation0.getFrontendOpts().DisableFree = false;
 
-  compiler1.createDiagnostics();
+    compiler0.createDiagnostics(new IgnoringDiagConsumer());
 
-  // capture the rewritten c file
+    llvm::raw_string_ostream os(out_str);
+    TracepointFrontendAction tpact(os);
+    compiler0.ExecuteAction(tpact); // ignore errors, they will be reported later
+  }
+  unique_ptr<llvm::MemoryBuffer> out_buf = llvm::MemoryBuffer::getMemBuffer(out_str);
+
+  // first pass, the compiler and its AST are released before code generation
   string out_str1;
-  llvm::raw_string_ostream os1(out_str1);
-  BFrontendAction bact(os1, flags_, ts, id, main_path, func_src, mod_src,
-                       maps_ns, fake_fd_map, perf_events);
-  if (!compiler1.ExecuteAction(bact))
-    return -1;
+  {
+    ScopedPhase phase(profile_, "clang rewrite pass");
+    CompilerInstance compiler1;
+    CompilerInvocation &invocation1 = compiler1.getInvocation();
+    if (!CreateFromArgs( invocation1, ccargs, diags))
+      return -1;
+
+    add_remapped_files(invocation1, pch);
+    invocation1.getPreprocessorOpts().addRemappedFile(main_path, &*out_buf);
+    invocation1.getFrontendOpts().Inputs.clear();
+    invocation1.getFrontendOpts().Inputs.push_back(FrontendInputFile(
+        main_path, FrontendOptions::getInputKindForExtension("c")));
+    invocation1.getFrontendOpts().DisableFree = false;
+
+    compiler1.createDiagnostics();
+
+    llvm::raw_string_ostream os1(out_str1);
+    BFrontendAction bact(os1, flags_, ts, id, main_path, func_src, mod_src,
+                         maps_ns, fake_fd_map, perf_events);
+    if (!compiler1.ExecuteAction(bact))
+      return -1;
+  }
   unique_ptr<llvm::MemoryBuffer> out_buf1 = llvm::MemoryBuffer::getMemBuffer(out_str1);
 
   // second pass, clear input and take rewrite buffer
+  ScopedPhase phase(profile_, "clang codegen pass");
   CompilerInstance compiler2;
   CompilerInvocation &invocation2 = compiler2.getInvocation();
   if (!CreateFromArgs(invocation2, ccargs, diags))
     return -1;
 
-  invocation2.getPreprocessorOpts().RetainRemappedFileBuffers = true;
-  for (const auto &f : remapped_headers_)
-    invocation2.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
-  for (const auto &f : remapped_footers_)
-    invocation2.getPreprocessorOpts().addRemappedFile(f.first, &*f.second);
+  add_remapped_files(invocation2, pch);
   invocation2.getPreprocessorOpts().addRemappedFile(main_path, &*out_buf1);
   invocation2.getFrontendOpts().Inputs.clear();
   invocation2.getFrontendOpts().Inputs.push_back(FrontendInputFile(
@@ -447,6 +545,156 @@ int ClangLoader::do_compile(unique_ptr<llvm::Module> *mod, TableStorage &ts,
   return 0;
 }
 
+void ClangLoader::add_remapped_files(clang::CompilerInvocation &invocation,
+                                     const string &pch) {
+  clang::PreprocessorOptions &opts = invocation.getPreprocessorOpts();
+
+  // This option instructs clang whether or not to free the file buffers that we
+  // give to it. Since the embedded header files should be copied fewer times
+  // and reused if possible, set this flag to true.
+  opts.RetainRemappedFileBuffers = true;
+  for (const auto &f : remapped_headers_)
+    opts.addRemappedFile(f.first, &*f.second);
+  for (const auto &f : remapped_footers_)
+    opts.addRemappedFile(f.first, &*f.second);
+
+  // The precompiled header replaces the -include'd files. Its main file has
+  // to stay available, clang checks it when loading the header.
+  if (!pch.empty()) {
+    opts.addRemappedFile(pch_main_path, &*pch_header_);
+    opts.Includes.clear();
+    opts.ImplicitPCHInclude = pch;
+  }
+}
+
+// The precompiled header depends on the same things as the compilation
+// itself, except the program: the flags (which select the kernel headers and
+// may define macros tested by helpers.h), the running kernel and the bcc and
+// llvm versions. Headers are only precompiled when BCC_PROG_CACHE_DIR is set.
+string ClangLoader::pch_path(const vector<const char *> &flags_cstr) const {
+  const char *cache_dir = ::getenv("BCC_PROG_CACHE_DIR");
+  if (!cache_dir || !*cache_dir || !make_private_dir(cache_dir))
+    return string();
+
+  struct utsname un;
+  if (uname(&un))
+    return string();
+
+  llvm::SHA1 hash;
+  auto add = [&hash](const char *s) {
+    hash.update(llvm::StringRef(s));
+    hash.update(llvm::StringRef("", 1));
+  };
+  add(LIBBCC_VERSION);
+  add(std::to_string(LLVM_MAJOR_VERSION).c_str());
+  add(un.release);
+  add(un.version);
+  for (size_t i = 0; i < flags_cstr.size(); ++i) {
+    // skip the input file
+    if (!strcmp(flags_cstr[i], "-c")) {
+      ++i;
+      continue;
+    }
+    add(flags_cstr[i]);
+  }
+
+  return string(cache_dir) + "/" + llvm::toHex(hash.final(), true) + ".pch";
+}
+
+bool ClangLoader::build_pch(const vector<const char *> &ccargs,
+                            const string &path) {
+  using namespace clang;
+
+  IntrusiveRefCntPtr<DiagnosticOptions> diag_opts(new DiagnosticOptions());
+  IntrusiveRefCntPtr<DiagnosticIDs> diag_ids(new DiagnosticIDs());
+  DiagnosticsEngine diags(diag_ids, &*diag_opts, new IgnoringDiagConsumer());
+
+  CompilerInstance compiler;
+  CompilerInvocation &invocation = compiler.getInvocation();
+  if (!CreateFromArgs(invocation, ccargs, diags))
+    return false;
+
+  if (!pch_header_)
+    pch_header_ = make_pch_header(invocation.getPreprocessorOpts().Includes);
+  add_remapped_files(invocation, string());
+  invocation.getPreprocessorOpts().addRemappedFile(pch_main_path,
+                                                   &*pch_header_);
+  invocation.getPreprocessorOpts().Includes.clear();
+  invocation.getFrontendOpts().Inputs.clear();
+  invocation.getFrontendOpts().Inputs.push_back(FrontendInputFile(
+      pch_main_path, FrontendOptions::getInputKindForExtension("h")));
+  invocation.getFrontendOpts().DisableFree = false;
+
+  // Write to a private file and rename it in place, so that concurrent
+  // compilations only ever see complete headers.
+  string tmp_path = path + ".XXXXXX";
+  int fd = mkstemp(&tmp_path[0]);
+  if (fd < 0)
+    return false;
+  close(fd);
+  invocation.getFrontendOpts().OutputFile = tmp_path;
+
+  compiler.createDiagnostics(new IgnoringDiagConsumer());
+  GeneratePCHAction act;
+  if (!compiler.ExecuteAction(act) || rename(tmp_path.c_str(), path.c_str())) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Compile an empty program against the precompiled header. This fails if the
+// header is missing, stale or was built by a different clang. The result is
+// kept for the process, so only the first compilation with these flags pays
+// for the check.
+bool ClangLoader::check_pch(const vector<const char *> &ccargs,
+                            const string &path) {
+  using namespace clang;
+
+  struct stat st;
+  if (::stat(path.c_str(), &st) < 0)
+    return false;
+
+  const char *check_path = "/virtual/pch_check.c";
+  unique_ptr<llvm::MemoryBuffer> check_buf =
+      llvm::MemoryBuffer::getMemBuffer("");
+
+  IntrusiveRefCntPtr<DiagnosticOptions> diag_opts(new DiagnosticOptions());
+  IntrusiveRefCntPtr<DiagnosticIDs> diag_ids(new DiagnosticIDs());
+  DiagnosticsEngine diags(diag_ids, &*diag_opts, new IgnoringDiagConsumer());
+
+  CompilerInstance compiler;
+  CompilerInvocation &invocation = compiler.getInvocation();
+  if (!CreateFromArgs(invocation, ccargs, diags))
+    return false;
+
+  if (!pch_header_)
+    pch_header_ = make_pch_header(invocation.getPreprocessorOpts().Includes);
+
+  {
+    std::lock_guard<std::mutex> guard(checked_pch_mutex);
+    auto it = checked_pch.find(path);
+    if (it != checked_pch.end() && same_file(it->second, st))
+      return true;
+  }
+
+  add_remapped_files(invocation, path);
+  invocation.getPreprocessorOpts().addRemappedFile(check_path, &*check_buf);
+  invocation.getFrontendOpts().Inputs.clear();
+  invocation.getFrontendOpts().Inputs.push_back(FrontendInputFile(
+      check_path, FrontendOptions::getInputKindForExtension("c")));
+  invocation.getFrontendOpts().DisableFree = false;
+
+  compiler.createDiagnostics(new IgnoringDiagConsumer());
+  SyntaxOnlyAction act;
+  if (!compiler.ExecuteAction(act))
+    return false;
+
+  std::lock_guard<std::mutex> guard(checked_pch_mutex);
+  checked_pch[path] = st;
+  return true;
+}
+
 const char * FuncSource::src(const std::string& name) {
   auto src = funcs_.find(name);
   if (src == funcs_.end())
@@ -20,8 +20,13 @@
 #include <memory>
 #include <string>
 
+#include "bcc_profile.h"
 #include "table_storage.h"
 
+namespace clang {
+class CompilerInvocation;
+}
+
 namespace llvm {
 class Module;
 class LLVMContext;
@@ -45,11 +50,24 @@ class FuncSource {
   const char * src_rewritten(const std::string& name);
   void set_src(const std::string& name, const std::string& src);
   void set_src_rewritten(const std::string& name, const std::string& src);
+  template <typename F>
+  void for_each(F fn) const {
+    for (const auto &it : funcs_)
+      fn(it.first, it.second.src_, it.second.src_rewritten_);
+  }
 };
 
+// Whether the program may include headers other than the kernel and bcc ones:
+// quoted includes, angled includes found in dir (the working directory of the
+// compilation, which is on the include path) and include paths or files added
+// by the cflags. Their contents are not known before compiling.
+bool uses_local_headers(const std::string &text, const char *cflags[],
+                        int ncflags, const char *dir);
+
 class ClangLoader {
  public:
-  explicit ClangLoader(llvm::LLVMContext *ctx, unsigned flags);
+  explicit ClangLoader(llvm::LLVMContext *ctx, unsigned flags,
+                       CompileProfile *profile = nullptr);
   ~ClangLoader();
   int parse(std::unique_ptr<llvm::Module> *mod, TableStorage &ts,
             const std::string &file, bool in_memory, const char *cflags[],
@@ -60,7 +78,8 @@ class ClangLoader {
 
  private:
   int do_compile(std::unique_ptr<llvm::Module> *mod, TableStorage &ts,
-                 bool in_memory, const std::vector<const char *> &flags_cstr_in,
+                 bool in_memory, bool tracepoint_pass,
+                 const std::vector<const char *> &flags_cstr_in,
                  const std::vector<const char *> &flags_cstr_rem,
                  const std::string &main_path,
                  const std::unique_ptr<llvm::MemoryBuffer> &main_buf,
@@ -69,12 +88,21 @@ class ClangLoader {
                  const std::string &maps_ns,
                  fake_fd_map_def &fake_fd_map,
                  std::map<std::string, std::vector<std::string>> &perf_events);
+  std::string pch_path(const std::vector<const char *> &flags_cstr) const;
+  bool build_pch(const std::vector<const char *> &ccargs,
+                 const std::string &path);
+  bool check_pch(const std::vector<const char *> &ccargs,
+                 const std::string &path);
+  void add_remapped_files(clang::CompilerInvocation &invocation,
+                          const std::string &pch);
 
  private:
   std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> remapped_headers_;
   std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> remapped_footers_;
+  std::unique_ptr<llvm::MemoryBuffer> pch_header_;
   llvm::LLVMContext *ctx_;
   unsigned flags_;
+  CompileProfile *profile_;
 };
 
 }  // namespace ebpf
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
+#include <mutex>
+#include <regex.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "kallsyms_index.h"
+
+namespace {
+
+std::mutex cache_mutex;
+std::shared_ptr<KallsymsIndex> cache;
+
+// Same as in bcc_proc.c
+#ifdef __x86_64__
+const uint64_t kernel_addr_space = 0x00ffffffffffffff;
+#else
+const uint64_t kernel_addr_space = 0x0;
+#endif
+
+bool starts_with(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// gcc 8 and later split out unlikely code into name.cold or name.cold.N
+bool is_cold(const char *name) {
+  const char *p = strstr(name, ".cold");
+  if (!p)
+    return false;
+  p += strlen(".cold");
+  if (*p == '\0')
+    return true;
+  if (*p++ != '.' || *p == '\0')
+    return false;
+  while (isdigit(*p))
+    p++;
+  return *p == '\0';
+}
+
+// The blacklist has lines like "0xffffffff81001000-0xffffffff81001010\tname".
+// It is only readable by root, the functions in it cannot be kprobed.
+std::unordered_set<std::string> load_blacklist() {
+  std::unordered_set<std::string> names;
+  FILE *f = fopen("/sys/kernel/debug/kprobes/blacklist", "r");
+  if (!f)
+    return names;
+  char line[2048], name[2048];
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%*s %2047s", name) == 1)
+      names.insert(name);
+  }
+  fclose(f);
+  return names;
+}
+
+// Section of the kernel image kprobes cannot be attached to, delimited by a
+// pair of symbols in kallsyms.
+struct Section {
+  const char *begin;
+  const char *end;
+  int state;  // 0 before, 1 within, 2 after
+};
+
+}  // namespace
+
+std::shared_ptr<KallsymsIndex> KallsymsIndex::get() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  if (!cache) {
+    std::shared_ptr<KallsymsIndex> index(new KallsymsIndex());
+    if (!index->load())
+      return nullptr;
+    cache = std::move(index);
+  }
+  return cache;
+}
+
+void KallsymsIndex::invalidate() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  cache.reset();
+}
+
+bool KallsymsIndex::load() {
+  FILE *kallsyms = fopen("/proc/kallsyms", "r");
+  if (!kallsyms)
+    return false;
+
+  std::unordered_set<std::string> blacklist = load_blacklist();
+  std::unordered_map<std::string, uint32_t> mods;
+  Section init = {"__init_begin", "__init_end", 0};
+  Section irqentry = {"__irqentry_text_start", "__irqentry_text_end", 0};
+
+  strtab_.clear();
+  syms_.clear();
+  char line[2048];
+  while (fgets(line, sizeof(line), kallsyms)) {
+    char *p;
+    uint64_t addr = strtoull(line, &p, 16);
+    while (*p == ' ')
+      p++;
+    char type = *p;
+    // Ignore data symbols, as bcc_procutils_each_ksym() does
+    if (!type || strchr("bBdDrR", type))
+      continue;
+    char *name = p + 1;
+    while (*name == ' ')
+      name++;
+    char *end = name + strcspn(name, " \t\n");
+    const char *mod = "kernel";
+    if (*end == '\t' || *end == ' ') {
+      char *m = end + strspn(end, " \t");
+      if (*m == '[') {
+        mod = ++m;
+        m[strcspn(m, "]\n")] = '\0';
+      }
+    }
+    *end = '\0';
+
+    // Kprobes cannot be attached to the init and irqentry sections, the
+    // functions annotated NOKPROBE_SYMBOL() (which also have a _kbl_addr_
+    // symbol, even in modules), the perf code and the .cold parts of
+    // functions.
+    bool kprobe = type == 't' || type == 'T' || type == 'w' || type == 'W';
+    for (Section *s : {&init, &irqentry}) {
+      if (s->state == 0 && !strcmp(name, s->begin)) {
+        s->state = 1;
+        kprobe = false;
+      } else if (s->state == 1) {
+        if (!strcmp(name, s->end))
+          s->state = 2;
+        kprobe = false;
+      }
+    }
+    if (kprobe && (starts_with(name, "_kbl_addr_") ||
+                   starts_with(name, "__perf") || starts_with(name, "perf_") ||
+                   is_cold(name) || blacklist.count(name)))
+      kprobe = false;
+
+    auto it = mods.find(mod);
+    if (it == mods.end()) {
+      it = mods.emplace(mod, strtab_.size()).first;
+      strtab_.append(mod, strlen(mod) + 1);
+    }
+    syms_.push_back({addr, static_cast<uint32_t>(strtab_.size()), it->second,
+                     type, kprobe});
+    strtab_.append(name, end - name + 1);
+  }
+  fclose(kallsyms);
+
+  std::stable_sort(syms_.begin(), syms_.end());
+  by_addr_.clear();
+  for (size_t i = 0; i < syms_.size(); i++) {
+    uint64_t addr = syms_[i].addr;
+    if (addr != 0 && addr != ULLONG_MAX && addr >= kernel_addr_space)
+      by_addr_.push_back(i);
+  }
+  by_name_.resize(syms_.size());
+  for (size_t i = 0; i < syms_.size(); i++)
+    by_name_[i] = i;
+  std::stable_sort(by_name_.begin(), by_name_.end(),
+                   [this](uint32_t a, uint32_t b) {
+                     return strcmp(name(syms_[a]), name(syms_[b])) < 0;
+                   });
+  return true;
+}
+
+const KallsymsIndex::Symbol *KallsymsIndex::find_name(const char *name) const {
+  auto it = std::lower_bound(by_name_.begin(), by_name_.end(), name,
+                             [this](uint32_t i, const char *name) {
+                               return strcmp(this->name(syms_[i]), name) < 0;
+                             });
+  if (it == by_name_.end() || strcmp(this->name(syms_[*it]), name))
+    return nullptr;
+  return &syms_[*it];
+}
+
+const KallsymsIndex::Symbol *KallsymsIndex::find_addr(uint64_t addr) const {
+  auto it = std::upper_bound(by_addr_.begin(), by_addr_.end(), addr,
+                             [this](uint64_t addr, uint32_t i) {
+                               return addr < syms_[i].addr;
+                             });
+  if (it == by_addr_.begin())
+    return nullptr;
+  return &syms_[*--it];
+}
+
+int KallsymsIndex::foreach(const char *pattern, int flags,
+                           const std::function<bool(const Symbol &)> &cb) const {
+  regex_t re;
+  bool use_regex = pattern && (flags & REGEX);
+  if (use_regex && regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB))
+    return -1;
+  for (auto &sym : syms_) {
+    if ((flags & KPROBES) && !sym.kprobe)
+      continue;
+    if (use_regex) {
+      if (regexec(&re, name(sym), 0, nullptr, 0))
+        continue;
+    } else if (pattern && fnmatch(pattern, name(sym), 0)) {
+      continue;
+    }
+    if (!cb(sym))
+      break;
+  }
+  if (use_regex)
+    regfree(&re);
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bcc_syms.h"
+
+// The function symbols of /proc/kallsyms, parsed once and shared by everyone
+// in the process needing kernel symbols: KSyms, kprobe discovery and the
+// bcc_kallsyms_*() C API. Each symbol also records whether a kprobe can be
+// attached to it, which is what attach_kprobe(event_re=...) needs.
+class KallsymsIndex {
+ public:
+  struct Symbol {
+    uint64_t addr;
+    uint32_t name_off;
+    uint32_t mod_off;
+    char type;
+    bool kprobe;
+
+    bool operator<(const Symbol &rhs) const { return addr < rhs.addr; }
+  };
+
+  // Flags of foreach()
+  enum {
+    REGEX = BCC_KALLSYMS_REGEX,
+    KPROBES = BCC_KALLSYMS_KPROBES,
+  };
+
+  // Returns the index of the running kernel, reading /proc/kallsyms on the
+  // first call or the first call after invalidate(). Returns nullptr if
+  // /proc/kallsyms cannot be read.
+  static std::shared_ptr<KallsymsIndex> get();
+  // Makes the next get() read /proc/kallsyms again, e.g. after a module was
+  // loaded. Indexes already handed out stay valid.
+  static void invalidate();
+
+  const char *name(const Symbol &sym) const { return &strtab_[sym.name_off]; }
+  const char *module(const Symbol &sym) const {
+    return &strtab_[sym.mod_off];
+  }
+  size_t size() const { return syms_.size(); }
+
+  // The symbol named name, the one with the lowest address if there are
+  // several.
+  const Symbol *find_name(const char *name) const;
+  // The symbol containing addr, i.e. the last one starting at or below it.
+  // Symbols at 0 or below the kernel address space, like absolute and per-cpu
+  // symbols or any symbol when not root, are never returned.
+  const Symbol *find_addr(uint64_t addr) const;
+  // Calls cb on each symbol matching pattern, in address order. pattern is a
+  // shell glob, or a POSIX extended regex with REGEX, null matches all. With
+  // KPROBES only the functions a kprobe can be attached to are visited.
+  // Stops when cb returns false. Returns -1 if the regex is invalid.
+  int foreach(const char *pattern, int flags,
+              const std::function<bool(const Symbol &)> &cb) const;
+
+ private:
+  bool load();
+
+  std::vector<Symbol> syms_;
+  // Indexes of syms_ sorted by name
+  std::vector<uint32_t> by_name_;
+  // Indexes of the syms_ find_addr() may return, in address order
+  std::vector<uint32_t> by_addr_;
+  std::string strtab_;
+};
@@ -34,6 +34,7 @@
 #include <linux/version.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -438,6 +439,68 @@ int bpf_obj_get_info(int prog_map_fd, void *info, uint32_t *info_len)
   return bpf_obj_get_info_by_fd(prog_map_fd, info, info_len);
 }
 
+#define BPF_STATS_SYSCTL "/proc/sys/kernel/bpf_stats_enabled"
+
+int bcc_enable_stats(int *stats_fd, int *stats_sysctl)
+{
+  int fd, ret;
+  char prev = '0';
+
+  fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+  if (fd >= 0) {
+    *stats_fd = fd;
+    *stats_sysctl = 0;
+    return 0;
+  }
+  if (errno != EINVAL)
+    return -1;
+
+  // BPF_ENABLE_STATS is in 5.8, the sysctl alone in 5.1 to 5.7
+  fd = open(BPF_STATS_SYSCTL, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (read(fd, &prev, 1) != 1) {
+    close(fd);
+    return -1;
+  }
+  ret = prev == '0' ? pwrite(fd, "1", 1, 0) : 1;
+  close(fd);
+  if (ret != 1)
+    return -1;
+  *stats_fd = -1;
+  *stats_sysctl = prev == '0';
+  return 0;
+}
+
+void bcc_disable_stats(int stats_fd, int stats_sysctl)
+{
+  int fd;
+
+  if (stats_fd >= 0)
+    close(stats_fd);
+  if (!stats_sysctl)
+    return;
+  fd = open(BPF_STATS_SYSCTL, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  if (write(fd, "0", 1) != 1)
+    fprintf(stderr, "could not restore %s: %s\n", BPF_STATS_SYSCTL,
+            strerror(errno));
+  close(fd);
+}
+
+int bcc_prog_stats(int prog_fd, uint64_t *run_cnt, uint64_t *run_time_ns)
+{
+  struct bpf_prog_info info = {};
+  uint32_t info_len = sizeof(info);
+
+  if (bpf_obj_get_info_by_fd(prog_fd, &info, &info_len))
+    return -1;
+  *run_cnt = info.run_cnt;
+  *run_time_ns = info.run_time_ns;
+  return 0;
+}
+
 int bpf_prog_compute_tag(const struct bpf_insn *insns, int prog_len,
                          unsigned long long *ptag)
 {
@@ -586,8 +649,10 @@ int bcc_prog_load_xattr(struct bpf_load_program_attr *attr, int prog_len,
       expected_attach_type = BPF_LSM_MAC;
     }
 
-    if (attr->prog_type == BPF_PROG_TYPE_TRACING ||
-        attr->prog_type == BPF_PROG_TYPE_LSM) {
+    // The attach target is named after the prefix, unless the caller chose
+    // it, see bcc_func_load_trampoline()
+    if ((attr->prog_type == BPF_PROG_TYPE_TRACING ||
+         attr->prog_type == BPF_PROG_TYPE_LSM) && !attr->attach_btf_id) {
       attr->attach_btf_id = libbpf_find_vmlinux_btf_id(attr->name + name_offset,
                                                        expected_attach_type);
       attr->expected_attach_type = expected_attach_type;
@@ -1159,6 +1224,263 @@ int bpf_detach_uprobe(const char *ev_name)
   return bpf_detach_probe(ev_name, "uprobe");
 }
 
+struct parallel_ctx {
+  void (*fn)(void *arg, int i);
+  void *arg;
+  int n;
+  int next;
+};
+
+static void *parallel_worker(void *p)
+{
+  struct parallel_ctx *ctx = p;
+  int i;
+
+  while ((i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) < ctx->n)
+    ctx->fn(ctx->arg, i);
+  return NULL;
+}
+
+// Calls fn(arg, i) for each i in [0, n) on up to nthreads threads, one per
+// online CPU when nthreads is 0. The calling thread is one of them.
+static void run_parallel(int n, int nthreads, void (*fn)(void *arg, int i),
+                         void *arg)
+{
+  struct parallel_ctx ctx = {fn, arg, n, 0};
+  pthread_t *threads = NULL;
+  int i, started = 0;
+
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > n)
+    nthreads = n;
+  if (nthreads > 1)
+    threads = calloc(nthreads - 1, sizeof(*threads));
+  for (i = 0; threads && i < nthreads - 1; i++) {
+    if (pthread_create(&threads[i], NULL, parallel_worker, &ctx))
+      break;
+    started++;
+  }
+  parallel_worker(&ctx);
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
+
+struct probe_batch {
+  struct bcc_probe_target *targets;
+  const char *event_type;
+  // for detaching: the sorted names of the [k,u]probe_events entries, and
+  // the fd used to remove ours
+  char **events;
+  size_t nevents;
+  int events_fd;
+};
+
+static void attach_probe_target(void *arg, int i)
+{
+  struct probe_batch *batch = arg;
+  struct bcc_probe_target *t = &batch->targets[i];
+  bool is_kprobe = strncmp("kprobe", batch->event_type, 6) == 0;
+
+  errno = 0;
+  t->pfd = bpf_attach_probe(t->progfd, t->attach_type, t->ev_name, t->name,
+                            batch->event_type, t->offset,
+                            is_kprobe ? -1 : t->pid,
+                            is_kprobe ? t->maxactive : -1);
+  t->err = t->pfd < 0 ? (errno ? errno : EINVAL) : 0;
+}
+
+static int bpf_attach_probes(struct bcc_probe_target *targets, int n,
+                             int nthreads, const char *event_type)
+{
+  struct probe_batch batch = {targets, event_type, NULL, 0, -1};
+  int i, failed = 0;
+
+  run_parallel(n, nthreads, attach_probe_target, &batch);
+  for (i = 0; i < n; i++)
+    failed += targets[i].pfd < 0;
+  return failed;
+}
+
+static int cmp_event_name(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Reads the names of the probes in [k,u]probe_events, which has lines like
+// "p:kprobes/p_do_sys_open_bcc_1234 do_sys_open".
+static int read_probe_events(struct probe_batch *batch)
+{
+  char buf[PATH_MAX], *line = NULL, *name, *end;
+  size_t len = 0, cap = 0;
+  char **events;
+  FILE *fp;
+
+  snprintf(buf, sizeof(buf), "/sys/kernel/debug/tracing/%s_events",
+           batch->event_type);
+  fp = fopen(buf, "r");
+  if (!fp) {
+    fprintf(stderr, "open(%s): %s\n", buf, strerror(errno));
+    return -1;
+  }
+  while (getline(&line, &len, fp) != -1) {
+    name = strchr(line, '/');
+    if (!name)
+      continue;
+    name++;
+    end = name + strcspn(name, " \t\n");
+    *end = '\0';
+    if (batch->nevents == cap) {
+      cap = cap ? cap * 2 : 64;
+      events = realloc(batch->events, cap * sizeof(*events));
+      if (!events)
+        break;
+      batch->events = events;
+    }
+    batch->events[batch->nevents] = strdup(name);
+    if (batch->events[batch->nevents])
+      batch->nevents++;
+  }
+  free(line);
+  fclose(fp);
+  qsort(batch->events, batch->nevents, sizeof(*batch->events),
+        cmp_event_name);
+  return 0;
+}
+
+static void close_probe_target(void *arg, int i)
+{
+  struct probe_batch *batch = arg;
+  struct bcc_probe_target *t = &batch->targets[i];
+
+  t->err = 0;
+  if (t->pfd >= 0 && bpf_close_perf_event_fd(t->pfd))
+    t->err = errno ? errno : EINVAL;
+  t->pfd = -1;
+}
+
+// The kernel runs each line written to [k,u]probe_events as a command, up to
+// this many bytes per write.
+#define PROBE_EVENTS_WRITE_SIZE 4095
+
+// Writes cmds, the len bytes of lines removing the events of targets[idx[i]]
+// for i in [0, n). If a line is rejected, which stops the kernel there, the
+// lines are written again one at a time to find which: ENOENT then means the
+// first write already removed the event.
+static void write_probe_events(struct probe_batch *batch, const char *cmds,
+                               size_t len, const int *idx, int n)
+{
+  struct bcc_probe_target *t;
+  const char *line = cmds;
+  size_t line_len;
+  int i;
+
+  if (write(batch->events_fd, cmds, len) == (ssize_t)len)
+    return;
+  for (i = 0; i < n; i++, line += line_len) {
+    t = &batch->targets[idx[i]];
+    line_len = strchr(line, '\n') - line + 1;
+    if (write(batch->events_fd, line, line_len) < 0 && errno != ENOENT) {
+      t->err = errno;
+      fprintf(stderr, "write(%.*s): %s\n", (int)line_len - 1, line,
+              strerror(errno));
+    }
+  }
+}
+
+// Probes created with perf_event_open are gone once their fd is closed, the
+// ones created through debugfs also need their event removed. Removing them
+// one write at a time takes seconds for thousands of probes, so the commands
+// are batched into as few writes as possible.
+static void remove_probe_events(struct probe_batch *batch, int n)
+{
+  char cmds[PROBE_EVENTS_WRITE_SIZE], alias[256], line[PATH_MAX];
+  int idx[PROBE_EVENTS_WRITE_SIZE / 8];
+  const char *key = alias;
+  struct bcc_probe_target *t;
+  size_t len = 0;
+  int i, nidx = 0, res;
+
+  for (i = 0; i < n; i++) {
+    t = &batch->targets[i];
+    if (snprintf(alias, sizeof(alias), "%s_bcc_%d", t->ev_name, getpid()) >=
+        sizeof(alias)) {
+      t->err = ENAMETOOLONG;
+      continue;
+    }
+    if (!bsearch(&key, batch->events, batch->nevents, sizeof(*batch->events),
+                 cmp_event_name))
+      continue;
+    res = snprintf(line, sizeof(line), "-:%ss/%s\n", batch->event_type, alias);
+    if (len + res > sizeof(cmds)) {
+      write_probe_events(batch, cmds, len, idx, nidx);
+      len = 0;
+      nidx = 0;
+    }
+    memcpy(cmds + len, line, res);
+    len += res;
+    idx[nidx++] = i;
+  }
+  if (nidx)
+    write_probe_events(batch, cmds, len, idx, nidx);
+}
+
+static int bpf_detach_probes(struct bcc_probe_target *targets, int n,
+                             int nthreads, const char *event_type)
+{
+  struct probe_batch batch = {targets, event_type, NULL, 0, -1};
+  char buf[PATH_MAX];
+  int i, err = 0, failed = 0;
+
+  run_parallel(n, nthreads, close_probe_target, &batch);
+
+  if (read_probe_events(&batch) < 0) {
+    err = errno;
+  } else if (batch.nevents > 0) {
+    snprintf(buf, sizeof(buf), "/sys/kernel/debug/tracing/%s_events",
+             event_type);
+    batch.events_fd = open(buf, O_WRONLY | O_APPEND, 0);
+    if (batch.events_fd < 0) {
+      err = errno;
+      fprintf(stderr, "open(%s): %s\n", buf, strerror(errno));
+    } else {
+      remove_probe_events(&batch, n);
+      close(batch.events_fd);
+    }
+  }
+  for (i = 0; i < batch.nevents; i++)
+    free(batch.events[i]);
+  free(batch.events);
+
+  for (i = 0; i < n; i++) {
+    if (err && !targets[i].err)
+      targets[i].err = err;
+    failed += targets[i].err != 0;
+  }
+  return failed;
+}
+
+int bpf_attach_kprobes(struct bcc_probe_target *targets, int n, int nthreads)
+{
+  return bpf_attach_probes(targets, n, nthreads, "kprobe");
+}
+
+int bpf_detach_kprobes(struct bcc_probe_target *targets, int n, int nthreads)
+{
+  return bpf_detach_probes(targets, n, nthreads, "kprobe");
+}
+
+int bpf_attach_uprobes(struct bcc_probe_target *targets, int n, int nthreads)
+{
+  return bpf_attach_probes(targets, n, nthreads, "uprobe");
+}
+
+int bpf_detach_uprobes(struct bcc_probe_target *targets, int n, int nthreads)
+{
+  return bpf_detach_probes(targets, n, nthreads, "uprobe");
+}
+
 int bpf_attach_tracepoint(int progfd, const char *tp_category,
                           const char *tp_name)
 {
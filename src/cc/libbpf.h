@@ -89,6 +89,31 @@ int bpf_attach_uprobe(int progfd, enum bpf_probe_attach_type attach_type,
                       uint64_t offset, pid_t pid);
 int bpf_detach_uprobe(const char *ev_name);
 
+/* A probe attached or detached by bpf_[at,de]tach_[k,u]probes(). The caller
+ * sets the arguments of bpf_attach_[k,u]probe(), pfd and err are filled in.
+ */
+struct bcc_probe_target {
+  int progfd;
+  enum bpf_probe_attach_type attach_type;
+  const char *ev_name;
+  const char *name;  /* the kernel function or the binary path */
+  uint64_t offset;
+  pid_t pid;         /* uprobes only */
+  int maxactive;     /* kretprobes only */
+  int pfd;           /* the perf event fd, -1 when not attached */
+  int err;           /* the errno of a failure, 0 on success */
+};
+
+/* Attach or detach targets[0..n), running up to nthreads attach syscalls at
+ * once (one thread per CPU when 0). Detaching closes the pfd of each target
+ * and removes the events created through debugfs, with as few writes to
+ * [k,u]probe_events as possible. Return the number of targets that failed.
+ */
+int bpf_attach_kprobes(struct bcc_probe_target *targets, int n, int nthreads);
+int bpf_detach_kprobes(struct bcc_probe_target *targets, int n, int nthreads);
+int bpf_attach_uprobes(struct bcc_probe_target *targets, int n, int nthreads);
+int bpf_detach_uprobes(struct bcc_probe_target *targets, int n, int nthreads);
+
 int bpf_attach_tracepoint(int progfd, const char *tp_category,
                           const char *tp_name);
 int bpf_detach_tracepoint(const char *tp_category, const char *tp_name);
@@ -144,6 +169,21 @@ int bpf_prog_get_fd_by_id(uint32_t id);
 int bpf_map_get_fd_by_id(uint32_t id);
 int bpf_obj_get_info_by_fd(int prog_fd, void *info, uint32_t *info_len);
 
+/* Turns on the run_cnt and run_time_ns accounting of all BPF programs. On
+ * success *stats_fd keeps it on until closed, or is -1 on kernels before 5.8
+ * where the kernel.bpf_stats_enabled sysctl is set instead. *stats_sysctl
+ * tells whether the sysctl was off before. Returns -1 on error.
+ */
+int bcc_enable_stats(int *stats_fd, int *stats_sysctl);
+/* Undoes bcc_enable_stats(): closes stats_fd and turns the sysctl back off
+ * if it was off before.
+ */
+void bcc_disable_stats(int stats_fd, int stats_sysctl);
+/* Number of runs and total run time of the program prog_fd, only counted
+ * while the accounting is on. Returns -1 on error.
+ */
+int bcc_prog_stats(int prog_fd, uint64_t *run_cnt, uint64_t *run_time_ns);
+
 #define LOG_BUF_SIZE 65536
 
 // Put non-static/inline functions in their own section with this prefix +
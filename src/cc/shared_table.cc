@@ -38,6 +38,7 @@ class SharedTableStorage : public TableStorageImpl {
     virtual ~iterator() {}
     virtual unique_ptr<self_type> clone() const override { return make_unique<iterator>(it_); }
     virtual self_type &operator++() override {
+      std::lock_guard<std::recursive_mutex> guard(mutex_);
       ++it_;
       return *this;
     }
@@ -53,12 +54,15 @@ class SharedTableStorage : public TableStorageImpl {
   virtual unique_ptr<TableStorageIteratorImpl> lower_bound(const string &k) override;
   virtual unique_ptr<TableStorageIteratorImpl> upper_bound(const string &k) override;
   virtual unique_ptr<TableStorageIteratorImpl> erase(const TableStorageIteratorImpl &it) override;
+  virtual std::recursive_mutex &mutex() override { return mutex_; }
 
  private:
   static std::map<string, TableDesc> tables_;
+  static std::recursive_mutex mutex_;
 };
 
 bool SharedTableStorage::Find(const string &name, TableStorage::iterator &result) const {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   auto it = tables_.find(name);
   if (it == tables_.end())
     return false;
@@ -67,6 +71,7 @@ bool SharedTableStorage::Find(const string &name, TableStorage::iterator &result
 }
 
 bool SharedTableStorage::Insert(const string &name, TableDesc &&desc) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   auto it = tables_.find(name);
   if (it != tables_.end())
     return false;
@@ -75,6 +80,7 @@ bool SharedTableStorage::Insert(const string &name, TableDesc &&desc) {
 }
 
 bool SharedTableStorage::Delete(const string &name) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   auto it = tables_.find(name);
   if (it == tables_.end())
     return false;
@@ -83,19 +89,24 @@ bool SharedTableStorage::Delete(const string &name) {
 }
 
 unique_ptr<TableStorageIteratorImpl> SharedTableStorage::begin() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   return make_unique<iterator>(tables_.begin());
 }
 unique_ptr<TableStorageIteratorImpl> SharedTableStorage::end() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   return make_unique<iterator>(tables_.end());
 }
 
 unique_ptr<TableStorageIteratorImpl> SharedTableStorage::lower_bound(const string &k) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   return make_unique<iterator>(tables_.lower_bound(k));
 }
 unique_ptr<TableStorageIteratorImpl> SharedTableStorage::upper_bound(const string &k) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   return make_unique<iterator>(tables_.upper_bound(k));
 }
 unique_ptr<TableStorageIteratorImpl> SharedTableStorage::erase(const TableStorageIteratorImpl &it) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
   auto i = tables_.find((*it).first);
   if (i == tables_.end())
     return unique_ptr<iterator>();
@@ -104,6 +115,7 @@ unique_ptr<TableStorageIteratorImpl> SharedTableStorage::erase(const TableStorag
 
 // All maps for this process are kept in global static storage.
 std::map<string, TableDesc> SharedTableStorage::tables_;
+std::recursive_mutex SharedTableStorage::mutex_;
 
 unique_ptr<TableStorage> createSharedTableStorage() {
   auto t = make_unique<TableStorage>();
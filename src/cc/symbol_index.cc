@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bcc_elf.h"
+#include "common.h"
+#include "symbol_index.h"
+#include "vendor/tinyformat.hpp"
+
+namespace {
+
+const char kMagic[8] = {'B', 'C', 'C', 'S', 'Y', 'M', 'I', 'X'};
+const uint32_t kVersion = 1;
+
+// Layout of an index file: the header, count entries sorted by start, then
+// strtab_size bytes of NUL-terminated symbol names.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t strtab_size;
+};
+
+struct BuildPayload {
+  std::vector<SymbolIndex::Entry> entries;
+  std::string strtab;
+};
+
+int add_symbol(const char *symname, uint64_t start, uint64_t size, void *p) {
+  BuildPayload *payload = static_cast<BuildPayload *>(p);
+  payload->entries.push_back({start, size, payload->strtab.size()});
+  payload->strtab.append(symname, strlen(symname) + 1);
+  return 0;
+}
+
+}  // namespace
+
+SymbolIndex::SymbolIndex(void *addr, size_t len)
+    : addr_(addr), len_(len) {
+  const Header *header = static_cast<const Header *>(addr_);
+  entries_ = reinterpret_cast<const Entry *>(header + 1);
+  count_ = header->count;
+  strtab_ = reinterpret_cast<const char *>(entries_ + count_);
+  strtab_size_ = header->strtab_size;
+}
+
+SymbolIndex::~SymbolIndex() { munmap(addr_, len_); }
+
+std::unique_ptr<SymbolIndex> SymbolIndex::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat s;
+  if (fstat(fd, &s) || static_cast<size_t>(s.st_size) < sizeof(Header)) {
+    close(fd);
+    return nullptr;
+  }
+
+  size_t len = s.st_size;
+  void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return nullptr;
+
+  const Header *header = static_cast<const Header *>(addr);
+  // Reject anything we did not write ourselves, including truncated files.
+  // The names table must be NUL-terminated so that any name_off in range
+  // yields a terminated string.
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) ||
+      header->version != kVersion ||
+      header->count > (len - sizeof(Header)) / sizeof(Entry) ||
+      len != sizeof(Header) + header->count * sizeof(Entry) +
+                 header->strtab_size ||
+      (header->strtab_size &&
+       static_cast<const char *>(addr)[len - 1] != '\0')) {
+    munmap(addr, len);
+    return nullptr;
+  }
+
+  return std::unique_ptr<SymbolIndex>(new SymbolIndex(addr, len));
+}
+
+bool SymbolIndex::build(const std::string &elf_path,
+                        const bcc_symbol_option *option,
+                        const std::string &path) {
+  // bcc_elf_foreach_sym() overwrites lazy_symbolize, don't let it change
+  // the caller's option.
+  bcc_symbol_option elf_option = *option;
+  BuildPayload payload;
+  if (bcc_elf_foreach_sym(elf_path.c_str(), add_symbol, &elf_option,
+                          &payload) < 0)
+    return false;
+  std::sort(payload.entries.begin(), payload.entries.end());
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.reserved = 0;
+  header.count = payload.entries.size();
+  header.strtab_size = payload.strtab.size();
+
+  // Write to a private file and rename it in place, so that concurrent
+  // readers and writers only ever see complete indexes.
+  std::string tmp_path = path + ".XXXXXX";
+  int fd = mkstemp(&tmp_path[0]);
+  if (fd < 0)
+    return false;
+  FILE *file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  bool ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(payload.entries.data(), sizeof(Entry), payload.entries.size(),
+             file) == payload.entries.size() &&
+      fwrite(payload.strtab.data(), 1, payload.strtab.size(), file) ==
+          payload.strtab.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<SymbolIndex> SymbolIndex::load(
+    const std::string &path, const bcc_symbol_option *option) {
+  const char *cache_dir = getenv("BCC_SYMBOL_CACHE_DIR");
+  if (!cache_dir || !*cache_dir || !ebpf::make_private_dir(cache_dir))
+    return nullptr;
+
+  char buildid[128];
+  if (bcc_elf_get_buildid(path.c_str(), buildid) < 0)
+    return nullptr;
+
+  // Which symbols end up in the index depends on the options, key it by
+  // them as well.
+  std::string index_path =
+      tfm::format("%s/%s-%x-%d.symidx", cache_dir, buildid,
+                  option->use_symbol_type, option->use_debug_file ? 1 : 0);
+
+  std::unique_ptr<SymbolIndex> index = open(index_path);
+  if (index)
+    return index;
+
+  if (!build(path, option, index_path))
+    return nullptr;
+  return open(index_path);
+}
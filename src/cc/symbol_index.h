@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "bcc_syms.h"
+
+// Symbol table of one ELF file, sorted by address and stored in a file under
+// the directory named by BCC_SYMBOL_CACHE_DIR, keyed by the ELF's build ID.
+// The file is mapped read-only, so that once it is written, later processes
+// can look up symbols without parsing the ELF symbol tables again.
+class SymbolIndex {
+ public:
+  struct Entry {
+    uint64_t start;
+    uint64_t size;
+    uint64_t name_off;
+
+    bool operator<(const Entry &rhs) const { return start < rhs.start; }
+  };
+
+  ~SymbolIndex();
+
+  // Returns the index of the ELF at path, building and storing it first if
+  // it is not cached yet. Returns nullptr if caching is disabled or the ELF
+  // has no build ID.
+  static std::unique_ptr<SymbolIndex> load(const std::string &path,
+                                           const bcc_symbol_option *option);
+
+  const Entry *begin() const { return entries_; }
+  const Entry *end() const { return entries_ + count_; }
+  bool empty() const { return count_ == 0; }
+  const char *name(const Entry &entry) const {
+    return entry.name_off < strtab_size_ ? strtab_ + entry.name_off : nullptr;
+  }
+
+ private:
+  SymbolIndex(void *addr, size_t len);
+
+  static std::unique_ptr<SymbolIndex> open(const std::string &path);
+  static bool build(const std::string &elf_path,
+                    const bcc_symbol_option *option,
+                    const std::string &path);
+
+  void *addr_;
+  size_t len_;
+  const Entry *entries_;
+  size_t count_;
+  const char *strtab_;
+  size_t strtab_size_;
+};
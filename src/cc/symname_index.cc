@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/elf.h>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <tuple>
+
+#include "bcc_elf.h"
+#include "symname_index.h"
+
+namespace {
+
+// The file, and the options deciding which symbols are visible in it. The
+// modification time catches binaries rewritten in place.
+typedef std::tuple<dev_t, ino_t, time_t, long, int, int, uint32_t> Key;
+
+std::mutex cache_mutex;
+std::map<Key, std::shared_ptr<const SymnameIndex>> cache;
+
+int add_symbol(const char *symname, uint64_t start, uint64_t, void *p) {
+  auto addrs = static_cast<std::unordered_map<std::string, uint64_t> *>(p);
+  // Keep the first one, as a search stopping at the first match would
+  addrs->emplace(symname, start);
+  return 0;
+}
+
+}  // namespace
+
+std::shared_ptr<const SymnameIndex> SymnameIndex::get(
+    const std::string &path, const bcc_symbol_option *option) {
+  struct stat s;
+  if (stat(path.c_str(), &s))
+    return nullptr;
+  Key key(s.st_dev, s.st_ino, s.st_mtim.tv_sec, s.st_mtim.tv_nsec,
+          option->use_debug_file, option->check_debug_file_crc,
+          option->use_symbol_type);
+
+  {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    auto it = cache.find(key);
+    if (it != cache.end())
+      return it->second;
+  }
+
+  // Built without the lock, so that binaries are parsed in parallel. If two
+  // threads race on one, the first index stored wins.
+  std::shared_ptr<SymnameIndex> index(new SymnameIndex());
+  if (!index->build(path, option))
+    return nullptr;
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  return cache.emplace(key, std::move(index)).first->second;
+}
+
+void SymnameIndex::invalidate() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  cache.clear();
+}
+
+bool SymnameIndex::build(const std::string &path,
+                         const bcc_symbol_option *option) {
+  type_ = bcc_elf_get_type(path.c_str());
+  if (type_ < 0)
+    return false;
+
+  // bcc_elf_foreach_sym() overwrites lazy_symbolize, don't let it change
+  // the caller's option.
+  bcc_symbol_option elf_option = *option;
+  if (bcc_elf_foreach_sym(path.c_str(), add_symbol, &elf_option, &addrs_) < 0)
+    return false;
+
+  if (type_ == ET_EXEC || type_ == ET_DYN) {
+    auto add_load_section = [](uint64_t v_addr, uint64_t mem_sz,
+                               uint64_t file_offset, void *p) {
+      auto sections = static_cast<std::vector<LoadSection> *>(p);
+      sections->push_back({v_addr, mem_sz, file_offset});
+      return 0;
+    };
+    if (bcc_elf_foreach_load_section(path.c_str(), add_load_section,
+                                     &load_sections_) < 0)
+      return false;
+  }
+  return true;
+}
+
+bool SymnameIndex::find_name(const char *name, uint64_t *addr) const {
+  auto it = addrs_.find(name);
+  if (it == addrs_.end())
+    return false;
+  *addr = it->second;
+  return true;
+}
+
+bool SymnameIndex::file_offset(uint64_t addr, uint64_t *offset) const {
+  if (type_ != ET_EXEC && type_ != ET_DYN) {
+    *offset = addr;
+    return true;
+  }
+  for (auto &section : load_sections_) {
+    if (addr >= section.v_addr && addr < section.v_addr + section.mem_sz) {
+      *offset = addr - section.v_addr + section.file_offset;
+      return true;
+    }
+  }
+  return false;
+}
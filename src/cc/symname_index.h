@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bcc_syms.h"
+
+// What bcc_resolve_symname() needs from an ELF file: the address of each
+// symbol name and the load sections to turn an address into a file offset.
+// It is built on the first resolution against a file and kept for the life
+// of the process, keyed by the file's device and inode, so attaching many
+// uprobes to one binary parses its symbol tables once.
+class SymnameIndex {
+ public:
+  // Returns the index of the ELF at path, building it if it is not cached
+  // yet. Returns nullptr if the file cannot be read as an ELF.
+  static std::shared_ptr<const SymnameIndex> get(
+      const std::string &path, const bcc_symbol_option *option);
+  // Drops all the cached indexes, e.g. after binaries were rebuilt in place.
+  // Indexes already handed out stay valid.
+  static void invalidate();
+
+  // Address of the first symbol named name, in the order bcc_elf_foreach_sym()
+  // visits them. Returns false if there is none.
+  bool find_name(const char *name, uint64_t *addr) const;
+  // Translates a virtual address to an offset in the file for ET_EXEC and
+  // ET_DYN files, returns it unchanged for others. Returns false if no load
+  // section contains addr.
+  bool file_offset(uint64_t addr, uint64_t *offset) const;
+
+ private:
+  struct LoadSection {
+    uint64_t v_addr;
+    uint64_t mem_sz;
+    uint64_t file_offset;
+  };
+
+  bool build(const std::string &path, const bcc_symbol_option *option);
+
+  int type_;
+  std::unordered_map<std::string, uint64_t> addrs_;
+  std::vector<LoadSection> load_sections_;
+};
@@ -16,9 +16,13 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sys/types.h>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -26,6 +30,8 @@
 #include "bcc_proc.h"
 #include "bcc_syms.h"
 #include "file_desc.h"
+#include "kallsyms_index.h"
+#include "symbol_index.h"
 
 class ProcStat {
   std::string procfs_;
@@ -38,29 +44,36 @@ public:
   void reset() { inode_ = getinode_(); }
 };
 
+// Line tables and inline frames of one module, see bcc_syms_dwarf.cc
+class ModuleDebugInfo;
+
 class SymbolCache {
 public:
+  // The ELF file of the module containing an address, and the address
+  // within that file, for symbolization beyond the symbol table.
+  struct ModuleFile {
+    const std::string *path;
+    uint64_t addr;
+    const bcc_symbol_option *option;
+    // Parsed debug info of the module, created by the caller on first use
+    std::shared_ptr<ModuleDebugInfo> *debug_info;
+  };
+
   virtual ~SymbolCache() = default;
 
   virtual void refresh() = 0;
+  virtual void prefetch(int nthreads) {}
+  virtual bool find_module_file(uint64_t addr, ModuleFile *file) {
+    return false;
+  }
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) = 0;
   virtual bool resolve_name(const char *module, const char *name,
                             uint64_t *addr) = 0;
 };
 
 class KSyms : SymbolCache {
-  struct Symbol {
-    Symbol(const char *name, const char *mod, uint64_t addr) : name(name), mod(mod), addr(addr) {}
-    std::string name;
-    std::string mod;
-    uint64_t addr;
-
-    bool operator<(const Symbol &rhs) const { return addr < rhs.addr; }
-  };
-
-  std::vector<Symbol> syms_;
-  std::unordered_map<std::string, uint64_t> symnames_;
-  static void _add_symbol(const char *, const char *, uint64_t, void *);
+  // Shared with every other KSyms of the process, see kallsyms_index.h
+  std::shared_ptr<KallsymsIndex> index_;
 
 public:
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) override;
@@ -125,45 +138,116 @@ class ProcSyms : SymbolCache {
     std::string name_;
     std::string path_;
     std::vector<Range> ranges_;
-    bool loaded_;
+    // The symbol table is loaded once, either by the first lookup or by a
+    // prefetch thread, and is read-only afterwards
+    std::unique_ptr<std::once_flag> load_once_;
     bcc_symbol_option *symbol_option_;
     ModuleType type_;
 
+    // Identity of the backing file, used to keep the module across refresh()
+    uint64_t dev_major_;
+    uint64_t dev_minor_;
+    uint64_t inode_;
+
     // The file offset within the ELF of the SO's first text section.
     uint64_t elf_so_offset_;
     uint64_t elf_so_addr_;
 
     std::unordered_set<std::string> symnames_;
     std::vector<Symbol> syms_;
+    // Used instead of syms_ when the symbols come from the on-disk cache
+    std::unique_ptr<SymbolIndex> sym_index_;
+    std::shared_ptr<ModuleDebugInfo> debug_info_;
+
+    // Symbols of a perf-PID map, keyed by start address. Entries never
+    // overlap: a newer entry replaces the parts of older ones it covers, as
+    // the JIT reuses the addresses of code it has discarded. start is the
+    // symbol's own start, which is below the key for a cut-off tail.
+    struct PerfMapSymbol {
+      uint64_t start;
+      uint64_t end;
+      const std::string *name;
+    };
+    std::map<uint64_t, PerfMapSymbol> perf_map_syms_;
+    // How far the perf-PID map has been read, and which file it was
+    uint64_t perf_map_offset_;
+    ino_t perf_map_inode_;
 
     void load_sym_table();
+    void do_load_sym_table();
+    void load_perf_map();
 
     bool contains(uint64_t addr, uint64_t &offset) const;
+    uint64_t range_offset(const Range &range, uint64_t addr) const;
     uint64_t start() const { return ranges_.begin()->start; }
+    bool same_file(uint64_t dev_major, uint64_t dev_minor,
+                   uint64_t inode) const {
+      return dev_major_ == dev_major && dev_minor_ == dev_minor &&
+             inode_ == inode;
+    }
 
     bool find_addr(uint64_t offset, struct bcc_symbol *sym);
+    bool find_perf_map_addr(uint64_t offset, struct bcc_symbol *sym);
+    bool find_index_addr(uint64_t offset, struct bcc_symbol *sym);
     bool find_name(const char *symname, uint64_t *addr);
 
     static int _add_symbol(const char *symname, uint64_t start, uint64_t size,
                            void *p);
+    static int _add_perf_map_symbol(const char *symname, uint64_t start,
+                                    uint64_t size, void *p);
     static int _add_symbol_lazy(size_t section_idx, size_t str_table_idx,
                                 size_t str_len, uint64_t start, uint64_t size,
                                 int debugfile, void *p);
   };
 
+  // One mapped range of a module, sorted by start address. max_end is the
+  // largest end address of this and all preceding entries, so that a lookup
+  // knows when it can stop walking backwards over overlapping ranges.
+  struct RangeEntry {
+    uint64_t start;
+    uint64_t end;
+    uint64_t max_end;
+    size_t module_idx;
+    size_t range_idx;
+
+    bool operator<(const RangeEntry &rhs) const { return start < rhs.start; }
+  };
+
   int pid_;
   std::vector<Module> modules_;
+  std::unordered_map<std::string, size_t> module_idx_;
+  std::vector<RangeEntry> range_index_;
+  std::vector<size_t> perf_map_idx_;
+  // Modules of the previous load_modules(), only valid during refresh()
+  std::unordered_map<std::string, Module> stale_modules_;
   ProcStat procstat_;
   bcc_symbol_option symbol_option_;
 
+  // Threads loading symbol tables ahead of lookups, see prefetch()
+  std::vector<std::thread> prefetch_threads_;
+  std::vector<Module *> prefetch_queue_;
+  std::atomic<size_t> prefetch_next_;
+  int prefetch_nthreads_;
+
   static int _add_load_sections(uint64_t v_addr, uint64_t mem_sz,
                                 uint64_t file_offset, void *payload);
   static int _add_module(mod_info *, int, void *);
+  Module *reuse_module(const std::string &name, const std::string &path,
+                       uint64_t dev_major, uint64_t dev_minor, uint64_t inode);
   void load_exe();
   void load_modules();
+  void build_range_index();
+  Module *find_module(uint64_t addr, uint64_t &offset);
+  void start_prefetch();
+  void stop_prefetch();
 
 public:
   ProcSyms(int pid, struct bcc_symbol_option *option = nullptr);
+  virtual ~ProcSyms();
+  // Load the symbol tables of all modules on nthreads background threads.
+  // A lookup only waits if the module it needs is still being loaded.
+  virtual void prefetch(int nthreads) override;
+  virtual bool find_module_file(uint64_t addr, ModuleFile *file) override;
   virtual void refresh() override;
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) override;
   virtual bool resolve_name(const char *module, const char *name,
@@ -192,6 +276,7 @@ class BuildSyms {
     bool loaded_;
     std::unordered_set<std::string> symnames_;
     std::vector<Symbol> syms_;
+    std::unique_ptr<SymbolIndex> sym_index_;
     bcc_symbol_option symbol_option_;
 
     bool load_sym_table();
@@ -39,6 +39,7 @@ bool TableStorage::Insert(const Path &path, TableDesc &&desc) {
 }
 bool TableStorage::Delete(const Path &path) { return impl_->Delete(path.to_string()); }
 size_t TableStorage::DeletePrefix(const Path &path) {
+  auto guard = lock();
   size_t i = 0;
   auto it = lower_bound(path);
   auto upper = upper_bound(path);
@@ -66,6 +67,9 @@ TableStorage::iterator TableStorage::lower_bound(const Path &p) {
 TableStorage::iterator TableStorage::upper_bound(const Path &p) {
   return impl_->upper_bound(p.to_string() + "\x7f");
 }
+std::unique_lock<std::recursive_mutex> TableStorage::lock() {
+  return std::unique_lock<std::recursive_mutex>(impl_->mutex());
+}
 
 /// TableStorage::iterator implementation
 TableStorage::iterator::iterator() {}
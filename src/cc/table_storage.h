@@ -20,6 +20,7 @@
 #include <iterator>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -103,6 +104,11 @@ class TableStorage {
   iterator lower_bound(const Path &p);
   iterator upper_bound(const Path &p);
 
+  /// Individual operations are safe to call from several threads. Iterating
+  /// over a range of tables that other threads may modify needs this lock
+  /// held for the duration of the loop.
+  std::unique_lock<std::recursive_mutex> lock();
+
  private:
   std::unique_ptr<TableStorageImpl> impl_;
   std::vector<std::unique_ptr<MapTypesVisitor>> visitors_;
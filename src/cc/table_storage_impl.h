@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "table_storage.h"
 
 namespace ebpf {
@@ -46,6 +48,12 @@ class TableStorageImpl {
   virtual std::unique_ptr<TableStorageIteratorImpl> lower_bound(const std::string &k) = 0;
   virtual std::unique_ptr<TableStorageIteratorImpl> upper_bound(const std::string &k) = 0;
   virtual std::unique_ptr<TableStorageIteratorImpl> erase(const TableStorageIteratorImpl &it) = 0;
+  // Storage shared between TableStorage instances must return a mutex shared
+  // by all of them.
+  virtual std::recursive_mutex &mutex() { return mutex_; }
+
+ private:
+  std::recursive_mutex mutex_;
 };
 
 }  // namespace ebpf
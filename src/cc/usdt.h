@@ -207,6 +207,8 @@ class Probe {
   std::string largest_arg_type(size_t arg_n);
 
   bool add_to_semaphore(int16_t val);
+  // Same, in process pid rather than the one the probe was created for
+  bool add_to_semaphore(int pid, int16_t val);
   bool resolve_global_address(uint64_t *global, const std::string &bin_path,
                               const uint64_t addr);
   bool lookup_semaphore_addr(uint64_t *address);
@@ -291,6 +293,15 @@ public:
                     const std::string &probe_name, const std::string &fn_name,
                     int16_t val);
 
+  struct ProbeSpec {
+    std::string provider;  // empty to match any provider
+    std::string name;
+    std::string fn_name;
+  };
+  // Enables all the probes or none, updating their semaphores with one write
+  // of the process memory for the ones sharing a page.
+  bool enable_probes(const std::vector<ProbeSpec> &specs);
+
   typedef void (*each_cb)(struct bcc_usdt *);
   void each(each_cb callback);
 
@@ -15,7 +15,10 @@
  */
 #include <algorithm>
 #include <cstring>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <tuple>
 #include <unordered_set>
 
 #include <fcntl.h>
@@ -32,6 +35,116 @@
 
 namespace USDT {
 
+namespace {
+
+struct Note {
+  uint64_t pc;
+  uint64_t base_addr;
+  uint64_t semaphore;
+  std::string provider;
+  std::string name;
+  std::string arg_fmt;
+};
+
+// The notes of a binary are cached by device, inode and modification time,
+// so that contexts for many processes running the same binaries parse each
+// one once. Binaries that cannot be parsed are cached as null.
+typedef std::tuple<dev_t, ino_t, time_t, long> NotesKey;
+std::mutex notes_mutex;
+std::map<NotesKey, std::shared_ptr<const std::vector<Note>>> notes_cache;
+
+void add_note(const char *, const struct bcc_elf_usdt *probe, void *p) {
+  auto notes = static_cast<std::vector<Note> *>(p);
+  notes->push_back({probe->pc, probe->base_addr, probe->semaphore,
+                    probe->provider, probe->name, probe->arg_fmt});
+}
+
+// Same as bcc_elf_foreach_usdt(), from the cached notes of path.
+int foreach_usdt_cached(const char *path, bcc_elf_probecb callback,
+                        void *payload) {
+  struct stat s;
+  if (stat(path, &s))
+    return -1;
+  NotesKey key(s.st_dev, s.st_ino, s.st_mtim.tv_sec, s.st_mtim.tv_nsec);
+
+  std::shared_ptr<const std::vector<Note>> notes;
+  {
+    std::lock_guard<std::mutex> guard(notes_mutex);
+    auto it = notes_cache.find(key);
+    if (it == notes_cache.end()) {
+      std::shared_ptr<std::vector<Note>> parsed(new std::vector<Note>());
+      if (bcc_elf_foreach_usdt(path, add_note, parsed.get()) < 0)
+        parsed.reset();
+      it = notes_cache.emplace(key, std::move(parsed)).first;
+    }
+    notes = it->second;
+  }
+  if (!notes)
+    return -1;
+
+  for (auto &note : *notes) {
+    struct bcc_elf_usdt probe = {note.pc, note.base_addr, note.semaphore,
+                                 note.provider.c_str(), note.name.c_str(),
+                                 note.arg_fmt.c_str()};
+    callback(path, &probe, payload);
+  }
+  return 0;
+}
+
+// Adds each delta to the 16 bit semaphore at its address in the memory of
+// pid. Semaphores right next to each other are read and written back at
+// once, nothing in between them is ever written. Either all semaphores are
+// updated or, as far as the memory can still be written, none of them.
+bool update_semaphores(int pid,
+                       std::vector<std::pair<uint64_t, int16_t>> updates) {
+  std::string procmem = tfm::format("/proc/%d/mem", pid);
+  int memfd = ::open(procmem.c_str(), O_RDWR);
+  if (memfd < 0)
+    return false;
+
+  std::sort(updates.begin(), updates.end());
+  std::vector<std::pair<size_t, size_t>> runs;
+  for (size_t begin = 0, end; begin < updates.size(); begin = end) {
+    for (end = begin + 1; end < updates.size(); end++) {
+      if (updates[end].first > updates[end - 1].first + sizeof(int16_t))
+        break;
+    }
+    runs.emplace_back(begin, end);
+  }
+
+  auto update_run = [&](const std::pair<size_t, size_t> &run, int sign) {
+    uint64_t start = updates[run.first].first;
+    size_t len = updates[run.second - 1].first + sizeof(int16_t) - start;
+    std::vector<char> buf(len);
+    if (::pread(memfd, buf.data(), len, start) != static_cast<ssize_t>(len))
+      return false;
+    for (size_t i = run.first; i < run.second; i++) {
+      int16_t value;
+      memcpy(&value, &buf[updates[i].first - start], sizeof(value));
+      value += sign * updates[i].second;
+      memcpy(&buf[updates[i].first - start], &value, sizeof(value));
+    }
+    return ::pwrite(memfd, buf.data(), len, start) ==
+           static_cast<ssize_t>(len);
+  };
+
+  size_t done = 0;
+  while (done < runs.size() && update_run(runs[done], 1))
+    done++;
+  bool ok = done == runs.size();
+  // Undo the runs already written, the caller takes the failure as nothing
+  // having changed
+  if (!ok) {
+    for (size_t i = 0; i < done; i++)
+      update_run(runs[i], -1);
+  }
+
+  ::close(memfd);
+  return ok;
+}
+
+}  // namespace
+
 Location::Location(uint64_t addr, const std::string &bin_path, const char *arg_fmt)
     : address_(addr),
       bin_path_(bin_path) {
@@ -82,9 +195,7 @@ bool Probe::resolve_global_address(uint64_t *global, const std::string &bin_path
   return true;
 }
 
-bool Probe::add_to_semaphore(int16_t val) {
-  assert(pid_);
-
+bool Probe::lookup_semaphore_addr(uint64_t *address) {
   if (!attached_semaphore_) {
     uint64_t addr;
     if (!resolve_global_address(&addr, bin_path_, semaphore_))
@@ -92,31 +203,26 @@ bool Probe::add_to_semaphore(int16_t val) {
     attached_semaphore_ = addr;
   }
 
-  off_t address = static_cast<off_t>(attached_semaphore_.value());
-
-  std::string procmem = tfm::format("/proc/%d/mem", pid_.value());
-  int memfd = ::open(procmem.c_str(), O_RDWR);
-  if (memfd < 0)
-    return false;
+  *address = attached_semaphore_.value();
+  return true;
+}
 
-  int16_t original;
+bool Probe::add_to_semaphore(int16_t val) {
+  assert(pid_);
 
-  if (::lseek(memfd, address, SEEK_SET) < 0 ||
-      ::read(memfd, &original, 2) != 2) {
-    ::close(memfd);
+  uint64_t address;
+  if (!lookup_semaphore_addr(&address))
     return false;
-  }
-
-  original = original + val;
+  return update_semaphores(pid_.value(), {{address, val}});
+}
 
-  if (::lseek(memfd, address, SEEK_SET) < 0 ||
-      ::write(memfd, &original, 2) != 2) {
-    ::close(memfd);
+bool Probe::add_to_semaphore(int pid, int16_t val) {
+  uint64_t address = semaphore_;
+  if (in_shared_object(bin_path_) &&
+      bcc_resolve_global_addr(pid, bin_path_.c_str(), semaphore_,
+                              mod_match_inode_only_, &address))
     return false;
-  }
-
-  ::close(memfd);
-  return true;
+  return update_semaphores(pid, {{address, val}});
 }
 
 bool Probe::enable(const std::string &fn_name) {
@@ -248,7 +354,7 @@ int Context::_each_module(mod_info *mod, int enter_ns, void *p) {
   // executable region. We are going to parse the ELF on disk anyway, so we
   // don't need these duplicates.
   if (ctx->modules_.insert(path).second /*inserted new?*/) {
-    bcc_elf_foreach_usdt(path.c_str(), _each_probe, p);
+    foreach_usdt_cached(path.c_str(), _each_probe, p);
   }
   return 0;
 }
@@ -340,6 +446,31 @@ bool Context::enable_probe(const std::string &provider_name,
   return false;
 }
 
+bool Context::enable_probes(const std::vector<ProbeSpec> &specs) {
+  std::vector<Probe *> found;
+  std::vector<std::pair<uint64_t, int16_t>> updates;
+  for (auto &spec : specs) {
+    Probe *probe = get_checked(spec.provider, spec.name);
+    if (probe == nullptr || probe->enabled() ||
+        std::find(found.begin(), found.end(), probe) != found.end())
+      return false;
+    found.push_back(probe);
+
+    if (probe->need_enable()) {
+      uint64_t address;
+      if (!pid_ || !probe->lookup_semaphore_addr(&address))
+        return false;
+      updates.emplace_back(address, 1);
+    }
+  }
+
+  if (!updates.empty() && !update_semaphores(pid_.value(), updates))
+    return false;
+  for (size_t i = 0; i < found.size(); i++)
+    found[i]->attached_to_ = specs[i].fn_name;
+  return true;
+}
+
 void Context::each(each_cb callback) {
   for (const auto &probe : probes_) {
     struct bcc_usdt info = {0};
@@ -385,7 +516,7 @@ Context::Context(const std::string &bin_path, uint8_t mod_match_inode_only)
     : loaded_(false), mod_match_inode_only_(mod_match_inode_only) {
   std::string full_path = resolve_bin_path(bin_path);
   if (!full_path.empty()) {
-    if (bcc_elf_foreach_usdt(full_path.c_str(), _each_probe, this) == 0) {
+    if (foreach_usdt_cached(full_path.c_str(), _each_probe, this) == 0) {
       cmd_bin_path_ = full_path;
       loaded_ = true;
     }
@@ -414,7 +545,7 @@ Context::Context(int pid, const std::string &bin_path,
       mod_match_inode_only_(mod_match_inode_only) {
   std::string full_path = resolve_bin_path(bin_path);
   if (!full_path.empty()) {
-    int res = bcc_elf_foreach_usdt(full_path.c_str(), _each_probe, this);
+    int res = foreach_usdt_cached(full_path.c_str(), _each_probe, this);
     if (res == 0) {
       cmd_bin_path_ = ebpf::get_pid_exe(pid);
       if (cmd_bin_path_.empty())
@@ -480,6 +611,18 @@ int bcc_usdt_enable_probe(void *usdt, const char *probe_name,
   return ctx->enable_probe(probe_name, fn_name) ? 0 : -1;
 }
 
+int bcc_usdt_enable_probes(void *usdt, const char **provider_names,
+                           const char **probe_names, const char **fn_names,
+                           int len) {
+  USDT::Context *ctx = static_cast<USDT::Context *>(usdt);
+  std::vector<USDT::Context::ProbeSpec> specs;
+  for (int i = 0; i < len; i++) {
+    specs.push_back({provider_names && provider_names[i] ? provider_names[i] : "",
+                     probe_names[i], fn_names[i]});
+  }
+  return ctx->enable_probes(specs) ? 0 : -1;
+}
+
 int bcc_usdt_addsem_probe(void *usdt, const char *probe_name,
                           const char *fn_name, int16_t val) {
   USDT::Context *ctx = static_cast<USDT::Context *>(usdt);
@@ -23,7 +23,9 @@ import struct
 import errno
 import sys
 
-from .libbcc import lib, bcc_symbol, bcc_symbol_option, bcc_stacktrace_build_id, _SYM_CB_TYPE
+from .libbcc import lib, bcc_symbol, bcc_symbol_line, bcc_symbol_option, bcc_stacktrace_build_id, _SYM_CB_TYPE, \
+    bcc_phase_stat, bcc_probe_target, _KALLSYMS_CB_TYPE, BCC_KALLSYMS_REGEX, \
+    BCC_KALLSYMS_KPROBES
 from .table import Table, PerfEventArray, RingBuf
 from .perf import Perf
 from .utils import get_online_cpus, printb, _assert_is_bytes, ArgString, StrcmpRewrite
@@ -59,6 +61,14 @@ DEBUG_SOURCE = 0x8
 DEBUG_BPF_REGISTER_STATE = 0x10
 # Debug BTF.
 DEBUG_BTF = 0x20
+# Record the time and memory taken by each phase of compiling and loading
+# the program, see BPF.profile().
+DEBUG_PROFILE = 0x40
+
+# Compile options, passed along with the debug flags
+
+# Optimize with a pipeline tuned for BPF instead of the generic -O3 one.
+OPT_BPF_PIPELINE = 0x1000
 
 class SymbolCache(object):
     def __init__(self, pid):
@@ -94,6 +104,27 @@ class SymbolCache(object):
             name_res = sym.name
         return (name_res, sym.offset, ct.cast(sym.module, ct.c_char_p).value)
 
+    def resolve_lines(self, addr, max_frames=32):
+        """
+        Return a list of (function, file, line, column) tuples for the
+        source location of addr, starting with the innermost function
+        inlined at it. The list is empty if there is no debug information.
+        """
+        frames = (bcc_symbol_line * max_frames)()
+        n = lib.bcc_symcache_resolve_lines(self.cache, addr, frames,
+                                           max_frames)
+        if n < 0:
+            return []
+        return [(f.function, f.file, f.line, f.column) for f in frames[:n]]
+
+    def prefetch(self, nthreads):
+        """
+        Load the symbol tables of all modules of the process on nthreads
+        background threads, so that resolving the first stacks does not
+        have to load them one by one.
+        """
+        lib.bcc_symcache_prefetch(self.cache, nthreads)
+
     def resolve_name(self, module, name):
         module = _assert_is_bytes(module)
         name = _assert_is_bytes(name)
@@ -173,6 +204,8 @@ class BPF(object):
     _probe_repl = re.compile(b"[^a-zA-Z0-9_]")
     _sym_caches = {}
     _bsymcache =  lib.bcc_buildsymcache_new()
+    _kallsyms_index = None
+    _kallsyms_modules = None
 
     _auto_includes = {
         "linux/time.h": ["time"],
@@ -284,7 +317,8 @@ class BPF(object):
         return None
 
     def __init__(self, src_file=b"", hdr_file=b"", text=None, debug=0,
-            cflags=[], usdt_contexts=[], allow_rlimit=True, device=None):
+            cflags=[], usdt_contexts=[], allow_rlimit=True, device=None,
+            bpf_pipeline=False):
         """Create a new BPF module with the given source code.
 
         Note:
@@ -297,6 +331,8 @@ class BPF(object):
             text (Optional[str]): Contents of a source file for the module
             debug (Optional[int]): Flags used for debug prints, can be |'d together
                                    See "Debug flags" for explanation
+            bpf_pipeline (Optional[bool]): Optimize with the faster pipeline
+                                   tuned for BPF, see OPT_BPF_PIPELINE
         """
 
         src_file = _assert_is_bytes(src_file)
@@ -306,6 +342,7 @@ class BPF(object):
         assert not (text and src_file)
 
         self.kprobe_fds = {}
+        self.trampoline_fds = {}
         self.uprobe_fds = {}
         self.tracepoint_fds = {}
         self.raw_tracepoint_fds = {}
@@ -320,8 +357,10 @@ class BPF(object):
 
         self.debug = debug
         self.funcs = {}
+        self._stats = None
         self.tables = {}
         self.module = None
+        flags = self.debug | (OPT_BPF_PIPELINE if bpf_pipeline else 0)
         cflags_array = (ct.c_char_p * len(cflags))()
         for i, s in enumerate(cflags): cflags_array[i] = bytes(ArgString(s))
 
@@ -331,7 +370,7 @@ class BPF(object):
 
         # files that end in ".b" are treated as B files. Everything else is a (BPF-)C file
         if src_file.endswith(b".b"):
-            self.module = lib.bpf_module_create_b(src_file, hdr_file, self.debug, device)
+            self.module = lib.bpf_module_create_b(src_file, hdr_file, flags, device)
         else:
             if src_file:
                 # Read the BPF C source file into the text variable. This ensures,
@@ -352,7 +391,7 @@ class BPF(object):
 
 
             self.module = lib.bpf_module_create_c_from_string(text,
-                                                              self.debug,
+                                                              flags,
                                                               cflags_array, len(cflags_array),
                                                               allow_rlimit, device)
         if not self.module:
@@ -513,6 +552,18 @@ class BPF(object):
             leaftype = BPF._decode_table_type(json.loads(leaf_desc))
         return Table(self, map_id, map_fd, keytype, leaftype, name, reducer=reducer)
 
+    def set_param(self, name, value):
+        """set_param(name, value)
+
+        Sets a parameter declared with BPF_PARAM in the program. The program
+        starts out with the default given in its declaration, this changes
+        the value it reads from then on, without compiling it again.
+        """
+        table = self[name]
+        if not isinstance(value, table.Leaf):
+            value = table.Leaf(value)
+        table[table.Key(0)] = value
+
     def __getitem__(self, key):
         if key not in self.tables:
             self.tables[key] = self.get_table(key)
@@ -547,60 +598,69 @@ class BPF(object):
         fn.sock = sock
 
     @staticmethod
-    def get_kprobe_functions(event_re):
-        blacklist_file = "%s/../kprobes/blacklist" % TRACEFS
+    def _kernel_modules():
+        # The name and address of each loaded module, which tell when the
+        # functions in /proc/kallsyms may have changed
         try:
-            with open(blacklist_file, "rb") as blacklist_f:
-                blacklist = set([line.rstrip().split()[1] for line in blacklist_f])
-        except IOError as e:
-            if e.errno != errno.EPERM:
-                raise e
-            blacklist = set([])
+            with open("/proc/modules", "rb") as f:
+                return [(line.split()[0], line.split()[-1]) for line in f]
+        except IOError:
+            return None
 
-        fns = []
+    @staticmethod
+    def _kallsyms():
+        # A reference to the native kallsyms index, shared with the kernel
+        # symcache. It is read again once modules were loaded or unloaded.
+        modules = BPF._kernel_modules()
+        if BPF._kallsyms_index and modules != BPF._kallsyms_modules:
+            lib.bcc_kallsyms_put(BPF._kallsyms_index)
+            BPF._kallsyms_index = None
+            lib.bcc_kallsyms_invalidate()
+        if not BPF._kallsyms_index:
+            BPF._kallsyms_index = lib.bcc_kallsyms_get()
+            if not BPF._kallsyms_index:
+                raise Exception("Failed to read /proc/kallsyms")
+            BPF._kallsyms_modules = modules
+        return BPF._kallsyms_index
 
-        in_init_section = 0
-        in_irq_section = 0
-        with open("/proc/kallsyms", "rb") as avail_file:
-            for line in avail_file:
-                (t, fn) = line.rstrip().split()[1:3]
-                # Skip all functions defined between __init_begin and
-                # __init_end
-                if in_init_section == 0:
-                    if fn == b'__init_begin':
-                        in_init_section = 1
-                        continue
-                elif in_init_section == 1:
-                    if fn == b'__init_end':
-                        in_init_section = 2
-                    continue
-                # Skip all functions defined between __irqentry_text_start and
-                # __irqentry_text_end
-                if in_irq_section == 0:
-                    if fn == b'__irqentry_text_start':
-                        in_irq_section = 1
-                        continue
-                elif in_irq_section == 1:
-                    if fn == b'__irqentry_text_end':
-                        in_irq_section = 2
-                    continue
-                # All functions defined as NOKPROBE_SYMBOL() start with the
-                # prefix _kbl_addr_*, blacklisting them by looking at the name
-                # allows to catch also those symbols that are defined in kernel
-                # modules.
-                if fn.startswith(b'_kbl_addr_'):
-                    continue
-                # Explicitly blacklist perf-related functions, they are all
-                # non-attachable.
-                elif fn.startswith(b'__perf') or fn.startswith(b'perf_'):
-                    continue
-                # Exclude all gcc 8's extra .cold functions
-                elif re.match(b'^.*\.cold(\.\d+)?$', fn):
-                    continue
-                if (t.lower() in [b't', b'w']) and re.match(event_re, fn) \
-                    and fn not in blacklist:
-                    fns.append(fn)
-        return set(fns)     # Some functions may appear more than once
+    @staticmethod
+    def get_kernel_symbols(pattern=None, regex=False, kprobes_only=False):
+        """get_kernel_symbols(pattern=None, regex=False, kprobes_only=False)
+
+        Return the (name, module, address) of the kernel function symbols
+        whose name matches pattern, a shell glob, or a POSIX extended regular
+        expression if regex is set. All symbols are returned if pattern is
+        None. With kprobes_only, the symbols kprobes cannot be attached to are
+        left out, as in get_kprobe_functions().
+        """
+        if pattern is not None:
+            pattern = _assert_is_bytes(pattern)
+        flags = BCC_KALLSYMS_REGEX if regex else 0
+        if kprobes_only:
+            flags |= BCC_KALLSYMS_KPROBES
+        syms = []
+        def sym_cb(name, module, addr, payload):
+            syms.append((name, module, addr))
+            return 0
+        res = lib.bcc_kallsyms_foreach(BPF._kallsyms(), pattern, flags,
+                                       _KALLSYMS_CB_TYPE(sym_cb), None)
+        if res < 0:
+            raise Exception("Invalid pattern %s" % pattern)
+        return syms
+
+    @staticmethod
+    def get_kprobe_functions(event_re):
+        # kallsyms is read, and the functions which cannot be kprobed left out,
+        # once per process by the native index. Only the regex is matched here,
+        # as the Python re syntax is not that of regcomp().
+        fns = set()     # Some functions may appear more than once
+        def sym_cb(name, module, addr, payload):
+            if re.match(event_re, name):
+                fns.add(name)
+            return 0
+        lib.bcc_kallsyms_foreach(BPF._kallsyms(), None, BCC_KALLSYMS_KPROBES,
+                                 _KALLSYMS_CB_TYPE(sym_cb), None)
+        return fns
 
     def _check_probe_quota(self, num_new_probes):
         global _num_open_probes
@@ -627,6 +687,65 @@ class BPF(object):
         del self.uprobe_fds[name]
         _num_open_probes -= 1
 
+    def _attach_probes(self, fn_name, attach_type, targets, is_kprobe,
+                       pid=-1, maxactive=0):
+        """Attach fn_name to each (ev_name, name, offset) of targets at once,
+        skipping the ones already attached. Returns the number of probes that
+        failed to attach."""
+        fds = self.kprobe_fds if is_kprobe else self.uprobe_fds
+        new_targets = {}
+        for t in targets:
+            if t[0] not in fds and t[0] not in new_targets:
+                new_targets[t[0]] = t
+        targets = list(new_targets.values())
+        if not targets:
+            return 0
+        self._check_probe_quota(len(targets))
+        fn = self.load_func(fn_name, BPF.KPROBE)
+        arr = (bcc_probe_target * len(targets))()
+        for i, (ev_name, name, offset) in enumerate(targets):
+            arr[i].progfd = fn.fd
+            arr[i].attach_type = attach_type
+            arr[i].ev_name = ev_name
+            arr[i].name = name
+            arr[i].offset = offset
+            arr[i].pid = pid
+            arr[i].maxactive = maxactive
+        if is_kprobe:
+            lib.bpf_attach_kprobes(arr, len(targets), 0)
+        else:
+            lib.bpf_attach_uprobes(arr, len(targets), 0)
+        failed = 0
+        for t in arr:
+            if t.pfd < 0:
+                failed += 1
+            elif is_kprobe:
+                self._add_kprobe_fd(t.ev_name, t.pfd)
+            else:
+                self._add_uprobe_fd(t.ev_name, t.pfd)
+        return failed
+
+    def _detach_probes(self, ev_names, is_kprobe):
+        """Detach the probes named ev_names at once, returns the number of
+        them that failed."""
+        fds = self.kprobe_fds if is_kprobe else self.uprobe_fds
+        if not ev_names:
+            return 0
+        arr = (bcc_probe_target * len(ev_names))()
+        for i, ev_name in enumerate(ev_names):
+            arr[i].ev_name = ev_name
+            arr[i].pfd = fds[ev_name]
+        if is_kprobe:
+            failed = lib.bpf_detach_kprobes(arr, len(ev_names), 0)
+        else:
+            failed = lib.bpf_detach_uprobes(arr, len(ev_names), 0)
+        for ev_name in ev_names:
+            if is_kprobe:
+                self._del_kprobe_fd(ev_name)
+            else:
+                self._del_uprobe_fd(ev_name)
+        return failed
+
     # Find current system's syscall prefix by testing on the BPF syscall.
     # If no valid value found, will return the first possible value which
     # would probably lead to error in later API calls.
@@ -653,25 +772,74 @@ class BPF(object):
                 return self.get_syscall_fnname(name[len(prefix):])
         return name
 
-    def attach_kprobe(self, event=b"", event_off=0, fn_name=b"", event_re=b""):
+    def _attach_trampoline(self, event, fn_name, ev_name, is_return):
+        """Attach the fentry (fexit) variant generated for fn_name by
+        KPROBE_FENTRY (KRETPROBE_FEXIT) to event, in place of the kprobe.
+        Returns False if there is no such variant or it cannot be attached,
+        the caller then falls back to the kprobe."""
+        func_name = fn_name + (b"__fexit" if is_return else b"__fentry")
+        if not lib.bpf_function_start(self.module, func_name):
+            return False
+        if not BPF.support_kfunc():
+            return False
+        log_level = 0
+        if (self.debug & DEBUG_BPF_REGISTER_STATE):
+            log_level = 2
+        elif (self.debug & DEBUG_BPF):
+            log_level = 1
+        # The traced function is fixed at load time, so each one needs its
+        # own program
+        prog_fd = lib.bcc_func_load_trampoline(self.module, func_name, event,
+                BPF.TRACE_FEXIT if is_return else BPF.TRACE_FENTRY,
+                lib.bpf_function_start(self.module, func_name),
+                lib.bpf_function_size(self.module, func_name),
+                lib.bpf_module_license(self.module),
+                lib.bpf_module_kern_version(self.module),
+                log_level, None, 0)
+        if prog_fd < 0:
+            return False
+        link_fd = lib.bpf_attach_kfunc(prog_fd)
+        if link_fd < 0:
+            os.close(prog_fd)
+            return False
+        global _num_open_probes
+        # Named like the C++ API names the program
+        self.trampoline_fds[ev_name] = (prog_fd, link_fd,
+                                        func_name + b"__" + event)
+        _num_open_probes += 1
+        return True
+
+    def _detach_trampoline(self, ev_name):
+        global _num_open_probes
+        prog_fd, link_fd, _ = self.trampoline_fds.pop(ev_name)
+        os.close(link_fd)
+        os.close(prog_fd)
+        _num_open_probes -= 1
+
+    def attach_kprobe(self, event=b"", event_off=0, fn_name=b"", event_re=b"",
+                      fentry=True):
         event = _assert_is_bytes(event)
         fn_name = _assert_is_bytes(fn_name)
         event_re = _assert_is_bytes(event_re)
 
-        # allow the caller to glob multiple functions together
+        # allow the caller to glob multiple functions together, attaching
+        # them all in one go
         if event_re:
             matches = BPF.get_kprobe_functions(event_re)
             self._check_probe_quota(len(matches))
-            for line in matches:
-                try:
-                    self.attach_kprobe(event=line, fn_name=fn_name)
-                except:
-                    pass
+            self._attach_probes(fn_name, 0,
+                    [(b"p_" + line.replace(b"+", b"_").replace(b".", b"_"),
+                      line, 0) for line in matches], True)
             return
 
         self._check_probe_quota(1)
-        fn = self.load_func(fn_name, BPF.KPROBE)
         ev_name = b"p_" + event.replace(b"+", b"_").replace(b".", b"_")
+        if ev_name in self.trampoline_fds:
+            raise Exception("%s is already attached" % event)
+        if fentry and event_off == 0 and \
+                self._attach_trampoline(event, fn_name, ev_name, False):
+            return self
+        fn = self.load_func(fn_name, BPF.KPROBE)
         fd = lib.bpf_attach_kprobe(fn.fd, 0, ev_name, event, event_off, 0)
         if fd < 0:
             raise Exception("Failed to attach BPF program %s to kprobe %s" %
@@ -679,24 +847,27 @@ class BPF(object):
         self._add_kprobe_fd(ev_name, fd)
         return self
 
-    def attach_kretprobe(self, event=b"", fn_name=b"", event_re=b"", maxactive=0):
+    def attach_kretprobe(self, event=b"", fn_name=b"", event_re=b"", maxactive=0,
+                         fentry=True):
         event = _assert_is_bytes(event)
         fn_name = _assert_is_bytes(fn_name)
         event_re = _assert_is_bytes(event_re)
 
         # allow the caller to glob multiple functions together
         if event_re:
-            for line in BPF.get_kprobe_functions(event_re):
-                try:
-                    self.attach_kretprobe(event=line, fn_name=fn_name,
-                                          maxactive=maxactive)
-                except:
-                    pass
+            self._attach_probes(fn_name, 1,
+                    [(b"r_" + line.replace(b"+", b"_").replace(b".", b"_"),
+                      line, 0) for line in BPF.get_kprobe_functions(event_re)],
+                    True, maxactive=maxactive)
             return
 
         self._check_probe_quota(1)
-        fn = self.load_func(fn_name, BPF.KPROBE)
         ev_name = b"r_" + event.replace(b"+", b"_").replace(b".", b"_")
+        if ev_name in self.trampoline_fds:
+            raise Exception("%s is already attached" % event)
+        if fentry and self._attach_trampoline(event, fn_name, ev_name, True):
+            return self
+        fn = self.load_func(fn_name, BPF.KPROBE)
         fd = lib.bpf_attach_kprobe(fn.fd, 1, ev_name, event, 0, maxactive)
         if fd < 0:
             raise Exception("Failed to attach BPF program %s to kretprobe %s" %
@@ -705,6 +876,9 @@ class BPF(object):
         return self
 
     def detach_kprobe_event(self, ev_name):
+        if ev_name in self.trampoline_fds:
+            self._detach_trampoline(ev_name)
+            return
         if ev_name not in self.kprobe_fds:
             raise Exception("Kprobe %s is not attached" % ev_name)
         res = lib.bpf_close_perf_event_fd(self.kprobe_fds[ev_name])
@@ -1086,6 +1260,19 @@ class BPF(object):
             # can have different event names
             return b"%s_%s_0x%x_%d" % (prefix, self._probe_repl.sub(b"_", path), addr, pid)
 
+    def _attach_uprobe_addresses(self, prefix, attach_type, name, addresses,
+                                 fn_name, pid):
+        targets = []
+        for sym_addr in addresses:
+            (path, addr) = BPF._check_path_symbol(name, b"", sym_addr, pid)
+            targets.append((self._get_uprobe_evname(prefix, path, addr, pid),
+                            path, addr))
+        failed = self._attach_probes(fn_name, attach_type, targets, False,
+                                     pid=pid)
+        if failed:
+            raise Exception("Failed to attach BPF to %d of %d uprobes" %
+                            (failed, len(targets)))
+
     def attach_uprobe(self, name=b"", sym=b"", sym_re=b"", addr=None,
             fn_name=b"", pid=-1, sym_off=0):
         """attach_uprobe(name="", sym="", sym_re="", addr=None, fn_name=""
@@ -1127,9 +1314,8 @@ class BPF(object):
         if sym_re:
             addresses = BPF.get_user_addresses(name, sym_re)
             self._check_probe_quota(len(addresses))
-            for sym_addr in addresses:
-                self.attach_uprobe(name=name, addr=sym_addr,
-                                   fn_name=fn_name, pid=pid)
+            self._attach_uprobe_addresses(b"p", 0, name, addresses, fn_name,
+                                          pid)
             return
 
         (path, addr) = BPF._check_path_symbol(name, sym, addr, pid, sym_off)
@@ -1159,9 +1345,8 @@ class BPF(object):
         fn_name = _assert_is_bytes(fn_name)
 
         if sym_re:
-            for sym_addr in BPF.get_user_addresses(name, sym_re):
-                self.attach_uretprobe(name=name, addr=sym_addr,
-                                      fn_name=fn_name, pid=pid)
+            self._attach_uprobe_addresses(b"r", 1, name,
+                    BPF.get_user_addresses(name, sym_re), fn_name, pid)
             return
 
         (path, addr) = BPF._check_path_symbol(name, sym, addr, pid)
@@ -1216,6 +1401,11 @@ class BPF(object):
     def _trace_autoload(self):
         for i in range(0, lib.bpf_num_functions(self.module)):
             func_name = lib.bpf_function_name(self.module, i)
+            # Variants of KPROBE_FENTRY/KRETPROBE_FEXIT probes, attached
+            # along with the probe itself
+            if func_name.endswith(b"__fentry") or \
+                    func_name.endswith(b"__fexit"):
+                continue
             if func_name.startswith(b"kprobe__"):
                 fn = self.load_func(func_name, BPF.KPROBE)
                 self.attach_kprobe(
@@ -1380,6 +1570,18 @@ class BPF(object):
             if show_module and module is not None else b""
         return name + module
 
+    @staticmethod
+    def sym_lines(addr, pid):
+        """sym_lines(addr, pid)
+
+        Translate a memory address of a pid into a list of
+        (function, file, line, column) tuples using the DWARF debug
+        information of its module, starting with the innermost function
+        inlined at the address. Returns an empty list when there is no
+        debug information.
+        """
+        return BPF._sym_cache(pid).resolve_lines(addr)
+
     @staticmethod
     def ksym(addr, show_module=False, show_offset=False):
         """ksym(addr)
@@ -1408,7 +1610,7 @@ class BPF(object):
         Get the number of open K[ret]probes. Can be useful for scenarios where
         event_re is used while attaching and detaching probes.
         """
-        return len(self.kprobe_fds)
+        return len(self.kprobe_fds) + len(self.trampoline_fds)
 
     def num_open_uprobes(self):
         """num_open_uprobes()
@@ -1477,6 +1679,92 @@ class BPF(object):
     def free_bcc_memory(self):
         return lib.bcc_free_memory()
 
+    def profile(self):
+        """profile()
+
+        Returns the phases of compiling and loading the program, in the order
+        they finished. Each has a name, wall_ms, cpu_ms, max_rss_kb and
+        max_rss_growth_kb. Empty unless the BPF object was created with
+        debug=DEBUG_PROFILE.
+        """
+        phases = []
+        for i in range(lib.bpf_module_num_phases(self.module)):
+            stat = bcc_phase_stat()
+            if lib.bpf_module_phase_stat(self.module, i, ct.byref(stat)) == 0:
+                phases.append(stat)
+        return phases
+
+    def print_profile(self):
+        """print_profile()
+
+        Prints the phases returned by profile(), one per line.
+        """
+        print("%-24s %10s %10s %12s %12s" % ("PHASE", "WALL(ms)", "CPU(ms)",
+                                            "MAXRSS(kB)", "GROWTH(kB)"))
+        for stat in self.profile():
+            print("%-24s %10.3f %10.3f %12d %12d" % (stat.name.decode(),
+                  stat.wall_ms, stat.cpu_ms, stat.max_rss_kb,
+                  stat.max_rss_growth_kb))
+
+    def enable_stats(self):
+        """enable_stats()
+
+        Turns on the accounting of the runs and run time of all BPF programs
+        in the system until cleanup(). Kernels before 5.8 only have the
+        kernel.bpf_stats_enabled sysctl, which cleanup() sets back to its
+        previous value. It costs two clock reads per run.
+        """
+        if self._stats is not None:
+            return
+        fd = ct.c_int(-1)
+        sysctl = ct.c_int(0)
+        if lib.bcc_enable_stats(ct.byref(fd), ct.byref(sysctl)) < 0:
+            errstr = os.strerror(ct.get_errno())
+            raise Exception("Failed to enable BPF stats: %s" % errstr)
+        self._stats = (fd.value, sysctl.value)
+
+    def prog_stats(self):
+        """prog_stats()
+
+        Returns a dict of (run_cnt, run_time_ns) by loaded function name,
+        counted since the function was loaded. Functions attached through
+        BPF trampolines are loaded once per traced kernel function, as
+        func__fentry__event or func__fexit__event.
+        """
+        progs = [(name, fn.fd) for name, fn in self.funcs.items()]
+        progs += [(name, prog_fd) for prog_fd, _, name in
+                  self.trampoline_fds.values()]
+        stats = {}
+        for name, fd in progs:
+            run_cnt = ct.c_ulonglong()
+            run_time_ns = ct.c_ulonglong()
+            if lib.bcc_prog_stats(fd, ct.byref(run_cnt),
+                                  ct.byref(run_time_ns)) == 0:
+                stats[name] = (run_cnt.value, run_time_ns.value)
+        return stats
+
+    def print_prog_stats(self, since=None):
+        """print_prog_stats(since=None)
+
+        Prints the loaded functions sorted by run time, most expensive first,
+        with their runs, time and time per run. Given an earlier prog_stats(),
+        only what ran since is counted, so printing at an interval gives a
+        top-like view.
+        """
+        rows = []
+        for name, (run_cnt, run_time_ns) in self.prog_stats().items():
+            prev = since.get(name) if since else None
+            # A function unloaded and loaded again starts from 0
+            if prev and prev[0] <= run_cnt:
+                run_cnt -= prev[0]
+                run_time_ns -= prev[1]
+            rows.append((name, run_cnt, run_time_ns))
+        rows.sort(key=lambda row: row[2], reverse=True)
+        print("%-32s %12s %12s %10s" % ("FUNC", "RUNS", "TIME(ms)", "NS/RUN"))
+        for name, run_cnt, run_time_ns in rows:
+            print("%-32s %12d %12.3f %10.1f" % (name.decode(), run_cnt,
+                  run_time_ns / 1e6, run_time_ns / run_cnt if run_cnt else 0.))
+
     @staticmethod
     def add_module(modname):
       """add_module(modname)
@@ -1493,10 +1781,10 @@ class BPF(object):
 
     def cleanup(self):
         # Clean up opened probes
-        for k, v in list(self.kprobe_fds.items()):
-            self.detach_kprobe_event(k)
-        for k, v in list(self.uprobe_fds.items()):
-            self.detach_uprobe_event(k)
+        failed = self._detach_probes(list(self.kprobe_fds.keys()), True)
+        for ev_name in list(self.trampoline_fds.keys()):
+            self._detach_trampoline(ev_name)
+        failed += self._detach_probes(list(self.uprobe_fds.keys()), False)
         for k, v in list(self.tracepoint_fds.items()):
             self.detach_tracepoint(k)
         for k, v in list(self.raw_tracepoint_fds.items()):
@@ -1521,6 +1809,9 @@ class BPF(object):
         for name, fn in list(self.funcs.items()):
             os.close(fn.fd)
             del self.funcs[name]
+        if self._stats is not None:
+            lib.bcc_disable_stats(*self._stats)
+            self._stats = None
         if self.module:
             lib.bpf_module_destroy(self.module)
             self.module = None
@@ -1530,6 +1821,9 @@ class BPF(object):
             lib.bpf_free_ringbuf(self._ringbuf_manager)
             self._ringbuf_manager = None
 
+        if failed:
+            raise Exception("Failed to detach BPF from %d probes" % failed)
+
     def __enter__(self):
         return self
 
@@ -71,6 +71,21 @@ lib.bpf_perf_event_fields.argtypes = [ct.c_void_p, ct.c_char_p]
 lib.bpf_perf_event_field.restype = ct.c_char_p
 lib.bpf_perf_event_field.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_ulonglong]
 
+class bcc_phase_stat(ct.Structure):
+    _fields_ = [
+            ('name', ct.c_char * 64),
+            ('wall_ms', ct.c_double),
+            ('cpu_ms', ct.c_double),
+            ('max_rss_kb', ct.c_long),
+            ('max_rss_growth_kb', ct.c_long),
+        ]
+
+lib.bpf_module_num_phases.restype = ct.c_ulonglong
+lib.bpf_module_num_phases.argtypes = [ct.c_void_p]
+lib.bpf_module_phase_stat.restype = ct.c_int
+lib.bpf_module_phase_stat.argtypes = [ct.c_void_p, ct.c_ulonglong,
+        ct.POINTER(bcc_phase_stat)]
+
 # keep in sync with libbpf.h
 lib.bpf_get_next_key.restype = ct.c_int
 lib.bpf_get_next_key.argtypes = [ct.c_int, ct.c_void_p, ct.c_void_p]
@@ -90,6 +105,10 @@ lib.bpf_attach_socket.argtypes = [ct.c_int, ct.c_int]
 lib.bcc_func_load.restype = ct.c_int
 lib.bcc_func_load.argtypes = [ct.c_void_p, ct.c_int, ct.c_char_p, ct.c_void_p,
         ct.c_size_t, ct.c_char_p, ct.c_uint, ct.c_int, ct.c_char_p, ct.c_uint, ct.c_char_p]
+lib.bcc_func_load_trampoline.restype = ct.c_int
+lib.bcc_func_load_trampoline.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_char_p,
+        ct.c_int, ct.c_void_p, ct.c_int, ct.c_char_p, ct.c_uint, ct.c_int,
+        ct.c_char_p, ct.c_uint]
 _RAW_CB_TYPE = ct.CFUNCTYPE(None, ct.py_object, ct.c_void_p, ct.c_int)
 _LOST_CB_TYPE = ct.CFUNCTYPE(None, ct.py_object, ct.c_ulonglong)
 lib.bpf_attach_kprobe.restype = ct.c_int
@@ -102,6 +121,32 @@ lib.bpf_attach_uprobe.argtypes = [ct.c_int, ct.c_int, ct.c_char_p, ct.c_char_p,
         ct.c_ulonglong, ct.c_int]
 lib.bpf_detach_uprobe.restype = ct.c_int
 lib.bpf_detach_uprobe.argtypes = [ct.c_char_p]
+
+class bcc_probe_target(ct.Structure):
+    _fields_ = [
+            ('progfd', ct.c_int),
+            ('attach_type', ct.c_int),
+            ('ev_name', ct.c_char_p),
+            ('name', ct.c_char_p),
+            ('offset', ct.c_ulonglong),
+            ('pid', ct.c_int),
+            ('maxactive', ct.c_int),
+            ('pfd', ct.c_int),
+            ('err', ct.c_int),
+        ]
+
+lib.bpf_attach_kprobes.restype = ct.c_int
+lib.bpf_attach_kprobes.argtypes = [ct.POINTER(bcc_probe_target), ct.c_int,
+        ct.c_int]
+lib.bpf_detach_kprobes.restype = ct.c_int
+lib.bpf_detach_kprobes.argtypes = [ct.POINTER(bcc_probe_target), ct.c_int,
+        ct.c_int]
+lib.bpf_attach_uprobes.restype = ct.c_int
+lib.bpf_attach_uprobes.argtypes = [ct.POINTER(bcc_probe_target), ct.c_int,
+        ct.c_int]
+lib.bpf_detach_uprobes.restype = ct.c_int
+lib.bpf_detach_uprobes.argtypes = [ct.POINTER(bcc_probe_target), ct.c_int,
+        ct.c_int]
 lib.bpf_attach_tracepoint.restype = ct.c_int
 lib.bpf_attach_tracepoint.argtypes = [ct.c_int, ct.c_char_p, ct.c_char_p]
 lib.bpf_detach_tracepoint.restype = ct.c_int
@@ -114,6 +159,13 @@ lib.bpf_attach_lsm.restype = ct.c_int
 lib.bpf_attach_lsm.argtypes = [ct.c_int]
 lib.bpf_has_kernel_btf.restype = ct.c_bool
 lib.bpf_has_kernel_btf.argtypes = None
+lib.bcc_enable_stats.restype = ct.c_int
+lib.bcc_enable_stats.argtypes = [ct.POINTER(ct.c_int), ct.POINTER(ct.c_int)]
+lib.bcc_disable_stats.restype = None
+lib.bcc_disable_stats.argtypes = [ct.c_int, ct.c_int]
+lib.bcc_prog_stats.restype = ct.c_int
+lib.bcc_prog_stats.argtypes = [ct.c_int, ct.POINTER(ct.c_ulonglong),
+        ct.POINTER(ct.c_ulonglong)]
 lib.bpf_open_perf_buffer.restype = ct.c_void_p
 lib.bpf_open_perf_buffer.argtypes = [_RAW_CB_TYPE, _LOST_CB_TYPE, ct.py_object, ct.c_int, ct.c_int, ct.c_int]
 lib.bpf_open_perf_event.restype = ct.c_int
@@ -156,6 +208,14 @@ class bcc_symbol(ct.Structure):
             ('offset', ct.c_ulonglong),
         ]
 
+class bcc_symbol_line(ct.Structure):
+    _fields_ = [
+            ('function', ct.c_char_p),
+            ('file', ct.c_char_p),
+            ('line', ct.c_uint),
+            ('column', ct.c_uint),
+        ]
+
 class bcc_ip_offset_union(ct.Union):
   _fields_ = [
           ('offset', ct.c_uint64),
@@ -218,6 +278,10 @@ lib.bcc_symcache_resolve.argtypes = [ct.c_void_p, ct.c_ulonglong, ct.POINTER(bcc
 lib.bcc_symcache_resolve_no_demangle.restype = ct.c_int
 lib.bcc_symcache_resolve_no_demangle.argtypes = [ct.c_void_p, ct.c_ulonglong, ct.POINTER(bcc_symbol)]
 
+lib.bcc_symcache_resolve_lines.restype = ct.c_int
+lib.bcc_symcache_resolve_lines.argtypes = [
+    ct.c_void_p, ct.c_ulonglong, ct.POINTER(bcc_symbol_line), ct.c_int]
+
 lib.bcc_symcache_resolve_name.restype = ct.c_int
 lib.bcc_symcache_resolve_name.argtypes = [
     ct.c_void_p, ct.c_char_p, ct.c_char_p, ct.POINTER(ct.c_ulonglong)]
@@ -225,6 +289,26 @@ lib.bcc_symcache_resolve_name.argtypes = [
 lib.bcc_symcache_refresh.restype = None
 lib.bcc_symcache_refresh.argtypes = [ct.c_void_p]
 
+BCC_KALLSYMS_REGEX = 0x1
+BCC_KALLSYMS_KPROBES = 0x2
+_KALLSYMS_CB_TYPE = ct.CFUNCTYPE(ct.c_int, ct.c_char_p, ct.c_char_p,
+        ct.c_ulonglong, ct.c_void_p)
+lib.bcc_kallsyms_get.restype = ct.c_void_p
+lib.bcc_kallsyms_get.argtypes = None
+lib.bcc_kallsyms_put.restype = None
+lib.bcc_kallsyms_put.argtypes = [ct.c_void_p]
+lib.bcc_kallsyms_invalidate.restype = None
+lib.bcc_kallsyms_invalidate.argtypes = None
+lib.bcc_kallsyms_lookup_name.restype = ct.c_int
+lib.bcc_kallsyms_lookup_name.argtypes = [ct.c_void_p, ct.c_char_p,
+        ct.POINTER(ct.c_ulonglong)]
+lib.bcc_kallsyms_foreach.restype = ct.c_int
+lib.bcc_kallsyms_foreach.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_int,
+        _KALLSYMS_CB_TYPE, ct.c_void_p]
+
+lib.bcc_symcache_prefetch.restype = None
+lib.bcc_symcache_prefetch.argtypes = [ct.c_void_p, ct.c_int]
+
 lib.bcc_free_memory.restype = ct.c_int
 lib.bcc_free_memory.argtypes = None
 
@@ -243,6 +327,10 @@ lib.bcc_usdt_enable_probe.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_char_p]
 lib.bcc_usdt_enable_fully_specified_probe.restype = ct.c_int
 lib.bcc_usdt_enable_fully_specified_probe.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_char_p, ct.c_char_p]
 
+lib.bcc_usdt_enable_probes.restype = ct.c_int
+lib.bcc_usdt_enable_probes.argtypes = [ct.c_void_p, ct.POINTER(ct.c_char_p),
+        ct.POINTER(ct.c_char_p), ct.POINTER(ct.c_char_p), ct.c_int]
+
 lib.bcc_usdt_genargs.restype = ct.c_char_p
 lib.bcc_usdt_genargs.argtypes = [ct.POINTER(ct.c_void_p), ct.c_int]
 
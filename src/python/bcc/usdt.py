@@ -166,6 +166,30 @@ for a configure flag similar to --with-dtrace or --enable-dtrace.
 To check which probes are present in the process, use the tplist tool.
 """ % probe)
 
+    def enable_probes(self, probes):
+        """Enable each (probe, fn_name) of probes, all of them or none.
+        Their semaphores are then updated together, which is cheaper than
+        calling enable_probe() for each when tracing many processes."""
+        n = len(probes)
+        provider_names = (ct.c_char_p * n)()
+        probe_names = (ct.c_char_p * n)()
+        fn_names = (ct.c_char_p * n)()
+        for i, (probe, fn_name) in enumerate(probes):
+            probe_parts = probe.split(":", 1)
+            if len(probe_parts) == 2:
+                provider_names[i] = probe_parts[0].encode('ascii')
+            probe_names[i] = probe_parts[-1].encode('ascii')
+            fn_names[i] = fn_name.encode('ascii')
+        if lib.bcc_usdt_enable_probes(self.context, provider_names,
+                                      probe_names, fn_names, n) != 0:
+            raise USDTException(
+"""Failed to enable USDT probes %s:
+the specified pid might not contain the given language's runtime,
+or the runtime was not built with the required USDT probes. Look
+for a configure flag similar to --with-dtrace or --enable-dtrace.
+To check which probes are present in the process, use the tplist tool.
+""" % ", ".join("'%s'" % probe for (probe, _) in probes))
+
     def enable_probe_or_bail(self, probe, fn_name):
         try:
             self.enable_probe(probe, fn_name)
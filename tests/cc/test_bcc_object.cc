@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/bpf.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "bcc_object_loader.h"
+#include "bpf_module.h"
+#include "libbpf.h"
+#include "catch.hpp"
+
+static const std::string AOT_PROGRAM = R"(
+struct data_t {
+  u32 pid;
+  u64 count;
+};
+BPF_HASH(counts, u32, u64);
+BPF_PARAM(u64, threshold, 10);
+BPF_PERF_OUTPUT(events);
+
+int on_getuid(void *ctx) {
+  u32 pid = bpf_get_current_pid_tgid() >> 32;
+  counts.increment(pid);
+  u64 *count = counts.lookup(&pid);
+  if (count && *count > threshold.get()) {
+    struct data_t data = {pid, *count};
+    events.perf_submit(ctx, &data, sizeof(data));
+  }
+  return 0;
+}
+)";
+
+TEST_CASE("test bcc object compiled ahead of time", "[bcc_object]") {
+  char dir[] = "/tmp/bcc-object-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string path = std::string(dir) + "/prog.bcco";
+
+  {
+    ebpf::BPFModule mod(0, nullptr, false);
+    REQUIRE(mod.compile_object(AOT_PROGRAM, nullptr, 0, path) == 0);
+  }
+
+  SECTION("load without llvm") {
+    ebpf::BccObjectLoader loader;
+    REQUIRE(loader.open(path) == 0);
+
+    const ebpf::BccObject::Table *counts = loader.table("counts");
+    REQUIRE(counts != nullptr);
+    REQUIRE(counts->type == BPF_MAP_TYPE_HASH);
+    REQUIRE(counts->key_size == sizeof(uint32_t));
+    REQUIRE(counts->leaf_size == sizeof(uint64_t));
+    REQUIRE(loader.table("events") != nullptr);
+    REQUIRE(loader.function_names() == std::vector<std::string>({"on_getuid"}));
+
+    int zero = 0;
+    uint64_t limit = 100;
+    REQUIRE(loader.set_param("threshold", &limit, sizeof(limit)) == 0);
+    REQUIRE(loader.set_param("threshold", &zero, sizeof(zero)) != 0);
+    REQUIRE(loader.set_value("threshold", "x", "y") != 0);
+    REQUIRE(loader.table_fd("counts") < 0);
+
+    REQUIRE(loader.load() == 0);
+    REQUIRE(loader.table_fd("counts") >= 0);
+    uint64_t value = 0;
+    REQUIRE(bpf_lookup_elem(loader.table_fd("threshold"), &zero, &value) == 0);
+    REQUIRE(value == limit);
+
+    REQUIRE(loader.load_func("on_getuid", BPF_PROG_TYPE_KPROBE) >= 0);
+    REQUIRE(loader.load_func("missing", BPF_PROG_TYPE_KPROBE) < 0);
+  }
+
+  SECTION("load into a BPFModule") {
+    ebpf::BPFModule mod(0);
+    REQUIRE(mod.load_object(path) == 0);
+    REQUIRE(mod.num_functions() == 1);
+    REQUIRE(mod.table_fd("counts") >= 0);
+    REQUIRE(mod.table_key_size("counts") == sizeof(uint32_t));
+
+    // the default from the declaration, then a value set at run time
+    int zero = 0;
+    uint64_t value = 0;
+    int fd = mod.table_fd("threshold");
+    REQUIRE(bpf_lookup_elem(fd, &zero, &value) == 0);
+    REQUIRE(value == 10);
+    value = 20;
+    REQUIRE(mod.set_param("threshold", &value, sizeof(value)) == 0);
+    value = 0;
+    REQUIRE(bpf_lookup_elem(fd, &zero, &value) == 0);
+    REQUIRE(value == 20);
+  }
+
+  unlink(path.c_str());
+  rmdir(dir);
+}
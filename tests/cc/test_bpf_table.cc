@@ -16,7 +16,10 @@
 
 #include <linux/version.h>
 #include <unistd.h>
+#include <cstdlib>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "BPF.h"
 #include "catch.hpp"
@@ -282,3 +285,119 @@ TEST_CASE("test bpf stack_id table", "[bpf_stack_table]") {
   REQUIRE(addrs.size()==0);
 #endif
 }
+
+TEST_CASE("test bpf table init_parallel", "[bpf_table]") {
+  const int nprogs = 8;
+  std::vector<std::unique_ptr<ebpf::BPF>> owners;
+  std::vector<ebpf::BPF *> bpfs;
+  std::vector<std::string> programs;
+  for (int i = 0; i < nprogs; i++) {
+    owners.emplace_back(new ebpf::BPF);
+    bpfs.push_back(owners.back().get());
+    programs.push_back("BPF_ARRAY(myarray, int, " + std::to_string(i + 1) +
+                       ");\n");
+  }
+
+  auto results = ebpf::BPF::init_parallel(bpfs, programs, {}, 4);
+  REQUIRE(results.size() == nprogs);
+  for (auto &res : results)
+    REQUIRE(res.code() == 0);
+
+  // each program gets its own map, even though all were compiled at once
+  for (int i = 0; i < nprogs; i++) {
+    auto t = bpfs[i]->get_array_table<int>("myarray");
+    REQUIRE(t.capacity() == (size_t)i + 1);
+    REQUIRE(t.update_value(0, i).code() == 0);
+  }
+  for (int i = 0; i < nprogs; i++) {
+    auto t = bpfs[i]->get_array_table<int>("myarray");
+    int value;
+    REQUIRE(t.get_value(0, value).code() == 0);
+    REQUIRE(value == i);
+  }
+}
+
+TEST_CASE("test bpf attach group rollback", "[bpf_table]") {
+  const std::string BPF_PROGRAM = R"(
+    int on_sys_getuid(void *ctx) {
+      return 0;
+    }
+  )";
+
+  ebpf::BPF bpf;
+  ebpf::StatusTuple res(0);
+  res = bpf.init(BPF_PROGRAM);
+  REQUIRE(res.code() == 0);
+  std::string getuid_fnname = bpf.get_syscall_fnname("getuid");
+
+  ebpf::AttachGroup bad;
+  bad.add_kprobe(getuid_fnname, "on_sys_getuid")
+      .add_kprobe("bcc_no_such_kernel_function", "on_sys_getuid");
+  REQUIRE(bad.size() == 2);
+  res = bpf.attach_group(bad);
+  REQUIRE(res.code() != 0);
+
+  // the kprobe attached before the failure was detached again
+  res = bpf.detach_kprobe(getuid_fnname);
+  REQUIRE(res.code() != 0);
+
+  // a probe function that cannot be loaded fails the group with its error
+  ebpf::AttachGroup unloadable;
+  unloadable.add_kprobe(getuid_fnname, "on_sys_getuid")
+      .add_kprobe(getuid_fnname, "bcc_no_such_probe_func", BPF_PROBE_RETURN);
+  res = bpf.attach_group(unloadable);
+  REQUIRE(res.code() != 0);
+  REQUIRE(res.msg().find("bcc_no_such_probe_func") != std::string::npos);
+  REQUIRE(res.msg().find("During clean up") == std::string::npos);
+  res = bpf.detach_kprobe(getuid_fnname);
+  REQUIRE(res.code() != 0);
+
+  ebpf::AttachGroup good;
+  good.add_kprobe(getuid_fnname, "on_sys_getuid")
+      .add_kprobe(getuid_fnname, "on_sys_getuid", BPF_PROBE_RETURN);
+  res = bpf.attach_group(good);
+  REQUIRE(res.code() == 0);
+  res = bpf.attach_group(good);
+  REQUIRE(res.code() != 0);
+  res = bpf.detach_group(good);
+  REQUIRE(res.code() == 0);
+  res = bpf.detach_kprobe(getuid_fnname);
+  REQUIRE(res.code() != 0);
+}
+
+TEST_CASE("test bpf table string APIs from the program cache",
+          "[bpf_table]") {
+  const std::string BPF_PROGRAM = R"(
+    struct key_t {
+      u32 pid;
+      u64 ts;
+    };
+    BPF_TABLE("hash", struct key_t, u64, myhash, 128);
+  )";
+
+  char cache_dir[] = "/tmp/bcc-progcache-XXXXXX";
+  REQUIRE(mkdtemp(cache_dir));
+  REQUIRE(setenv("BCC_PROG_CACHE_DIR", cache_dir, 1) == 0);
+
+  // The first load compiles and saves the program, the second one reads it
+  for (int i = 0; i < 2; i++) {
+    ebpf::BPF bpf;
+    ebpf::StatusTuple res(0);
+    res = bpf.init(BPF_PROGRAM);
+    REQUIRE(res.code() == 0);
+
+    ebpf::BPFTable t = bpf.get_table("myhash");
+    res = t.update_value("{ 0x7 0x2a }", "0x42");
+    REQUIRE(res.code() == 0);
+
+    std::vector<std::pair<std::string, std::string>> elements;
+    res = t.get_table_offline(elements);
+    REQUIRE(res.code() == 0);
+    REQUIRE(elements.size() == 1);
+    REQUIRE(elements[0].first == "{ 0x7 0x2a }");
+    REQUIRE(elements[0].second == "0x42");
+  }
+
+  unsetenv("BCC_PROG_CACHE_DIR");
+  REQUIRE(system((std::string("rm -rf ") + cache_dir).c_str()) == 0);
+}
@@ -78,6 +78,57 @@ TEST_CASE("list all kernel symbols", "[c_api]") {
   bcc_procutils_each_ksym(_test_ksym, NULL);
 }
 
+static int _count_ksym(const char *sym, const char *mod, uint64_t addr,
+                       void *count) {
+  (*static_cast<int *>(count))++;
+  return 0;
+}
+
+TEST_CASE("kallsyms index", "[c_api]") {
+  if (geteuid() != 0)
+    return;
+  void *index = bcc_kallsyms_get();
+  REQUIRE(index);
+  // the index is shared within the process
+  void *other = bcc_kallsyms_get();
+  REQUIRE(other);
+
+  uint64_t addr;
+  REQUIRE(bcc_kallsyms_lookup_name(index, "startup_64", &addr) == 0);
+  REQUIRE(addr != 0x0ull);
+  struct bcc_symbol sym;
+  REQUIRE(bcc_kallsyms_lookup_addr(other, addr + 1, &sym) == 0);
+  REQUIRE(sym.offset == 1);
+  REQUIRE(bcc_kallsyms_lookup_name(index, sym.name, &addr) == 0);
+  bcc_kallsyms_put(other);
+
+  int globbed = 0, matched = 0, kprobes = 0, all = 0;
+  REQUIRE(bcc_kallsyms_foreach(index, "vfs_*", 0, _count_ksym, &globbed) == 0);
+  REQUIRE(bcc_kallsyms_foreach(index, "^vfs_", BCC_KALLSYMS_REGEX, _count_ksym,
+                               &matched) == 0);
+  REQUIRE(globbed > 0);
+  REQUIRE(globbed == matched);
+  REQUIRE(bcc_kallsyms_foreach(index, "(", BCC_KALLSYMS_REGEX, _count_ksym,
+                               &matched) < 0);
+  bcc_kallsyms_foreach(index, nullptr, BCC_KALLSYMS_KPROBES, _count_ksym,
+                       &kprobes);
+  bcc_kallsyms_foreach(index, nullptr, 0, _count_ksym, &all);
+  REQUIRE(kprobes > 0);
+  REQUIRE(kprobes < all);
+  bcc_kallsyms_put(index);
+}
+
+TEST_CASE("kallsyms index does not resolve user space addresses", "[c_api]") {
+  void *index = bcc_kallsyms_get();
+  REQUIRE(index);
+  struct bcc_symbol sym;
+  int local = 0;
+  REQUIRE(bcc_kallsyms_lookup_addr(index, (uint64_t)&local, &sym) < 0);
+  REQUIRE(bcc_kallsyms_lookup_addr(index, (uint64_t)&_count_ksym, &sym) < 0);
+  REQUIRE(bcc_kallsyms_lookup_addr(index, 0x1000, &sym) < 0);
+  bcc_kallsyms_put(index);
+}
+
 TEST_CASE("file-backed mapping identification") {
   CHECK(bcc_mapping_is_file_backed("/bin/ls") == 1);
   CHECK(bcc_mapping_is_file_backed("") == 0);
@@ -100,6 +151,28 @@ TEST_CASE("resolve symbol name in external library", "[c_api]") {
   bcc_procutils_free(sym.module);
 }
 
+TEST_CASE("resolve symbol names through the module cache", "[c_api]") {
+  struct bcc_symbol sym;
+
+  REQUIRE(bcc_resolve_symname("c", "malloc", 0x0, 0, nullptr, &sym) == 0);
+  string module = sym.module;
+  uint64_t offset = sym.offset;
+  bcc_procutils_free(sym.module);
+
+  // The second lookup is served by the cached index, and must match a
+  // lookup after dropping it
+  for (int i = 0; i < 2; i++) {
+    REQUIRE(bcc_resolve_symname("c", "malloc", 0x0, 0, nullptr, &sym) == 0);
+    REQUIRE(module == sym.module);
+    REQUIRE(sym.offset == offset);
+    bcc_procutils_free(sym.module);
+    bcc_symname_cache_invalidate();
+  }
+
+  REQUIRE(bcc_resolve_symname("c", "bcc_no_such_symbol", 0x0, 0, nullptr,
+                              &sym) < 0);
+}
+
 TEST_CASE("resolve symbol name in external library using loaded libraries", "[c_api]") {
   struct bcc_symbol sym;
 
@@ -289,6 +362,57 @@ TEST_CASE("resolve symbol addresses for a given PID", "[c_api]") {
     REQUIRE(sym_match);
   }
 
+  SECTION("resolve with symbol tables prefetched") {
+    void *libc_fptr = dlsym(NULL, "strtok");
+    REQUIRE(libc_fptr);
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)libc_fptr, &sym) == 0);
+
+    void *prefetched = bcc_symcache_new(getpid(), nullptr);
+    REQUIRE(prefetched);
+    bcc_symcache_prefetch(prefetched, 4);
+
+    REQUIRE(bcc_symcache_resolve(prefetched, (uint64_t)libc_fptr,
+                                 &lazy_sym) == 0);
+    REQUIRE(string(lazy_sym.module) == sym.module);
+    REQUIRE(string(lazy_sym.name) == sym.name);
+
+    REQUIRE(bcc_symcache_resolve(prefetched, (uint64_t)&_a_test_function,
+                                 &lazy_sym) == 0);
+    REQUIRE(string("_a_test_function") == lazy_sym.name);
+
+    bcc_free_symcache(prefetched, getpid());
+  }
+
+  SECTION("resolve after refresh") {
+    void *libc_fptr = dlsym(NULL, "strtok");
+    REQUIRE(libc_fptr);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)libc_fptr, &sym) == 0);
+    string module(sym.module);
+    string name(sym.name);
+
+    // libc's symbol table is already loaded and kept across the refresh,
+    // libbcc's is only loaded afterwards.
+    void *libbcc = dlopen(LIBBCC_NAME, RTLD_LAZY | RTLD_NOLOAD);
+    REQUIRE(libbcc);
+    void *libbcc_fptr = dlsym(libbcc, "bcc_resolve_symname");
+    REQUIRE(libbcc_fptr);
+
+    bcc_symcache_refresh(resolver);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)libc_fptr, &sym) == 0);
+    REQUIRE(module == sym.module);
+    REQUIRE(name == sym.name);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)libbcc_fptr, &sym) == 0);
+    REQUIRE(string(sym.module).find(LIBBCC_NAME) != string::npos);
+    REQUIRE(string("bcc_resolve_symname") == sym.name);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)&_a_test_function,
+                                 &sym) == 0);
+    REQUIRE(string("_a_test_function") == sym.name);
+  }
+
   SECTION("resolve in separate mount namespace") {
     pid_t child;
     uint64_t addr = 0;
@@ -312,6 +436,41 @@ TEST_CASE("resolve symbol addresses for a given PID", "[c_api]") {
   }
 }
 
+TEST_CASE("resolve symbols using the symbol index cache", "[c_api]") {
+  void *libc_fptr = dlsym(NULL, "strtok");
+  REQUIRE(libc_fptr);
+
+  struct bcc_symbol uncached_sym;
+  void *uncached = bcc_symcache_new(getpid(), nullptr);
+  REQUIRE(uncached);
+  REQUIRE(bcc_symcache_resolve(uncached, (uint64_t)libc_fptr,
+                               &uncached_sym) == 0);
+
+  char cache_dir[] = "/tmp/bcc-symidx-XXXXXX";
+  REQUIRE(mkdtemp(cache_dir));
+  REQUIRE(setenv("BCC_SYMBOL_CACHE_DIR", cache_dir, 1) == 0);
+
+  // The first resolver writes the index, the second one only maps it
+  for (int i = 0; i < 2; i++) {
+    struct bcc_symbol sym;
+    void *resolver = bcc_symcache_new(getpid(), nullptr);
+    REQUIRE(resolver);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (uint64_t)libc_fptr, &sym) == 0);
+    REQUIRE(string(uncached_sym.module) == sym.module);
+    REQUIRE(string(uncached_sym.name) == sym.name);
+    REQUIRE(uncached_sym.offset == sym.offset);
+
+    bcc_symbol_free_demangle_name(&sym);
+    bcc_free_symcache(resolver, getpid());
+  }
+
+  unsetenv("BCC_SYMBOL_CACHE_DIR");
+  bcc_symbol_free_demangle_name(&uncached_sym);
+  bcc_free_symcache(uncached, getpid());
+  REQUIRE(system(tfm::format("rm -rf %s", cache_dir).c_str()) == 0);
+}
+
 #define STACK_SIZE (1024 * 1024)
 static char child_stack[STACK_SIZE];
 
@@ -414,6 +573,47 @@ TEST_CASE("resolve symbols using /tmp/perf-pid.map", "[c_api]") {
     REQUIRE(string("right_next_door_fn") == sym.name);
   }
 
+  SECTION("same namespace, symbols appended after load") {
+    child = spawn_child(map_addr, /* own_pidns */ false, false, perf_map_func);
+    REQUIRE(child > 0);
+
+    void *resolver = bcc_symcache_new(child, nullptr);
+    REQUIRE(resolver);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (unsigned long long)map_addr,
+        &sym) == 0);
+    REQUIRE(string("dummy_fn") == sym.name);
+
+    FILE *file = fopen(perf_map_path(child).c_str(), "a");
+    REQUIRE(file);
+    fprintf(file, "%llx 10 appended_fn\n",
+        (unsigned long long)map_addr + 0x20);
+    // Newer entries win over the older ones they overlap
+    fprintf(file, "%llx 8 recompiled_fn\n", (unsigned long long)map_addr);
+    fclose(file);
+
+    bcc_symcache_refresh(resolver);
+
+    REQUIRE(bcc_symcache_resolve(resolver,
+        (unsigned long long)map_addr + 0x24, &sym) == 0);
+    REQUIRE(string("appended_fn") == sym.name);
+    REQUIRE(sym.offset == 0x4);
+
+    REQUIRE(bcc_symcache_resolve(resolver, (unsigned long long)map_addr,
+        &sym) == 0);
+    REQUIRE(string("recompiled_fn") == sym.name);
+
+    // The part of dummy_fn not covered by recompiled_fn is still there
+    REQUIRE(bcc_symcache_resolve(resolver,
+        (unsigned long long)map_addr + 0xc, &sym) == 0);
+    REQUIRE(string("dummy_fn") == sym.name);
+    REQUIRE(sym.offset == 0xc);
+
+    REQUIRE(bcc_symcache_resolve(resolver,
+        (unsigned long long)map_addr + 0x10, &sym) == 0);
+    REQUIRE(string("right_next_door_fn") == sym.name);
+  }
+
   SECTION("separate namespace") {
     child = spawn_child(map_addr, /* own_pidns */ true, false, perf_map_func);
     REQUIRE(child > 0);
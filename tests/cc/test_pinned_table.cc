@@ -84,3 +84,137 @@ TEST_CASE("test pinned table", "[pinned_table]") {
   }
 }
 #endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0)
+TEST_CASE("test pin dir across BPF objects", "[pinned_table]") {
+  bool mounted = false;
+  if (system("mount | grep /sys/fs/bpf")) {
+    REQUIRE(system("mkdir -p /sys/fs/bpf") == 0);
+    REQUIRE(system("mount -o nosuid,nodev,noexec,mode=700 -t bpf bpf /sys/fs/bpf") == 0);
+    mounted = true;
+  }
+
+  const std::string BPF_PROGRAM = R"(
+    BPF_ARRAY(counts, u64, 1);
+    RAW_TRACEPOINT_PROBE(sys_enter) {
+      counts.increment(0);
+      return 0;
+    }
+  )";
+  const std::string pin_dir = "/sys/fs/bpf/test_pin_dir";
+  uint64_t count;
+
+  // the first run pins its map and link, and exits without unpinning
+  {
+    ebpf::BPF bpf;
+    ebpf::StatusTuple res(0);
+    REQUIRE(bpf.set_pin_dir(pin_dir).code() == 0);
+    res = bpf.init(BPF_PROGRAM);
+    REQUIRE(res.code() == 0);
+    res = bpf.attach_raw_tracepoint("sys_enter", "raw_tracepoint__sys_enter");
+    REQUIRE(res.code() == 0);
+    REQUIRE(access((pin_dir + "/maps/counts").c_str(), F_OK) == 0);
+    REQUIRE(access((pin_dir + "/links/raw_sys_enter").c_str(), F_OK) == 0);
+  }
+
+  // the probe kept counting into the map the second run reuses
+  {
+    ebpf::BPF bpf;
+    ebpf::StatusTuple res(0);
+    REQUIRE(bpf.set_pin_dir(pin_dir).code() == 0);
+    res = bpf.init(BPF_PROGRAM);
+    REQUIRE(res.code() == 0);
+
+    auto counts = bpf.get_array_table<uint64_t>("counts");
+    REQUIRE(counts.get_value(0, count).code() == 0);
+    uint64_t before = count;
+    getuid();
+    REQUIRE(counts.get_value(0, count).code() == 0);
+    REQUIRE(count > before);
+
+    res = bpf.attach_raw_tracepoint("sys_enter", "raw_tracepoint__sys_enter");
+    REQUIRE(res.code() == 0);
+    res = bpf.detach_raw_tracepoint("sys_enter");
+    REQUIRE(res.code() == 0);
+    REQUIRE(access((pin_dir + "/links/raw_sys_enter").c_str(), F_OK) != 0);
+
+    REQUIRE(bpf.unpin_all().code() == 0);
+    REQUIRE(access((pin_dir + "/maps/counts").c_str(), F_OK) != 0);
+  }
+
+  REQUIRE(rmdir((pin_dir + "/maps").c_str()) == 0);
+  REQUIRE(rmdir((pin_dir + "/links").c_str()) == 0);
+  REQUIRE(rmdir(pin_dir.c_str()) == 0);
+
+  if (mounted) {
+    REQUIRE(umount("/sys/fs/bpf") == 0);
+  }
+}
+
+TEST_CASE("test pinned link replaced when the program changes",
+          "[pinned_table]") {
+  bool mounted = false;
+  if (system("mount | grep /sys/fs/bpf")) {
+    REQUIRE(system("mkdir -p /sys/fs/bpf") == 0);
+    REQUIRE(system("mount -o nosuid,nodev,noexec,mode=700 -t bpf bpf /sys/fs/bpf") == 0);
+    mounted = true;
+  }
+
+  const std::string OLD_PROGRAM = R"(
+    BPF_ARRAY(counts, u64, 2);
+    RAW_TRACEPOINT_PROBE(sys_enter) {
+      counts.increment(0);
+      return 0;
+    }
+  )";
+  const std::string NEW_PROGRAM = R"(
+    BPF_ARRAY(counts, u64, 2);
+    RAW_TRACEPOINT_PROBE(sys_enter) {
+      counts.increment(1);
+      return 0;
+    }
+  )";
+  const std::string pin_dir = "/sys/fs/bpf/test_pin_dir_replace";
+  uint64_t old_count, new_count;
+
+  {
+    ebpf::BPF bpf;
+    REQUIRE(bpf.set_pin_dir(pin_dir).code() == 0);
+    REQUIRE(bpf.init(OLD_PROGRAM).code() == 0);
+    REQUIRE(bpf.attach_raw_tracepoint("sys_enter", "raw_tracepoint__sys_enter")
+                .code() == 0);
+  }
+
+  // the new program is attached instead of adopting the old one's link
+  {
+    ebpf::BPF bpf;
+    REQUIRE(bpf.set_pin_dir(pin_dir).code() == 0);
+    REQUIRE(bpf.init(NEW_PROGRAM).code() == 0);
+    REQUIRE(bpf.attach_raw_tracepoint("sys_enter", "raw_tracepoint__sys_enter")
+                .code() == 0);
+    REQUIRE(access((pin_dir + "/links/raw_sys_enter").c_str(), F_OK) == 0);
+
+    auto counts = bpf.get_array_table<uint64_t>("counts");
+    REQUIRE(counts.get_value(0, old_count).code() == 0);
+    REQUIRE(counts.get_value(1, new_count).code() == 0);
+    uint64_t before = new_count;
+    getuid();
+    REQUIRE(counts.get_value(1, new_count).code() == 0);
+    REQUIRE(new_count > before);
+    before = old_count;
+    REQUIRE(counts.get_value(0, old_count).code() == 0);
+    REQUIRE(old_count == before);
+
+    REQUIRE(bpf.detach_raw_tracepoint("sys_enter").code() == 0);
+    REQUIRE(bpf.unpin_all().code() == 0);
+  }
+
+  REQUIRE(rmdir((pin_dir + "/maps").c_str()) == 0);
+  REQUIRE(rmdir((pin_dir + "/links").c_str()) == 0);
+  REQUIRE(rmdir(pin_dir.c_str()) == 0);
+
+  if (mounted) {
+    REQUIRE(umount("/sys/fs/bpf") == 0);
+  }
+}
+#endif
@@ -149,6 +149,55 @@ TEST_CASE("test usdt partial init w/ fail init_usdt", "[usdt]") {
   REQUIRE(res.code() == 0);
 }
 
+TEST_CASE("test shared probe filtered by PID with C++ API", "[usdt]") {
+  ebpf::BPF bpf;
+  ebpf::USDT u("/proc/self/exe", "libbcc_test", "sample_probe_1", "on_event");
+  u.set_shared(true);
+
+  const std::string BPF_PROGRAM = R"(
+BPF_ARRAY(hits, u64, 1);
+int on_event(struct pt_regs *ctx) {
+  hits.increment(0);
+  return 0;
+}
+)";
+
+  auto res = bpf.init(BPF_PROGRAM, {}, {u});
+  REQUIRE(res.msg() == "");
+  REQUIRE(res.code() == 0);
+
+  res = bpf.add_usdt_pid(u, ::getpid());
+  REQUIRE(res.code() != 0);
+
+  res = bpf.attach_usdt(u);
+  REQUIRE(res.code() == 0);
+
+  auto hits = bpf.get_array_table<uint64_t>("hits");
+  uint64_t count;
+
+  REQUIRE(a_probed_function() != 0);
+  REQUIRE(hits.get_value(0, count).code() == 0);
+  REQUIRE(count == 0);
+
+  res = bpf.add_usdt_pid(u, ::getpid());
+  REQUIRE(res.code() == 0);
+  REQUIRE(a_probed_function() != 0);
+  REQUIRE(hits.get_value(0, count).code() == 0);
+  REQUIRE(count == 1);
+
+  res = bpf.remove_usdt_pid(u, ::getpid());
+  REQUIRE(res.code() == 0);
+  REQUIRE(a_probed_function() != 0);
+  REQUIRE(hits.get_value(0, count).code() == 0);
+  REQUIRE(count == 1);
+
+  res = bpf.remove_usdt_pid(u, ::getpid());
+  REQUIRE(res.code() != 0);
+
+  res = bpf.detach_usdt(u);
+  REQUIRE(res.code() == 0);
+}
+
 class ChildProcess {
   pid_t pid_;
 
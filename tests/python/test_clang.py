@@ -2,11 +2,13 @@
 # Copyright (c) PLUMgrid, Inc.
 # Licensed under the Apache License, Version 2.0 (the "License")
 
-from bcc import BPF
+from bcc import BPF, DEBUG_PROFILE
 import ctypes as ct
 from unittest import main, skipUnless, TestCase
 import os
+import shutil
 import sys
+import tempfile
 import socket
 import struct
 from contextlib import contextmanager
@@ -1032,6 +1034,15 @@ TRACEPOINT_PROBE(skb, kfree_skb) {
 """
         b = BPF(text=text)
 
+    @skipUnless(kernel_version_ge(4,7), "requires kernel >= 4.7")
+    def test_tracepoint_probe_from_cflags(self):
+        text = """
+PROBE(skb, kfree_skb) {
+    return args->protocol;
+}
+"""
+        b = BPF(text=text, cflags=["-DPROBE=TRACEPOINT_PROBE"])
+
     def test_probe_read_kprobe_ctx(self):
         text = """
 #include <linux/sched.h>
@@ -1330,5 +1341,141 @@ int do_request(struct pt_regs *ctx, struct request *rq) {
         b = BPF(text=text)
         fns = b.load_funcs(BPF.KPROBE)
 
+    def test_prog_cache(self):
+        text = """
+struct key_t {
+  u32 pid;
+  char comm[16];
+};
+BPF_HASH(counts, struct key_t);
+int count(void *ctx) {
+  struct key_t key = {};
+  key.pid = bpf_get_current_pid_tgid();
+  counts.increment(key);
+  return 0;
+}
+"""
+        cache_dir = tempfile.mkdtemp()
+        os.environ["BCC_PROG_CACHE_DIR"] = cache_dir
+        try:
+            b = BPF(text=text)
+            b.load_func("count", BPF.KPROBE)
+            entries = [f for f in os.listdir(cache_dir)
+                       if f.endswith(".bpfc")]
+            self.assertEqual(len(entries), 1)
+            b.cleanup()
+
+            b = BPF(text=text)
+            b.load_func("count", BPF.KPROBE)
+            self.assertEqual([f for f in os.listdir(cache_dir)
+                              if f.endswith(".bpfc")], entries)
+            counts = b["counts"]
+            key = counts.Key(1, b"cached")
+            counts[key] = counts.Leaf(2)
+            self.assertEqual(counts[key].value, 2)
+            b.cleanup()
+        finally:
+            del os.environ["BCC_PROG_CACHE_DIR"]
+            shutil.rmtree(cache_dir)
+
+    def test_prog_cache_local_header(self):
+        text = b"""
+#include <cached.h>
+int count(void *ctx) {
+  return VALUE;
+}
+"""
+        cache_dir = tempfile.mkdtemp()
+        include_dir = tempfile.mkdtemp()
+        os.environ["BCC_PROG_CACHE_DIR"] = cache_dir
+        try:
+            # the header is not part of the key, the program must not be
+            # cached
+            for value in (1, 2):
+                with open(os.path.join(include_dir, "cached.h"), "w") as f:
+                    f.write("#define VALUE %d\n" % value)
+                b = BPF(text=text, cflags=["-I" + include_dir])
+                b.load_func(b"count", BPF.KPROBE)
+                b.cleanup()
+            self.assertEqual([f for f in os.listdir(cache_dir)
+                              if f.endswith(".bpfc")], [])
+        finally:
+            del os.environ["BCC_PROG_CACHE_DIR"]
+            shutil.rmtree(cache_dir)
+            shutil.rmtree(include_dir)
+
+    def test_param(self):
+        b = BPF(text=b"""
+BPF_PARAM(u64, threshold, 42);
+BPF_HASH(counts, u32);
+int count(void *ctx) {
+  u32 key = 0;
+  if (bpf_ktime_get_ns() > threshold.get())
+    counts.increment(key);
+  return 0;
+}
+""")
+        b.load_func(b"count", BPF.KPROBE)
+        self.assertEqual(b[b"threshold"][0].value, 42)
+        b.set_param(b"threshold", 7)
+        self.assertEqual(b[b"threshold"][0].value, 7)
+        b.cleanup()
+
+    def test_profile(self):
+        text = b"""
+BPF_HASH(counts, u32);
+int count(void *ctx) {
+  u32 key = 0;
+  counts.increment(key);
+  return 0;
+}
+"""
+        b = BPF(text=text)
+        b.load_func(b"count", BPF.KPROBE)
+        self.assertEqual(b.profile(), [])
+        b.cleanup()
+
+        b = BPF(text=text, debug=DEBUG_PROFILE)
+        b.load_func(b"count", BPF.KPROBE)
+        phases = [stat.name for stat in b.profile()]
+        self.assertIn(b"create maps", phases)
+        self.assertEqual(phases[-1], b"bcc_prog_load count")
+        for stat in b.profile():
+            self.assertGreaterEqual(stat.wall_ms, 0)
+            self.assertGreater(stat.max_rss_kb, 0)
+        b.cleanup()
+
+    def test_prog_stats(self):
+        text = b"""
+int count(void *ctx) {
+  return 0;
+}
+"""
+        sysctl = "/proc/sys/kernel/bpf_stats_enabled"
+        def stats_sysctl():
+            if not os.path.exists(sysctl):
+                return None
+            with open(sysctl) as f:
+                return f.read()
+        prev = stats_sysctl()
+        b = BPF(text=text)
+        try:
+            b.attach_kprobe(event=b.get_syscall_fnname(b"getppid"),
+                            fn_name=b"count")
+            try:
+                b.enable_stats()
+            except Exception:
+                self.skipTest("BPF stats not supported")
+            before = b.prog_stats()
+            for i in range(10):
+                os.getppid()
+            (run_cnt, run_time_ns) = b.prog_stats()[b"count"]
+            self.assertGreaterEqual(run_cnt - before[b"count"][0], 10)
+            self.assertGreater(run_time_ns, 0)
+        finally:
+            b.cleanup()
+        # the fallback for kernels before 5.8 sets the sysctl
+        self.assertEqual(stats_sysctl(), prev)
+
 if __name__ == "__main__":
     main()
@@ -0,0 +1,160 @@
+#!/usr/bin/env python
+#
+# USAGE: test_compile_time.py
+#
+# Measures how long BPF() takes to compile a typical tracing program, with and
+# without the precompiled kernel headers kept in BCC_PROG_CACHE_DIR, and
+# compares the generic and the BPF pass pipelines on programs from tools/.
+#
+# Copyright (c) Google LLC
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+from __future__ import print_function
+from bcc import BPF
+from bcc.libbcc import lib
+from unittest import main, TestCase
+import ctypes as ct
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+text = """
+// iteration %d
+#include <uapi/linux/ptrace.h>
+#include <linux/sched.h>
+
+struct key_t {
+    u32 pid;
+    char comm[TASK_COMM_LEN];
+};
+BPF_HASH(counts, struct key_t);
+BPF_HISTOGRAM(dist);
+
+int do_count(struct pt_regs *ctx) {
+    struct key_t key = {};
+    key.pid = bpf_get_current_pid_tgid() >> 32;
+    bpf_get_current_comm(&key.comm, sizeof(key.comm));
+    counts.increment(key);
+    dist.increment(bpf_log2l(bpf_ktime_get_ns()));
+    return 0;
+}
+"""
+
+tools_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         "../../tools")
+
+# Arguments of the tools whose programs, printed with --ebpf, are compiled by
+# test_pass_pipeline. trace.py with many probes is the slowest case.
+tools = [
+    ["biolatency.py"],
+    ["opensnoop.py"],
+    ["runqlat.py"],
+    ["tcpconnect.py"],
+    ["trace.py"] + ['%s "%%d", arg3' % fn for fn in
+                    ["vfs_read", "vfs_write", "vfs_fsync"] * 10],
+]
+
+# Program type of a function, from the prefix given to it by the macros of
+# helpers.h.
+prog_types = [
+    (b"kfunc__", BPF.TRACING),
+    (b"kretfunc__", BPF.TRACING),
+    (b"lsm__", BPF.LSM),
+    (b"tracepoint__", BPF.TRACEPOINT),
+    (b"raw_tracepoint__", BPF.RAW_TRACEPOINT),
+]
+
+def tool_text(args):
+    return subprocess.check_output(
+        [sys.executable, os.path.join(tools_dir, args[0]), "--ebpf"] + args[1:])
+
+def prog_type(name):
+    for prefix, t in prog_types:
+        if name.startswith(prefix):
+            return t
+    return BPF.KPROBE
+
+def verified_insns(b, name):
+    """Loads the function with only the verifier statistics (log level 4)
+    logged, returns the number of instructions the verifier processed or None
+    if it was rejected."""
+    log = ct.create_string_buffer(1 << 16)
+    fd = lib.bcc_func_load(b.module, prog_type(name), name,
+                           lib.bpf_function_start(b.module, name),
+                           lib.bpf_function_size(b.module, name),
+                           lib.bpf_module_license(b.module),
+                           lib.bpf_module_kern_version(b.module),
+                           4, log, ct.sizeof(log), None)
+    if fd < 0:
+        return None
+    os.close(fd)
+    m = re.search(b"processed (\\d+) insns", log.value)
+    return int(m.group(1)) if m else 0
+
+class TestCompileTime(TestCase):
+    runs = 3
+
+    def compile_time(self):
+        # Every iteration compiles a different program so that only the
+        # precompiled headers, not the compiled program cache, are reused.
+        start = time.time()
+        for i in range(self.runs):
+            b = BPF(text=text % i)
+            b.cleanup()
+        return (time.time() - start) / self.runs
+
+    def test_pch(self):
+        cold = self.compile_time()
+
+        cache_dir = tempfile.mkdtemp()
+        os.environ["BCC_PROG_CACHE_DIR"] = cache_dir
+        try:
+            # the first compilation builds the header
+            b = BPF(text=text % -1)
+            b.cleanup()
+            pch = [f for f in os.listdir(cache_dir) if f.endswith(".pch")]
+            self.assertEqual(len(pch), 1)
+
+            warm = self.compile_time()
+            pch_after = [f for f in os.listdir(cache_dir)
+                         if f.endswith(".pch")]
+            self.assertEqual(pch_after, pch)
+        finally:
+            del os.environ["BCC_PROG_CACHE_DIR"]
+            shutil.rmtree(cache_dir)
+
+        print("\ncompile time: %.3fs without, %.3fs with precompiled headers"
+              % (cold, warm))
+
+    def test_pass_pipeline(self):
+        print("\n%-14s %-8s %8s %8s %10s" % ("TOOL", "PIPELINE", "TIME(s)",
+                                            "INSNS", "VERIFIED"))
+        for args in tools:
+            text = tool_text(args)
+            loaded = {}
+            for bpf_pipeline in (False, True):
+                start = time.time()
+                b = BPF(text=text, bpf_pipeline=bpf_pipeline)
+                elapsed = time.time() - start
+                insns = verified = 0
+                for i in range(lib.bpf_num_functions(b.module)):
+                    name = lib.bpf_function_name(b.module, i)
+                    insns += lib.bpf_function_size(b.module, name) // 8
+                    n = verified_insns(b, name)
+                    # the BPF pipeline must not break programs that load
+                    if n is None:
+                        self.assertFalse(loaded.get(name), name)
+                    else:
+                        verified += n
+                        loaded[name] = True
+                b.cleanup()
+                print("%-14s %-8s %8.3f %8d %10d" % (args[0],
+                      "bpf" if bpf_pipeline else "generic", elapsed, insns,
+                      verified))
+
+if __name__ == "__main__":
+    main()
@@ -43,6 +43,19 @@ class TestKSyms(TestCase):
         found = sym in aliases
         self.assertTrue(found)
 
+    def test_kernel_symbols(self):
+        syms = BPF.get_kernel_symbols(b"vfs_*")
+        names = [name for (name, module, addr) in syms]
+        self.assertIn(b"vfs_read", names)
+        self.assertEqual(syms, BPF.get_kernel_symbols(b"^vfs_", regex=True))
+        for (name, module, addr) in syms:
+            if name == b"vfs_read":
+                self.assertEqual(BPF.ksymname(name), addr)
+        # kprobes cannot be attached to the perf code
+        self.assertEqual(set(), BPF.get_kprobe_functions(b"perf_"))
+        self.assertTrue(len(BPF.get_kernel_symbols(kprobes_only=True)) <
+                        len(BPF.get_kernel_symbols()))
+
 class Harness(TestCase):
     def setUp(self):
         self.build_command()
@@ -136,5 +149,23 @@ class TestBuildid(Harness):
     def test_resolve_addr(self):
         self.resolve_name()
 
+class TestDebugLines(TestDebuglink):
+    def build_command(self):
+        subprocess.check_output('g++ -g -o dummy dummy.cc'.split())
+        lines = subprocess.check_output('nm dummy'.split()).splitlines()
+        for line in lines:
+            if b"some_function" in line:
+                self.mangled_name = line.split(b' ')[2]
+                break
+        self.assertTrue(self.mangled_name)
+
+    def test_resolve_lines(self):
+        frames = self.syms.resolve_lines(self.addr)
+        self.assertEqual(len(frames), 1)
+        (function, filename, line, column) = frames[0]
+        self.assertEqual(function, b'some_namespace::some_function(int, int)')
+        self.assertTrue(filename.endswith(b'dummy.cc'))
+        self.assertEqual(line, 5)
+
 if __name__ == "__main__":
     main()
@@ -75,6 +75,40 @@ class TestProbeQuota(TestCase):
         self.b.cleanup()
 
 
+class TestBulkAttach(TestCase):
+    def setUp(self):
+        self.b = BPF(text="""int count(void *ctx) { return 0; }""")
+
+    def _bcc_events(self, kind):
+        suffix = b"_bcc_%d" % os.getpid()
+        with open("%s/%s_events" % (TRACEFS, kind), "rb") as f:
+            return [l for l in f if l.split()[0].endswith(suffix)]
+
+    def test_kprobes(self):
+        self.b.attach_kprobe(event_re=b"^vfs_", fn_name=b"count")
+        cnt = self.b.num_open_kprobes()
+        self.assertGreater(cnt, 0)
+        self.b.attach_kretprobe(event_re=b"^vfs_", fn_name=b"count")
+        self.assertGreater(self.b.num_open_kprobes(), cnt)
+        # attaching again is a no-op for the probes already attached
+        cnt = self.b.num_open_kprobes()
+        self.b.attach_kprobe(event_re=b"^vfs_", fn_name=b"count")
+        self.assertEqual(cnt, self.b.num_open_kprobes())
+        self.b.cleanup()
+        self.assertEqual(0, _get_num_open_probes())
+        self.assertEqual([], self._bcc_events("kprobe"))
+
+    def test_uprobes(self):
+        self.b.attach_uprobe(name=b"c", sym_re=b"^mall", fn_name=b"count")
+        self.assertGreater(self.b.num_open_uprobes(), 0)
+        self.b.cleanup()
+        self.assertEqual(0, _get_num_open_probes())
+        self.assertEqual([], self._bcc_events("uprobe"))
+
+    def tearDown(self):
+        self.b.cleanup()
+
+
 class TestProbeNotExist(TestCase):
     def setUp(self):
         self.b = BPF(text="""int count(void *ctx) { return 0; }""")
@@ -46,5 +46,58 @@ class TestKprobeReplace(TestCase):
     def test_periods(self):
         self.b.attach_kprobe(event_re=b"^tcp_enter_cwr.*", fn_name=b"empty")
 
+class TestKprobeFentry(TestCase):
+    def setUp(self):
+        self.b = BPF(text=b"""
+        BPF_ARRAY(stats, u64, 2);
+        KPROBE_FENTRY(count_entry) {
+          stats.increment(0);
+          return 0;
+        }
+        KRETPROBE_FEXIT(count_exit, 1) {
+          stats.increment(1);
+          return 0;
+        }
+        """)
+        self.event = self.b.get_syscall_fnname(b"getpid")
+
+    def check_attached(self, fentry):
+        self.b.attach_kprobe(event=self.event, fn_name=b"count_entry", fentry=fentry)
+        self.b.attach_kretprobe(event=self.event, fn_name=b"count_exit",
+                                fentry=fentry)
+        self.assertEqual(self.b.num_open_kprobes(), 2)
+        os.getpid()
+        stats = self.b[b"stats"]
+        self.assertTrue(stats[stats.Key(0)].value >= 1)
+        self.assertTrue(stats[stats.Key(1)].value >= 1)
+        self.b.detach_kprobe(self.event)
+        self.b.detach_kretprobe(self.event)
+        self.assertEqual(self.b.num_open_kprobes(), 0)
+
+    def test_fentry(self):
+        # falls back to kprobes if trampolines are not supported
+        self.check_attached(True)
+
+    def test_kprobe(self):
+        self.check_attached(False)
+
+    def test_prog_stats(self):
+        try:
+            self.b.attach_kprobe(event=self.event, fn_name=b"count_entry")
+            name = b"count_entry"
+            if self.b.trampoline_fds:
+                name = b"count_entry__fentry__" + self.event
+            try:
+                self.b.enable_stats()
+            except Exception:
+                self.skipTest("BPF stats not supported")
+            before = self.b.prog_stats()
+            for i in range(10):
+                os.getpid()
+            run_cnt = self.b.prog_stats()[name][0]
+            self.assertGreaterEqual(run_cnt - before[name][0], 10)
+        finally:
+            self.b.cleanup()
+
 if __name__ == "__main__":
     main()
@@ -6,7 +6,7 @@
 # Licensed under the Apache License, Version 2.0 (the "License")
 
 from __future__ import print_function
-from bcc import BPF, USDT
+from bcc import BPF, USDT, USDTException
 from unittest import main, TestCase
 from subprocess import Popen, PIPE
 from tempfile import NamedTemporaryFile
@@ -216,6 +216,19 @@ int do_trace5(struct pt_regs *ctx) {
             b.perf_buffer_poll()
         self.assertTrue(self.evt_st_1 == 1 and self.evt_st_2 == 1 and self.evt_st_3 == 1)
 
+    def test_enable_probes(self):
+        u = USDT(pid=int(self.app.pid))
+        # a probe that cannot be enabled leaves the others disabled
+        with self.assertRaises(USDTException):
+            u.enable_probes([("probe_point_1", "do_trace1"),
+                             ("probe_point_none", "do_trace2")])
+        u.enable_probes([("probe_point_%d" % i, "do_trace%d" % i)
+                         for i in range(1, 6)])
+        with self.assertRaises(USDTException):
+            u.enable_probes([("test:probe_point_1", "do_trace1")])
+        b = BPF(text=self.bpf_text, usdt_contexts=[u])
+        b.cleanup()
+
     def tearDown(self):
         # kill the subprocess, clean the environment
         self.app.kill()
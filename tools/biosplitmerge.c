@@ -14,6 +14,10 @@
 #include <linux/blkdev.h>
 #include <linux/version.h>
 
+/* The probes declared with KPROBE_FENTRY and KRETPROBE_FEXIT are attached
+ * as fentry/fexit programs when the kernel supports BPF trampolines, and
+ * read kernel memory with bpf_probe_read_kernel() only. */
+
 /* Split/Merge event type. */
 enum type { Split = 0, Fmerge, Bmerge, Dmerge };
 
@@ -66,31 +70,29 @@ static inline void do_entry(enum type event_type, struct bio *bio) {
 
 
 /* Function probed to entry of bio_split(). */
-int split_entry(struct pt_regs *ctx, struct bio *bio) {
+KPROBE_FENTRY(split_entry, struct bio *bio) {
 	do_entry(Split, bio);
 	return 0;
 }
 
 
 /* Function probed to entry of bio_attempt_front_merge(). */
-int front_merge_entry(struct pt_regs *ctx) {
-	// obtain the second param of the function
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
-	struct bio *bio = (struct bio *)PT_REGS_PARM2(ctx);
-#else 
-	struct bio *bio = (struct bio *)PT_REGS_PARM3(ctx);
+KPROBE_FENTRY(front_merge_entry, struct request *req, struct bio *bio) {
+#else
+KPROBE_FENTRY(front_merge_entry, struct request_queue *q, struct request *req,
+	      struct bio *bio) {
 #endif
 	do_entry(Fmerge, bio);
 	return 0;
 }
 
 /* Function probed to entry of bio_attempt_back_merge(). */
-int back_merge_entry(struct pt_regs *ctx) {
-	// obtain the bio argument of the function
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
-	struct bio *bio = (struct bio *)PT_REGS_PARM2(ctx);
-#else 
-	struct bio *bio = (struct bio *)PT_REGS_PARM3(ctx);
+KPROBE_FENTRY(back_merge_entry, struct request *req, struct bio *bio) {
+#else
+KPROBE_FENTRY(back_merge_entry, struct request_queue *q, struct request *req,
+	      struct bio *bio) {
 #endif
 	do_entry(Bmerge, bio);
 	return 0;
@@ -98,17 +100,17 @@ int back_merge_entry(struct pt_regs *ctx) {
 
 
 /* Function probed to entry of bio_attempt_discard_merge(). */
-int discard_merge_entry(struct pt_regs *ctx) {
-	struct bio *bio = (struct bio *)PT_REGS_PARM3(ctx);
+KPROBE_FENTRY(discard_merge_entry, struct request_queue *q,
+	      struct request *req, struct bio *bio) {
 	do_entry(Dmerge, bio);
 	return 0;
 }
 
 
 /* Function probed to return of bio_split(). */
-int split_return(struct pt_regs *ctx) {
+KRETPROBE_FEXIT(split_return, 4) {
 	u64 pid = bpf_get_current_pid_tgid();
-	struct bio *split = (struct bio *)PT_REGS_RC(ctx); 
+	struct bio *split = (struct bio *)ret; 
 	
 	struct val_t *valp = input.lookup(&pid); 
 	if (valp == NULL) 
@@ -136,21 +138,30 @@ int split_return(struct pt_regs *ctx) {
 
 	// fill remaining fields and emit output data to user space
 	bpf_get_current_comm(&out_data.cmd_name, sizeof(out_data.cmd_name));
+	struct gendisk *disk;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
-	struct gendisk *disk = split->bi_disk;
+	bpf_probe_read_kernel(&disk, sizeof(disk), &split->bi_disk);
 #else
-	struct gendisk *disk = split->bi_bdev->bd_disk;
+	struct block_device *bdev;
+	bpf_probe_read_kernel(&bdev, sizeof(bdev), &split->bi_bdev);
+	bpf_probe_read_kernel(&disk, sizeof(disk), &bdev->bd_disk);
 #endif
 	bpf_probe_read_kernel(&out_data.disk_name, sizeof(out_data.disk_name),
 			disk->disk_name); 
 
 	// obtain r/w flag 
 #ifdef REQ_WRITE      // kernel version < 4.8.0
-	out_data.rwflag = split->bi_rw == REQ_WRITE;
-#elif defined(REQ_OP_SHIFT)
-	out_data.rwflag = (split->bi_opf >> REQ_OP_SHIFT) == REQ_OP_WRITE;
+	unsigned long rw;
+	bpf_probe_read_kernel(&rw, sizeof(rw), &split->bi_rw);
+	out_data.rwflag = rw == REQ_WRITE;
+#else
+	unsigned int opf;
+	bpf_probe_read_kernel(&opf, sizeof(opf), &split->bi_opf);
+#ifdef REQ_OP_SHIFT
+	out_data.rwflag = (opf >> REQ_OP_SHIFT) == REQ_OP_WRITE;
 #else
-	out_data.rwflag = (split->bi_opf & REQ_OP_MASK) == REQ_OP_WRITE;
+	out_data.rwflag = (opf & REQ_OP_MASK) == REQ_OP_WRITE;
+#endif
 #endif
 	events.perf_submit(ctx, &out_data, sizeof(out_data));
 	
@@ -8,6 +8,7 @@
 # Trace both split and merge event:  ./biosplitmerge.py
 # Trace split events only:           ./biosplitmerge.py -S
 # Trace merge events only:           ./biosplitmerge.py -M
+# Use kprobes instead of fentry/fexit: ./biosplitmerge.py -K
 #
 #
 # Copyright (c) Google LLC
@@ -25,6 +26,7 @@ examples = """examples:
     ./biosplitmerge.py       # trace both split and merge events
     ./biosplitmerge.py -S    # trace split events
     ./biosplitmerge.py -M    # trace merge events
+    ./biosplitmerge.py -K    # use kprobes even if fentry/fexit is supported
 """
 parser = argparse.ArgumentParser(
 	description="Bio split/merge event tracer",
@@ -34,24 +36,27 @@ parser.add_argument("-S", "--split", action="store_true",
 	help="trace split events")
 parser.add_argument("-M", "--merge", action="store_true",
 	help="trace merge events")
+parser.add_argument("-K", "--kprobe", action="store_true",
+	help="use kprobes even if fentry/fexit is supported")
 args = parser.parse_args()
+fentry = not args.kprobe
 
 
 # load BPF program
 bpf = BPF(src_file="biosplitmerge.c")
 
 if args.split or not args.merge:
-	bpf.attach_kprobe(event="bio_split", fn_name="split_entry") 
-	bpf.attach_kretprobe(event="bio_split", fn_name="split_return") 
+	bpf.attach_kprobe(event="bio_split", fn_name="split_entry", fentry=fentry)
+	bpf.attach_kretprobe(event="bio_split", fn_name="split_return", fentry=fentry)
 
 if args.merge or not args.split:
-	bpf.attach_kprobe(event="bio_attempt_front_merge", fn_name="front_merge_entry")
-	bpf.attach_kprobe(event="bio_attempt_back_merge", fn_name="back_merge_entry")
-	bpf.attach_kprobe(event="bio_attempt_discard_merge", fn_name="discard_merge_entry")
+	bpf.attach_kprobe(event="bio_attempt_front_merge", fn_name="front_merge_entry", fentry=fentry)
+	bpf.attach_kprobe(event="bio_attempt_back_merge", fn_name="back_merge_entry", fentry=fentry)
+	bpf.attach_kprobe(event="bio_attempt_discard_merge", fn_name="discard_merge_entry", fentry=fentry)
 
-	bpf.attach_kretprobe(event="bio_attempt_front_merge", fn_name="merge_return")
-	bpf.attach_kretprobe(event="bio_attempt_back_merge", fn_name="merge_return")
-	bpf.attach_kretprobe(event="bio_attempt_discard_merge", fn_name="merge_return")
+	bpf.attach_kretprobe(event="bio_attempt_front_merge", fn_name="merge_return", fentry=fentry)
+	bpf.attach_kretprobe(event="bio_attempt_back_merge", fn_name="merge_return", fentry=fentry)
+	bpf.attach_kretprobe(event="bio_attempt_discard_merge", fn_name="merge_return", fentry=fentry)
 
 
 # header
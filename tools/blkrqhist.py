@@ -8,6 +8,7 @@
 # Usage: 
 # To run with Kprobe implementation (by default):  ./blkrqhist.py
 # With Raw tracepoint implementation:              ./blkrqhist.py -T 
+# With kprobes even if fentry is supported:        ./blkrqhist.py -K
 #
 #
 # Copyright (c) Google LLC
@@ -25,6 +26,7 @@ import argparse
 examples = """examples:
     ./blkrqhist.py       # use kprobe (default) implementation
     ./blkrqhist.py -T    # use raw tracepoint implementation
+    ./blkrqhist.py -K    # use kprobes even if fentry is supported
 """
 parser = argparse.ArgumentParser(
 	description="Latency histograms for block I/O requests",
@@ -32,7 +34,10 @@ parser = argparse.ArgumentParser(
 	epilog=examples)
 parser.add_argument("-T", "--tp", action="store_true",
 	help="use raw tracepoint implementation")
+parser.add_argument("-K", "--kprobe", action="store_true",
+	help="use kprobes even if fentry is supported")
 args = parser.parse_args()
+fentry = not args.kprobe
 
 
 # BPF program
@@ -79,15 +84,15 @@ static int rq_complete(struct request *req) {
 """
 
 bpf_text_kprobe = """
-int trace_rq_insert(struct pt_regs *ctx, struct request *req) {
+KPROBE_FENTRY(trace_rq_insert, struct request *req) {
 	return rq_insert(req);
 }
 
-int trace_rq_issue(struct pt_regs *ctx, struct request *req) {
+KPROBE_FENTRY(trace_rq_issue, struct request *req) {
 	return rq_issue(req);
 }
 
-int trace_rq_complete(struct pt_regs *ctx, struct request *req) {
+KPROBE_FENTRY(trace_rq_complete, struct request *req) {
 	return rq_complete(req);
 }
 """
@@ -113,14 +118,14 @@ RAW_TRACEPOINT_PROBE(block_rq_complete) {
 if args.tp: 	# use tracepoint 
 	bpf = BPF(text=bpf_text_head+bpf_text_tracepoint) 
 
-else:		# default: use kprobe
+else:		# default: use kprobe, or fentry if the kernel supports it
 	bpf = BPF(text=bpf_text_head+bpf_text_kprobe) 
 
-	bpf.attach_kprobe(event="blk_account_io_start", fn_name="trace_rq_insert")
+	bpf.attach_kprobe(event="blk_account_io_start", fn_name="trace_rq_insert", fentry=fentry)
 	if BPF.get_kprobe_functions(b'blk_start_request'):
-		bpf.attach_kprobe(event="blk_start_request", fn_name="trace_rq_issue")
-	bpf.attach_kprobe(event="blk_mq_start_request", fn_name="trace_rq_issue")
-	bpf.attach_kprobe(event="blk_account_io_done", fn_name="trace_rq_complete")
+		bpf.attach_kprobe(event="blk_start_request", fn_name="trace_rq_issue", fentry=fentry)
+	bpf.attach_kprobe(event="blk_mq_start_request", fn_name="trace_rq_issue", fentry=fentry)
+	bpf.attach_kprobe(event="blk_account_io_done", fn_name="trace_rq_complete", fentry=fentry)
 
 
 # header
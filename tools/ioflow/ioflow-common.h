@@ -10,14 +10,9 @@
  * 1-Sep-2020   Haoning Chen   Created this.
  */
 
-/* Set default value for time thresholds if they are not specified. */
-#ifndef SYSCALL_THRESHOLD
-#define SYSCALL_THRESHOLD 1000000
-#endif 
-
-#ifndef REQUEST_THRESHOLD
-#define REQUEST_THRESHOLD 200000
-#endif 
+/* Time thresholds in ns, set at run time by the tracer scripts. */
+BPF_PARAM(u64, syscall_threshold, 1000000);
+BPF_PARAM(u64, request_threshold, 200000);
 
 /* Value of the bpf map. */
 struct val_t {
@@ -192,9 +187,11 @@ static inline void comm_rq_create(struct rqval_t *rqval, struct val_t *val,
     rqval->seq_num = val->seq_num;
     rqval->ts_vfs = val->ts_vfs;
     rqval->ts_rqcreate = ts;
-    rqval->sector = rq->__sector;
-    rqval->len = rq->__data_len;
-    struct gendisk *disk = rq->rq_disk;
+    // rq may come from a fentry program, which cannot dereference it
+    struct gendisk *disk;
+    bpf_probe_read_kernel(&rqval->sector, sizeof(rqval->sector), &rq->__sector);
+    bpf_probe_read_kernel(&rqval->len, sizeof(rqval->len), &rq->__data_len);
+    bpf_probe_read_kernel(&disk, sizeof(disk), &rq->rq_disk);
     bpf_probe_read_kernel(&rqval->disk_name, sizeof(rqval->disk_name), 
         disk->disk_name);
 }
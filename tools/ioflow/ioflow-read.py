@@ -17,6 +17,8 @@ examples = """examples:
     ./ioflow-read.py              # Trace read io flow. Default time threshold: 1ms for syscalls and 0.2ms for requests.
     ./ioflow-read.py -s 5         # Set syscall threshold to 5ms. Print syscall data if its latency exceeds 5 ms.
     ./ioflow-read.py -s 5 -r 0.5  # Set syscall threshold to 5ms and request threshold to 0.5 ms.
+    ./ioflow-read.py -K           # Use kprobes instead of fentry/fexit
+    ./ioflow-read.py -Q           # Follow requests with kprobes instead of block_rq_* tracepoints
     Any syscall data and request data that takes time longer than the corresponding threshold is emitted. 
 """
 parser = argparse.ArgumentParser(
@@ -27,7 +29,12 @@ parser.add_argument("-s", "--sys_thres", type=float, default=1.,
     help="Set syscall threshold in ms. Emit any syscall data that takes time longer than this threshold. Default to be 1.0")
 parser.add_argument("-r", "--rq_thres", type=float, default=0.2,
     help="Set request threshold in ms. Emit any request data that takes time longer than this threshold. Default to be 0.2")
+parser.add_argument("-K", "--kprobe", action="store_true",
+    help="Attach kprobes even if the kernel supports fentry/fexit")
+parser.add_argument("-Q", "--rq-kprobe", action="store_true",
+    help="Follow requests with kprobes on the block accounting functions instead of the block_rq_* raw tracepoints")
 args = parser.parse_args()
+fentry = not args.kprobe
 
 
 # load Tracer program 
@@ -36,33 +43,36 @@ with open("ioflow-read.c") as src_f:
 with open("ioflow-common.h") as comm_f:
     comm_text = comm_f.read()
 
-sys_thres_flag = "-DSYSCALL_THRESHOLD=%d" % int(args.sys_thres * 1000000)
-rq_thres_flag = "-DREQUEST_THRESHOLD=%d" % int(args.rq_thres * 1000000)
 # load BPF program
-bpf = BPF(text=bpf_text.replace("[IMPORT_COMM]", comm_text, 1), cflags=[sys_thres_flag, rq_thres_flag])
+cflags = ["-DRQ_KPROBE"] if args.rq_kprobe else []
+bpf = BPF(text=bpf_text.replace("[IMPORT_COMM]", comm_text, 1), cflags=cflags)
+bpf.set_param("syscall_threshold", int(args.sys_thres * 1000000))
+bpf.set_param("request_threshold", int(args.rq_thres * 1000000))
 
 # file system layer:
-bpf.attach_kprobe(event="vfs_read", fn_name="vfs_read_entry")
-bpf.attach_kprobe(event="generic_file_read_iter", fn_name="page_cache_entry")
-bpf.attach_kprobe(event="__do_page_cache_readahead", fn_name="read_page_entry")
-bpf.attach_kprobe(event="ext4_mpage_readpages", fn_name="ext4_read_page_entry")
+bpf.attach_kprobe(event="vfs_read", fn_name="vfs_read_entry", fentry=fentry)
+bpf.attach_kprobe(event="generic_file_read_iter", fn_name="page_cache_entry", fentry=fentry)
+bpf.attach_kprobe(event="__do_page_cache_readahead", fn_name="read_page_entry", fentry=fentry)
+bpf.attach_kprobe(event="ext4_mpage_readpages", fn_name="ext4_read_page_entry", fentry=fentry)
 # block layer:
-bpf.attach_kprobe(event="submit_bio", fn_name="block_entry")
-bpf.attach_kretprobe(event="submit_bio", fn_name="block_return")
-bpf.attach_kprobe(event="bio_split", fn_name="split_entry")
-bpf.attach_kretprobe(event="bio_split", fn_name="split_return")
-bpf.attach_kprobe(event="bio_attempt_front_merge", fn_name="merge_entry")
-bpf.attach_kretprobe(event="bio_attempt_front_merge", fn_name="merge_return")
-bpf.attach_kprobe(event="bio_attempt_back_merge", fn_name="merge_entry")
-bpf.attach_kretprobe(event="bio_attempt_back_merge", fn_name="merge_return")
-# async request handling:
-bpf.attach_kprobe(event="blk_account_io_start", fn_name="rq_create")
-if BPF.get_kprobe_functions(b'blk_start_request'):
-	bpf.attach_kprobe(event="blk_start_request", fn_name="rq_issue")
-bpf.attach_kprobe(event="blk_mq_start_request", fn_name="rq_issue")
-bpf.attach_kprobe(event="blk_account_io_done", fn_name="rq_done")
+bpf.attach_kprobe(event="submit_bio", fn_name="block_entry", fentry=fentry)
+bpf.attach_kretprobe(event="submit_bio", fn_name="block_return", fentry=fentry)
+bpf.attach_kprobe(event="bio_split", fn_name="split_entry", fentry=fentry)
+bpf.attach_kretprobe(event="bio_split", fn_name="split_return", fentry=fentry)
+bpf.attach_kprobe(event="bio_attempt_front_merge", fn_name="merge_entry", fentry=fentry)
+bpf.attach_kretprobe(event="bio_attempt_front_merge", fn_name="merge_return", fentry=fentry)
+bpf.attach_kprobe(event="bio_attempt_back_merge", fn_name="merge_entry", fentry=fentry)
+bpf.attach_kretprobe(event="bio_attempt_back_merge", fn_name="merge_return", fentry=fentry)
+# async request handling, the block_rq_* raw tracepoints being attached
+# automatically otherwise:
+if args.rq_kprobe:
+	bpf.attach_kprobe(event="blk_account_io_start", fn_name="rq_create", fentry=fentry)
+	if BPF.get_kprobe_functions(b'blk_start_request'):
+		bpf.attach_kprobe(event="blk_start_request", fn_name="rq_issue", fentry=fentry)
+	bpf.attach_kprobe(event="blk_mq_start_request", fn_name="rq_issue", fentry=fentry)
+	bpf.attach_kprobe(event="blk_account_io_done", fn_name="rq_done", fentry=fentry)
 # end of IO:
-bpf.attach_kretprobe(event="vfs_read", fn_name="vfs_read_return")
+bpf.attach_kretprobe(event="vfs_read", fn_name="vfs_read_return", fentry=fentry)
 
 
 # header
@@ -12,6 +12,10 @@
 #include <linux/blkdev.h>
 #include <linux/fs.h>
 
+/* The probes declared with KPROBE_FENTRY and KRETPROBE_FEXIT are attached
+ * as fentry/fexit programs when the kernel supports BPF trampolines, and
+ * read kernel memory with bpf_probe_read_kernel() only. */
+
 #define IO_FLOW_SYNCWRITE 1
 // Use python string replacement to import common header code
 [IMPORT_COMM]
@@ -45,7 +49,7 @@ int vfs_write_entry(struct pt_regs *ctx, struct file *file) {
     return 0;
 }
 
-int ext4_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(ext4_entry) {
     u64 pid =  bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
     if (valp && valp->ts_ext4 == 0)
@@ -53,7 +57,7 @@ int ext4_entry(struct pt_regs *ctx) {
     return 0;
 }
 
-int write_page_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(write_page_entry) {
     u64 pid =  bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
     if (valp && valp->ts_writepg == 0)
@@ -61,7 +65,7 @@ int write_page_entry(struct pt_regs *ctx) {
     return 0;
 }
 
-int ext4_sync_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(ext4_sync_entry) {
     u64 pid =  bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
     if (valp && valp->ts_ext4sync == 0)
@@ -70,7 +74,7 @@ int ext4_sync_entry(struct pt_regs *ctx) {
 }
 
 /* BLock layer */
-int block_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(block_entry) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -80,7 +84,7 @@ int block_entry(struct pt_regs *ctx) {
     return 0;
 }
 
-int block_return(struct pt_regs *ctx) {
+KRETPROBE_FEXIT(block_return, 1) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -90,7 +94,7 @@ int block_return(struct pt_regs *ctx) {
     return 0;
 }
 
-int split_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(split_entry) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -100,7 +104,7 @@ int split_entry(struct pt_regs *ctx) {
     return 0;
 }
 
-int split_return(struct pt_regs *ctx) {
+KRETPROBE_FEXIT(split_return, 4) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -110,7 +114,7 @@ int split_return(struct pt_regs *ctx) {
     return 0;
 }
 
-int merge_entry(struct pt_regs *ctx) {
+KPROBE_FENTRY(merge_entry) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -120,7 +124,7 @@ int merge_entry(struct pt_regs *ctx) {
     return 0;
 }
 
-int merge_return(struct pt_regs *ctx) {
+KRETPROBE_FEXIT(merge_return, 3) {
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -130,8 +134,10 @@ int merge_return(struct pt_regs *ctx) {
     return 0;
 }
 
-// Async request handling
-int rq_create(struct pt_regs *ctx, struct request *rq) {
+// Async request handling. The requests are followed through the block_rq_*
+// raw tracepoints, a stable interface, unless RQ_KPROBE is defined, in
+// which case they are followed through kprobes on the accounting functions.
+static inline int do_rq_create(struct request *rq) {
     // Still in the syscall process's context now. 
     u64 ts = bpf_ktime_get_ns();
     u64 pid = bpf_get_current_pid_tgid();
@@ -144,8 +150,7 @@ int rq_create(struct pt_regs *ctx, struct request *rq) {
     return 0;
 }
 
-// The request is issued to device driver.
-int rq_issue(struct pt_regs *ctx, struct request *rq) {
+static inline int do_rq_issue(struct request *rq) {
     // Async to the syscall process now. 
     u64 ts = bpf_ktime_get_ns();
     struct rqval_t *rqvalp = request_map.lookup(&rq);
@@ -153,16 +158,15 @@ int rq_issue(struct pt_regs *ctx, struct request *rq) {
     return 0;
 }
 
-// The request is done.
-int rq_done(struct pt_regs *ctx, struct request *rq) {
+static inline int do_rq_done(void *ctx, struct request *rq) {
     u64 ts = bpf_ktime_get_ns();
     struct rqval_t *rqvalp = request_map.lookup(&rq);
     if (rqvalp) {
         struct rqdata_t rqdata = {0};
         comm_rq_done(&rqdata, rqvalp, ts);
-
+        
         // filter out data that has latency less than the threshold
-        if (rqdata.queue + rqdata.service >= REQUEST_THRESHOLD) {
+        if (rqdata.queue + rqdata.service >= request_threshold.get()) {
             rq_events.perf_submit(ctx, &rqdata, sizeof(rqdata));
         }
 
@@ -174,10 +178,53 @@ int rq_done(struct pt_regs *ctx, struct request *rq) {
     return 0;
 }
 
+#ifdef RQ_KPROBE
+// The request is created.
+KPROBE_FENTRY(rq_create, struct request *rq) {
+    return do_rq_create(rq);
+}
+
+// The request is issued to device driver.
+KPROBE_FENTRY(rq_issue, struct request *rq) {
+    return do_rq_issue(rq);
+}
+
+// The request is done.
+KPROBE_FENTRY(rq_done, struct request *rq) {
+    return do_rq_done(ctx, rq);
+}
+#else
+// block_rq_insert and block_rq_issue lost their request_queue argument in 5.11
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#define RQ_TP_ARG 0
+#else
+#define RQ_TP_ARG 1
+#endif
+
+// The request is queued.
+RAW_TRACEPOINT_PROBE(block_rq_insert) {
+    return do_rq_create((struct request *)ctx->args[RQ_TP_ARG]);
+}
+
+// The request is issued to device driver. Requests issued directly are
+// never queued, they are created here, still in the syscall's context.
+RAW_TRACEPOINT_PROBE(block_rq_issue) {
+    struct request *rq = (struct request *)ctx->args[RQ_TP_ARG];
+    if (!request_map.lookup(&rq))
+        do_rq_create(rq);
+    return do_rq_issue(rq);
+}
+
+// The request is done.
+RAW_TRACEPOINT_PROBE(block_rq_complete) {
+    // TP_PROTO(struct request *rq, int error, unsigned int nr_bytes)
+    return do_rq_done(ctx, (struct request *)ctx->args[0]);
+}
+#endif
+
 // The end of the write IO
-int vfs_write_return(struct pt_regs *ctx) {
-    struct file *file = (struct file *) PT_REGS_PARM1(ctx);
-    ssize_t size = (ssize_t) PT_REGS_RC(ctx);
+KRETPROBE_FEXIT(vfs_write_return, 4) {
+    ssize_t size = (ssize_t) ret;
     u64 pid =  bpf_get_current_pid_tgid();
 
     struct val_t *valp = syscall_map.lookup(&pid);
@@ -216,7 +263,7 @@ int vfs_write_return(struct pt_regs *ctx) {
         data.ext4sync = ts_end - valp->ts_ext4sync;
 
     // filter out data that has latency less than the threshold
-    if (data.total >= SYSCALL_THRESHOLD) {
+    if (data.total >= syscall_threshold.get()) {
         syscall_events.perf_submit(ctx, &data, sizeof(data));
     }
     syscall_map.delete(&pid);
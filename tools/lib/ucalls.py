@@ -15,7 +15,8 @@
 from __future__ import print_function
 import argparse
 from time import sleep
-from bcc import BPF, USDT, utils
+import sys
+from bcc import BPF, USDT, USDTException, utils
 from bcc.syscall import syscall_name
 
 languages = ["java", "perl", "php", "python", "ruby", "tcl"]
@@ -251,9 +252,14 @@ TRACEPOINT_PROBE(raw_syscalls, sys_exit) {
 
 if language:
     usdt = USDT(pid=args.pid)
-    usdt.enable_probe_or_bail(entry_probe, "trace_entry")
+    probes = [(entry_probe, "trace_entry")]
     if args.latency:
-        usdt.enable_probe_or_bail(return_probe, "trace_return")
+        probes.append((return_probe, "trace_return"))
+    try:
+        usdt.enable_probes(probes)
+    except USDTException as e:
+        print(e, file=sys.stderr)
+        exit(1)
 else:
     usdt = None
 
@@ -13,10 +13,11 @@
 
 from __future__ import print_function
 import argparse
-from bcc import BPF, USDT, utils
+from bcc import BPF, USDT, USDTException, utils
 import ctypes as ct
 import time
 import os
+import sys
 
 languages = ["java", "perl", "php", "python", "ruby", "tcl"]
 
@@ -101,7 +102,7 @@ int NAME(struct pt_regs *ctx) {
 """
 
 def enable_probe(probe_name, func_name, read_class, read_method, is_return):
-    global program, trace_template, usdt
+    global program, trace_template, probes
     depth = "*depth + 1" if not is_return else "*depth | (1ULL << 63)"
     update = "++(*depth);" if not is_return else "if (*depth) --(*depth);"
     filter_class = "if (!prefix_class(data.clazz)) { return 0; }" \
@@ -115,9 +116,10 @@ def enable_probe(probe_name, func_name, read_class, read_method, is_return):
                              .replace("FILTER_METHOD", filter_method)   \
                              .replace("DEPTH", depth)                   \
                              .replace("UPDATE", update)
-    usdt.enable_probe_or_bail(probe_name, func_name)
+    probes.append((probe_name, func_name))
 
 usdt = USDT(pid=args.pid)
+probes = []
 
 language = args.language
 if not language:
@@ -175,6 +177,13 @@ else:
     print("No language detected; use -l to trace a language.")
     exit(1)
 
+# enable the probes together, to update their semaphores at once
+try:
+    usdt.enable_probes(probes)
+except USDTException as e:
+    print(e, file=sys.stderr)
+    exit(1)
+
 if args.ebpf or args.verbose:
     if args.verbose:
         print(usdt.get_text())